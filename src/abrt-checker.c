@@ -57,8 +57,17 @@
 #include <jvmticmlr.h>
 
 /* Internal tool includes */
-#include "jthread_map.h"
-#include "jthrowable_circular_buf.h"
+#include "report_queue.h"
+#include "jni_cache.h"
+#include "class_metadata.h"
+#include "class_index.h"
+#include "frame_cache.h"
+#include "string_builder.h"
+#include "report_arena.h"
+#include "abrt_socket.h"
+#include "report_limiter.h"
+#include "report_dedup.h"
+#include "uncaught_handler.h"
 
 
 /* Configuration of processed JVMTI Events */
@@ -94,32 +103,42 @@
 /* Max. length of reason message */
 #define MAX_REASON_MESSAGE_STRING_LENGTH 255
 
-/* Max. length of stack trace */
-#define MAX_STACK_TRACE_STRING_LENGTH 10000
-
-/* Depth of stack trace */
-#define MAX_STACK_TRACE_DEPTH 5
+/* Max. number of cached stack frames and line number tables */
+#define FRAME_CACHE_CAPACITY 16384
 
 #define DEFAULT_THREAD_NAME "DefaultThread"
 
+/* Name of the agent threads delivering reports */
+#define REPORT_WORKER_THREAD_NAME "ABRT Reporter"
+
+/* Name of the agent thread releasing coalesced reports */
+#define REPORT_DEDUP_THREAD_NAME "ABRT Deduplicator"
+
+/* Max. number of coalesced exceptions waiting for their windows to close */
+#define REPORT_DEDUP_CAPACITY 1024
+
+/* Number of local references created while generating a stack trace */
+#define STACK_TRACE_LOCAL_FRAME_CAPACITY 16
+
 /* Fields which needs to be filled when calling ABRT */
 #define FILENAME_TYPE_VALUE      "Java"
 #define FILENAME_ANALYZER_VALUE  "Java"
 
-/* Name of two methods from URL class */
-#define TO_EXTERNAL_FORM_METHOD_NAME "toExternalForm"
-#define GET_PATH_METHOD_NAME "getPath"
-
 /* Default main class name */
 #define UNKNOWN_CLASS_NAME "*unknown*"
 
 /* The standard stack trace caused by header */
 #define CAUSED_STACK_TRACE_HEADER "Caused by: "
 
-/* A number stored reported exceptions */
-#ifndef REPORTED_EXCEPTION_STACK_CAPACITY
-#define  REPORTED_EXCEPTION_STACK_CAPACITY 5
-#endif
+/* Max. number of problem data items common for all ABRT reports */
+#define PROBLEM_DATA_TEMPLATE_CAPACITY 8
+
+/* Maximal size of problem data submitted to ABRT */
+#define MAX_PROBLEM_DATA_SIZE (4 * 1024 * 1024)
+
+/* Maximal number of problems waiting for delivery to ABRT */
+#define ABRT_SOCKET_CAPACITY 256
+
 
 
 /*
@@ -166,25 +185,105 @@ typedef struct {
  */
 typedef struct {
     const char *label; ///< FQDN static method returning String
-    char *data;        ///< Return value of the method's call
+    char *data;        ///< Return value of the method's call, in the report's arena
 } T_infoPair;
 
 
 
+/*
+ * This structure holds data captured at the time an exception was thrown
+ * which are needed for generating the stack trace later. Its memory belongs
+ * to the report's arena.
+ */
+typedef struct {
+    char *thread_name;         ///< name of the throwing thread
+    jobject exception;         ///< global reference to the thrown exception, set by submit_report()
+    jvmtiFrameInfo *frames;    ///< stack of the throwing thread or NULL if the frames are taken from the exception
+    jint frame_count;          ///< number of frames
+    jmethodID bottom_method;   ///< the bottom most method of the stack or NULL
+    int executable;            ///< the executable is determined from the stack
+} T_rawStackTrace;
+
+
+
+/*
+ * This structure holds numbers of exceptions which were not reported on their
+ * own but are accounted to a report.
+ */
+typedef struct {
+    size_t suppressed;               ///< number of similar exceptions suppressed before this one
+    size_t occurrences;              ///< number of coalesced occurrences including the reported one or 0
+    time_t first_seen;               ///< time of the first coalesced occurrence
+    time_t last_seen;                ///< time of the last coalesced occurrence
+} T_reportCounters;
+
+
+
 /*
  * This structure is representation of a single report of an exception.
+ *
+ * The structure and all its strings are allocated from the report's arena.
  */
 typedef struct {
+    T_reportArena *arena;            ///< memory of the report
     char *message;
     char *stacktrace;
     char *executable;
     char *exception_type_name;
     T_infoPair *additional_info;
-    jobject exception_object;
+    jobject exception_object;        ///< global reference to a postponed exception or NULL
+    jmethodID method;                ///< method throwing a postponed exception
+    T_reportCounters counters;       ///< exceptions accounted to the report
+    uint64_t fingerprint;            ///< stack fingerprint if repeats are coalesced into the report or 0
+    uint64_t limit_fingerprint;      ///< stack fingerprint charged to the rate limit once a postponed report is emitted or 0
+    T_rawStackTrace *raw_stacktrace; ///< not yet generated stack trace
 } T_exceptionReport;
 
 
 
+/*
+ * This structure represents a single item of problem data sent to ABRT.
+ */
+typedef struct {
+    const char *name;
+    char *value;
+} T_problemDataItem;
+
+
+
+/*
+ * This structure holds counters of the agent's work. The counters are
+ * updated atomically and printed when JVM shuts down.
+ */
+typedef struct {
+    size_t probed;          ///< exceptions which went through the probe stage
+    size_t coalesced;       ///< probed exceptions counted to a pending coalesced report
+    size_t rate_limited;    ///< probed exceptions exceeding the rate limit
+} T_agentStatistics;
+
+
+
+/*
+ * This structure holds data of a single Java thread. It is stored in JVMTI
+ * thread local storage and it is accessed only by its own thread, hence it
+ * does not need any locking.
+ */
+typedef struct {
+    /* Postponed report of an uncaught exception. There should be only 1 per thread. */
+    T_exceptionReport *uncaught_exception;
+
+    /* The thread is an agent's reporting thread and its exceptions are ignored */
+    int reporting_thread;
+
+    /* Cached name of the thread, see get_cached_thread_name() */
+    char *name;
+
+    /* Weak global reference to the String object the name was taken from */
+    jobject name_object;
+} T_threadState;
+
+
+
 /* Global monitor lock */
 jrawMonitorID shared_lock;
 
@@ -205,41 +304,68 @@ T_jvmEnvironment jvmEnvironment;
 /* Structure containing process properties. */
 T_processProperties processProperties;
 
-/* Map of buffer for already reported exceptions to prevent re-reporting */
-T_jthreadMap *threadMap;
-
-/* Map of uncaught exceptions. There should be only 1 per thread.*/
-T_jthreadMap *uncaughtExceptionMap;
-
 /* Configuration */
 T_configuration globalConfig;
 
-/* forward headers */
-static char* get_path_to_class(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jclass class, char *class_name, const char *stringize_method_name);
-static void print_jvm_environment_variables_to_file(FILE *out);
-static char* format_class_name(char *class_signature, char replace_to);
-static int check_jvmti_error(jvmtiEnv *jvmti_env, jvmtiError error_code, const char *str);
-static jclass find_class_in_loaded_class(jvmtiEnv *jvmti_env, JNIEnv *jni_env, const char *searched_class_name);
+/* Reports waiting for the reporting threads. NULL if reports are delivered
+ * from the throwing thread. */
+T_reportQueue *reportQueue;
 
+/* The reporting threads were asked to finish */
+int reportWorkerStopped;
 
+/* Loaded classes by their names */
+T_classIndex *classIndex;
 
-/*
- * Frees memory of given array terminated by empty entry.
- */
-static void info_pair_vector_free(T_infoPair *pairs)
-{
-    if (NULL == pairs)
-    {
-        return;
-    }
+/* Formatted frames of stacks got from JVMTI */
+T_frameCache *frameCache;
 
-    for (T_infoPair *iter = pairs; iter->label; ++iter)
-    {
-        free(iter->data);
-    }
+/* Problem data common for all ABRT reports terminated by an empty item.
+ * Built once after VM init and never modified. */
+T_problemDataItem problemDataTemplate[PROBLEM_DATA_TEMPLATE_CAPACITY + 1];
 
-    free(pairs);
-}
+/* Delivers problems to abrtd. NULL if ABRT reporting is disabled. */
+T_abrtSocket *abrtSocket;
+
+/* The ABRT socket was asked to deliver the queued problems and finish */
+int abrtSocketStopped;
+
+/* Limits reports of similar exceptions. NULL if the rate is not limited. */
+T_reportLimiter *reportLimiter;
+
+/* Coalesces repeated exceptions. NULL if every exception is reported on its
+ * own. */
+T_reportDedup *reportDedup;
+
+/* The deduplicating thread was asked to release all reports and finish */
+int reportDedupStopped;
+
+/* Counters of the agent's work */
+T_agentStatistics agentStatistics;
+
+/* Environment used by the agent's uncaught exception handler. NULL if
+ * uncaught exceptions are detected by exception events. */
+jvmtiEnv *uncaughtHandlerJvmtiEnv;
+
+/* forward headers */
+static char* get_path_to_class(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jclass class, char *class_name, jmethodID stringize_method);
+static void print_jvm_environment_variables_to_file(FILE *out);
+static char* format_class_name(char *class_signature, char replace_to);
+static int check_jvmti_error(jvmtiEnv *jvmti_env, jvmtiError error_code, const char *str);
+static jclass find_class_in_loaded_class(jvmtiEnv *jvmti_env, JNIEnv *jni_env, const char *searched_class_name);
+static void index_loaded_classes(jvmtiEnv *jvmti_env, JNIEnv *jni_env);
+static void enter_critical_section(jvmtiEnv *jvmti_env, jrawMonitorID monitor);
+static void exit_critical_section(jvmtiEnv *jvmti_env, jrawMonitorID monitor);
+static char *generate_thread_stack_trace(jvmtiEnv *jvmti_env, JNIEnv *jni_env, const T_rawStackTrace *raw, T_reportArena *arena, char **executable);
+static char *generate_frames_stack_trace(jvmtiEnv *jvmti_env, JNIEnv *jni_env, const T_rawStackTrace *raw, const char *exception_type_name, T_reportArena *arena, char **executable);
+static inline int check_and_clear_exception(JNIEnv *jni_env);
+static T_threadState *get_or_create_thread_state(jvmtiEnv *jvmti_env, jthread thread);
+static void report_uncaught_exception(JNIEnv *jni_env, jobject thread, jthrowable exception);
+static void watch_loaded_exception_constructors(jvmtiEnv *jvmti_env, JNIEnv *jni_env);
+static void exception_report_describe_method(jvmtiEnv *jvmti_env, JNIEnv *jni_env, T_exceptionReport *rpt, const char *occurrence, jmethodID method);
+static int exception_events_required(void);
+static int postponed_report_rate_limited(T_exceptionReport *rpt);
+jvmtiError set_event_notification_mode(jvmtiEnv* jvmti_env, int event);
 
 
 
@@ -291,21 +417,53 @@ static char *info_pair_vector_to_string(T_infoPair *pairs)
 
 
 /*
- * Frees memory of given report structure.
+ * Releases the reference to the exception held by given raw stack trace.
+ *
+ * The memory of the raw stack trace is released with the report's arena.
+ *
+ * @param jni_env JNI environment of the current thread or NULL if the global
+ *                reference to the exception cannot be released anymore
+ * @param raw Accepts NULL
+ */
+static void raw_stack_trace_release(JNIEnv *jni_env, T_rawStackTrace *raw)
+{
+    if (NULL == raw)
+    {
+        return;
+    }
+
+    if (NULL != jni_env && NULL != raw->exception)
+    {
+        (*jni_env)->DeleteGlobalRef(jni_env, raw->exception);
+    }
+
+    raw->exception = NULL;
+}
+
+
+
+/*
+ * Frees memory of given report structure including the structure itself.
+ *
+ * @param jni_env JNI environment of the current thread or NULL (see
+ *                raw_stack_trace_release())
  */
-static void exception_report_free(T_exceptionReport *report)
+static void exception_report_free(JNIEnv *jni_env, T_exceptionReport *report)
 {
     if (NULL == report)
     {
         return;
     }
 
-    free(report->message);
-    free(report->stacktrace);
-    free(report->executable);
-    free(report->exception_type_name);
+    if (NULL != jni_env && NULL != report->exception_object)
+    {
+        (*jni_env)->DeleteGlobalRef(jni_env, report->exception_object);
+    }
+
+    raw_stack_trace_release(jni_env, report->raw_stacktrace);
 
-    info_pair_vector_free(report->additional_info);
+    /* The report lives in its arena */
+    report_arena_release(report->arena);
 }
 
 
@@ -530,6 +688,28 @@ static char *get_exception_type_name(
  * Returns non zero value if exception's type is intended to be reported even
  * if the exception was caught.
  */
+static int exception_type_is_listed(
+        const char *exception_type)
+{
+    for (char **cursor = globalConfig.reportedCaughExceptionTypes; NULL != cursor && NULL != *cursor; ++cursor)
+    {
+        if (strcmp(*cursor, exception_type) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Returns non zero value if exception object is intended to be reported even
+ * if it was caught.
+ *
+ * @param exception_type Set to the mallocated type name if it is NULL
+ */
 static int exception_is_intended_to_be_reported(
         jvmtiEnv *jvmti_env,
         JNIEnv *jni_env,
@@ -548,14 +728,7 @@ static int exception_is_intended_to_be_reported(
         }
 
         /* special cases for selected exceptions */
-        for (char **cursor = globalConfig.reportedCaughExceptionTypes; *cursor; ++cursor)
-        {
-            if (strcmp(*cursor, *exception_type) == 0)
-            {
-                retval = 1;
-                break;
-            }
-        }
+        retval = exception_type_is_listed(*exception_type);
     }
 
     return retval;
@@ -564,9 +737,23 @@ static int exception_is_intended_to_be_reported(
 
 
 /*
- * Add JVM environment data into ABRT event message.
+ * Returns non zero if exceptions of the listed types are detected by
+ * breakpoints in their constructors instead of exception events.
  */
-static void add_jvm_environment_data(problem_data_t *pd)
+static int exception_constructors_watched(void)
+{
+    return CE_DETECTION_CONSTRUCTOR == globalConfig.caughtDetection
+        && NULL != globalConfig.reportedCaughExceptionTypes;
+}
+
+
+
+/*
+ * Formats JVM environment data for ABRT event message.
+ *
+ * @returns Mallocated memory or NULL
+ */
+static char *format_jvm_environment_data(void)
 {
     char *jvm_env = NULL;
     size_t sizeloc = 0;
@@ -575,56 +762,116 @@ static void add_jvm_environment_data(problem_data_t *pd)
     if (NULL == mem)
     {
         perror("Skipping 'jvm_environment' problem element. open_memstream");
-        return;
+        return NULL;
     }
 
     print_jvm_environment_variables_to_file(mem);
     fclose(mem);
 
-    problem_data_add_text_editable(pd, "jvm_environment", jvm_env);
-    free(jvm_env);
+    return jvm_env;
+}
+
+
+
+/*
+ * Appends an item to the problem data template.
+ *
+ * @param value Mallocated memory, the template takes its ownership. Accepts
+ *              NULL, the item is skipped.
+ */
+static void problem_data_template_add(const char *name, char *value)
+{
+    if (NULL == value)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": skipping '%s' problem element\n", name);
+        return;
+    }
+
+    T_problemDataItem *item = problemDataTemplate;
+    while (NULL != item->name)
+    {
+        ++item;
+    }
+
+    if (item == problemDataTemplate + PROBLEM_DATA_TEMPLATE_CAPACITY)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": problem data template is full, skipping '%s'\n", name);
+        free(value);
+        return;
+    }
+
+    item->name = name;
+    item->value = value;
 }
 
 
 
 /*
- * Add process properties into ABRT event message.
+ * Builds the problem data common for all ABRT reports from JVM environment
+ * data and process properties, so the reports need not to format them again.
+ *
+ * Must be called once after fill_jvm_environment() and
+ * fill_process_properties() in the critical section, before any report is
+ * delivered.
  */
-static void add_process_properties_data(problem_data_t *pd)
+static void problem_data_template_build(void)
 {
-    pid_t pid = getpid();
+    char s[11];
+    get_uid_as_string(s);
+    problem_data_template_add(FILENAME_UID, strdup(s));
 
-    char *environ = get_environ(pid);
-    problem_data_add_text_editable(pd, FILENAME_ENVIRON, environ ? environ : "");
-    free(environ);
+    problem_data_template_add("jvm_environment", format_jvm_environment_data());
 
-    char pidstr[20];
-    get_pid_as_string(pidstr);
-    problem_data_add_text_editable(pd, FILENAME_PID, pidstr);
-    problem_data_add_text_editable(pd, FILENAME_CMDLINE, null2empty(processProperties.exec_command));
-    if (!problem_data_get_content_or_NULL(pd, FILENAME_EXECUTABLE))
+    if (!globalConfig.resampleEnviron)
     {
-        problem_data_add_text_editable(pd, FILENAME_EXECUTABLE, null2empty(processProperties.executable));
+        char *environ = get_environ(getpid());
+        problem_data_template_add(FILENAME_ENVIRON, NULL != environ ? environ : strdup(""));
     }
-    else
+
+    char pidstr[20];
+    get_pid_as_string(pidstr);
+    problem_data_template_add(FILENAME_PID, strdup(pidstr));
+    problem_data_template_add(FILENAME_CMDLINE, strdup(null2empty(processProperties.exec_command)));
+
+    /* executable of the report is the one determined from a stack trace */
+    problem_data_template_add("java_executable", strdup(null2empty(processProperties.executable)));
+
+    problem_data_template_add("abrt-java-connector", strdup(VERSION));
+}
+
+
+
+/*
+ * Frees memory of the problem data template.
+ */
+static void problem_data_template_free(void)
+{
+    for (T_problemDataItem *item = problemDataTemplate; NULL != item->name; ++item)
     {
-        problem_data_add_text_editable(pd, "java_executable", null2empty(processProperties.executable));
+        free(item->value);
     }
+
+    memset(problemDataTemplate, 0, sizeof(problemDataTemplate));
 }
 
 
 
 /*
- * Add additional debug info item.
+ * Appends the additional debug info item.
+ *
+ * @returns 0 on success or if there is no info; otherwise non zero
  */
-static void add_additional_info_data(problem_data_t *pd, T_infoPair *additional_info)
+static int append_additional_info_data(T_stringBuilder *problem, T_infoPair *additional_info)
 {
     char *contents = info_pair_vector_to_string(additional_info);
-    if (NULL != contents)
+    if (NULL == contents)
     {
-        problem_data_add_text_editable(pd, "java_custom_debug_info", contents);
-        free(contents);
+        return 0;
     }
+
+    const int retval = abrt_socket_append_item(problem, "java_custom_debug_info", contents);
+    free(contents);
+    return retval;
 }
 
 
@@ -632,12 +879,16 @@ static void add_additional_info_data(problem_data_t *pd, T_infoPair *additional_
 /*
  * Register new ABRT event using given message and a method name.
  * If reportErrosTo global flags doesn't contain ED_ABRT, this function does nothing.
+ *
+ * The problem data are only queued, they are delivered to abrtd by
+ * the ABRT socket's thread.
  */
 static void register_abrt_event(
         const char *executable,
         const char *message,
         const char *backtrace,
-        T_infoPair *additional_info)
+        T_infoPair *additional_info,
+        const T_reportCounters *counters)
 {
     if ((globalConfig.reportErrosTo & ED_ABRT) == 0)
     {
@@ -645,61 +896,152 @@ static void register_abrt_event(
         return;
     }
 
-    char s[11];
-    problem_data_t *pd = problem_data_new();
+    if (NULL == abrtSocket)
+    {
+        fprintf(stderr, "ABRT problem creation: 'failure'\n");
+        return;
+    }
 
-    /* fill in all required fields */
-    problem_data_add_text_editable(pd, FILENAME_TYPE, FILENAME_TYPE_VALUE);
-    problem_data_add_text_editable(pd, FILENAME_ANALYZER, FILENAME_ANALYZER_VALUE);
+    /* The thread's builder is not used by the caller, the stack trace has
+     * already been copied from it */
+    T_stringBuilder *problem = string_builder_get_thread_builder(MAX_PROBLEM_DATA_SIZE);
+    if (NULL == problem)
+    {
+        fprintf(stderr, "ABRT problem creation: 'failure'\n");
+        return;
+    }
 
-    get_uid_as_string(s);
-    problem_data_add_text_editable(pd, FILENAME_UID, s);
+    /* fill in all required fields, uid is in the template */
+    int failed = abrt_socket_append_item(problem, FILENAME_TYPE, FILENAME_TYPE_VALUE)
+        || abrt_socket_append_item(problem, FILENAME_ANALYZER, FILENAME_ANALYZER_VALUE)
+        /* executable must belong to some package otherwise ABRT refuse it */
+        || abrt_socket_append_item(problem, FILENAME_EXECUTABLE, executable)
+        || abrt_socket_append_item(problem, FILENAME_BACKTRACE, backtrace)
+        /* type and analyzer are the same for abrt, we keep both just for sake of comaptibility */
+        || abrt_socket_append_item(problem, FILENAME_REASON, message);
+    /* end of required fields */
 
-    /* executable must belong to some package otherwise ABRT refuse it */
-    problem_data_add_text_editable(pd, FILENAME_EXECUTABLE, executable);
-    problem_data_add_text_editable(pd, FILENAME_BACKTRACE, backtrace);
+    /* add fields common for all reports */
+    for (const T_problemDataItem *item = problemDataTemplate; !failed && NULL != item->name; ++item)
+    {
+        failed = abrt_socket_append_item(problem, item->name, item->value);
+    }
 
-    /* type and analyzer are the same for abrt, we keep both just for sake of comaptibility */
-    problem_data_add_text_editable(pd, FILENAME_REASON, message);
-    /* end of required fields */
+    if (!failed && globalConfig.resampleEnviron)
+    {
+        char *environ = get_environ(getpid());
+        failed = abrt_socket_append_item(problem, FILENAME_ENVIRON, environ ? environ : "");
+        free(environ);
+    }
 
     /* add optional fields */
-    add_jvm_environment_data(pd);
-    add_process_properties_data(pd);
-    add_additional_info_data(pd, additional_info);
-    problem_data_add_text_noteditable(pd, "abrt-java-connector", VERSION);
+    char numstr[24];
+    if (!failed && NULL != counters && 0 != counters->suppressed)
+    {
+        snprintf(numstr, sizeof(numstr), "%zu", counters->suppressed);
+        failed = abrt_socket_append_item(problem, "suppressed_similar", numstr);
+    }
+
+    if (!failed && NULL != counters && counters->occurrences > 1)
+    {
+        snprintf(numstr, sizeof(numstr), "%zu", counters->occurrences);
+        failed = abrt_socket_append_item(problem, "occurrences", numstr);
+
+        snprintf(numstr, sizeof(numstr), "%lld", (long long)counters->first_seen);
+        failed = failed || abrt_socket_append_item(problem, "first_seen", numstr);
+
+        snprintf(numstr, sizeof(numstr), "%lld", (long long)counters->last_seen);
+        failed = failed || abrt_socket_append_item(problem, "last_seen", numstr);
+    }
+
+    if (failed || append_additional_info_data(problem, additional_info))
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": problem data exceed %d bytes\n", MAX_PROBLEM_DATA_SIZE);
+        fprintf(stderr, "ABRT problem creation: 'failure'\n");
+        return;
+    }
+
+    /* the result of creation is printed by the ABRT socket's thread */
+    if (abrt_socket_submit(abrtSocket, string_builder_cstr(problem), string_builder_length(problem)))
+    {
+        fprintf(stderr, "ABRT problem creation: 'failure'\n");
+    }
+}
+
+
+
+/*
+ * Formats a time of a coalesced occurrence for humans
+ */
+static const char *format_occurrence_time(time_t time, char *buffer, size_t size)
+{
+    struct tm tm;
+    if (NULL == localtime_r(&time, &tm) || 0 == strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &tm))
+    {
+        snprintf(buffer, size, "%lld", (long long)time);
+    }
 
-    /* sends problem data to abrtd over the socket */
-    int res = problem_data_send_to_abrt(pd);
-    fprintf(stderr, "ABRT problem creation: '%s'\n", res ? "failure" : "success");
-    problem_data_free(pd);
+    return buffer;
 }
 
 
 
 /*
  * Report a stack trace to all systems
+ *
+ * @param counters Exceptions which were not reported on their own but are
+ *        accounted to this report or NULL
  */
 static void report_stacktrace(
         const char *executable,
         const char *message,
         const char *stacktrace,
-        T_infoPair *additional_info)
+        T_infoPair *additional_info,
+        const T_reportCounters *counters)
 {
+    static const T_reportCounters s_noCounters;
+    if (NULL == counters)
+    {
+        counters = &s_noCounters;
+    }
+
     if (globalConfig.reportErrosTo & ED_SYSLOG)
     {
         VERBOSE_PRINT("Reporting stack trace to syslog\n");
-        syslog(LOG_ERR, "%s\n%s", message, stacktrace);
+        char suffix[96] = "";
+        size_t len = 0;
+        if (counters->occurrences > 1)
+            len = snprintf(suffix, sizeof(suffix), " (%zu occurrences)", counters->occurrences);
+        if (0 != counters->suppressed && len < sizeof(suffix))
+            snprintf(suffix + len, sizeof(suffix) - len, " (suppressed %zu similar)", counters->suppressed);
+
+        syslog(LOG_ERR, "%s%s\n%s", message, suffix, stacktrace);
     }
 
 #if HAVE_SYSTEMD_JOURNAL
     if (globalConfig.reportErrosTo & ED_JOURNALD)
     {
         VERBOSE_PRINT("Reporting stack trace to JournalD\n");
-        sd_journal_send("MESSAGE=%s", message,
-                        "PRIORITY=%d", LOG_ERR,
-                        "STACK_TRACE=%s", stacktrace ? stacktrace : "no stack trace",
-                        NULL);
+        if (counters->occurrences > 1)
+            sd_journal_send("MESSAGE=%s", message,
+                            "PRIORITY=%d", LOG_ERR,
+                            "STACK_TRACE=%s", stacktrace ? stacktrace : "no stack trace",
+                            "SUPPRESSED_SIMILAR=%zu", counters->suppressed,
+                            "OCCURRENCES=%zu", counters->occurrences,
+                            "FIRST_SEEN=%lld", (long long)counters->first_seen,
+                            "LAST_SEEN=%lld", (long long)counters->last_seen,
+                            NULL);
+        else if (0 != counters->suppressed)
+            sd_journal_send("MESSAGE=%s", message,
+                            "PRIORITY=%d", LOG_ERR,
+                            "STACK_TRACE=%s", stacktrace ? stacktrace : "no stack trace",
+                            "SUPPRESSED_SIMILAR=%zu", counters->suppressed,
+                            NULL);
+        else
+            sd_journal_send("MESSAGE=%s", message,
+                            "PRIORITY=%d", LOG_ERR,
+                            "STACK_TRACE=%s", stacktrace ? stacktrace : "no stack trace",
+                            NULL);
 
     }
 #endif
@@ -714,6 +1056,18 @@ static void report_stacktrace(
     {
         log_print("executable: %s\n", executable);
     }
+    if (counters->occurrences > 1)
+    {
+        char first[32];
+        char last[32];
+        log_print("occurrences: %zu, first seen: %s, last seen: %s\n", counters->occurrences,
+                format_occurrence_time(counters->first_seen, first, sizeof(first)),
+                format_occurrence_time(counters->last_seen, last, sizeof(last)));
+    }
+    if (0 != counters->suppressed)
+    {
+        log_print("suppressed %zu similar\n", counters->suppressed);
+    }
     if (additional_info)
     {
         char *info = info_pair_vector_to_string(additional_info);
@@ -727,145 +1081,294 @@ static void report_stacktrace(
     if (NULL != stacktrace)
     {
         VERBOSE_PRINT("Reporting stack trace to ABRT");
-        register_abrt_event(executable, message, stacktrace, additional_info);
+        register_abrt_event(executable, message, stacktrace, additional_info, counters);
     }
 }
 
 
 
 /*
- * Returns logical true if exception occurred and clears it.
+ * Generates the stack trace of given report from its raw stack trace
+ *
+ * Calls Java methods, hence must not be called in the critical section.
  */
-static inline int check_and_clear_exception(
-        JNIEnv     *jni_env)
+static void exception_report_symbolize(
+        jvmtiEnv *jvmti_env,
+        JNIEnv   *jni_env,
+        T_exceptionReport *report)
 {
-        if ((*jni_env)->ExceptionOccurred(jni_env))
-        {
-#ifdef VERBOSE
-            (*jni_env)->ExceptionDescribe(jni_env);
-#endif
-            (*jni_env)->ExceptionClear(jni_env);
-            return 1;
-        }
+    T_rawStackTrace *raw = report->raw_stacktrace;
+    if (NULL == raw)
+    {
+        return;
+    }
 
-        return 0;
+    report->raw_stacktrace = NULL;
+
+    if (NULL == raw->exception && NULL == raw->frames)
+    {
+        VERBOSE_PRINT("The exception is not available, cannot generate its stack trace\n");
+        return;
+    }
+
+    /* The reporting threads never return to Java, release local references
+     * created for causes and frames */
+    if (JNI_OK != (*jni_env)->PushLocalFrame(jni_env, STACK_TRACE_LOCAL_FRAME_CAPACITY))
+    {
+        check_and_clear_exception(jni_env);
+        VERBOSE_PRINT("Cannot create a local frame for generating a stack trace\n");
+        raw_stack_trace_release(jni_env, raw);
+        return;
+    }
+
+    char **executable = raw->executable ? &(report->executable) : NULL;
+    if (NULL != raw->exception)
+    {
+        report->stacktrace = generate_thread_stack_trace(jvmti_env, jni_env, raw, report->arena, executable);
+    }
+    else
+    {   /* Only the frames captured when the exception was thrown are left */
+        report->stacktrace = generate_frames_stack_trace(jvmti_env, jni_env, raw, report->exception_type_name, report->arena, executable);
+    }
+
+    (*jni_env)->PopLocalFrame(jni_env, NULL);
+
+    raw_stack_trace_release(jni_env, raw);
 }
 
 
 
 /*
- * Print a message when any JVM TI error occurs.
+ * Reports given report to all systems and releases its memory
  */
-static void print_jvmti_error(
-            jvmtiEnv   *jvmti_env,
-            jvmtiError  error_code,
-            const char *str)
+static void exception_report_deliver(
+        JNIEnv *jni_env,
+        T_exceptionReport *report)
 {
-    char *errnum_str;
-    const char *msg_str = str == NULL ? "" : str;
-    char *msg_err = NULL;
-    errnum_str = NULL;
+    report_stacktrace(NULL != report->executable ? report->executable : processProperties.main_class,
+            report->message,
+            report->stacktrace,
+            report->additional_info,
+            &(report->counters));
 
-    /* try to convert error number to string */
-    (void)(*jvmti_env)->GetErrorName(jvmti_env, error_code, &errnum_str);
-    msg_err = errnum_str == NULL ? "Unknown" : errnum_str;
-    fprintf(stderr, "ERROR: JVMTI: %d(%s): %s\n", error_code, msg_err, msg_str);
+    exception_report_free(jni_env, report);
+}
 
-    if (NULL != errnum_str)
-        (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)errnum_str);
+
+
+/*
+ * Passes given report to the reporting threads or reports it directly if
+ * the reporting threads are not running.
+ *
+ * Takes ownership of the report. Should be called outside of the critical
+ * section because the queue may wait for a free slot and the stack trace may
+ * be generated.
+ */
+static void dispatch_report(
+        jvmtiEnv *jvmti_env,
+        JNIEnv   *jni_env,
+        T_exceptionReport *report)
+{
+    T_reportQueue *queue = reportQueue;
+    if (NULL == queue)
+    {
+        exception_report_symbolize(jvmti_env, jni_env, report);
+
+        enter_critical_section(jvmti_env, shared_lock);
+        exception_report_deliver(jni_env, report);
+        exit_critical_section(jvmti_env, shared_lock);
+        return;
+    }
+
+    void *evicted = NULL;
+    if (report_queue_push(queue, report, &evicted))
+    {
+        VERBOSE_PRINT("The report was not queued: %s\n", report->message);
+        exception_report_free(jni_env, report);
+    }
+
+    if (NULL != evicted)
+    {
+        VERBOSE_PRINT("The report was evicted: %s\n", ((T_exceptionReport *)evicted)->message);
+        exception_report_free(jni_env, (T_exceptionReport *)evicted);
+    }
 }
 
 
-static int get_tid(
+
+/*
+ * Holds given report until its deduplication window closes or dispatches it
+ * if its repeats are not coalesced.
+ *
+ * Takes ownership of the report. The exception is kept alive only until the
+ * stack trace is generated; the report's weak reference is released.
+ * Should be called outside of the critical section because the queue may
+ * wait for a free slot and the stack trace may be generated.
+ *
+ * @param report A report allocated from its arena
+ * @param exception The reported exception or NULL if it is not available
+ * @param default_message Used if the report has no message
+ */
+static void submit_report(
+        jvmtiEnv *jvmti_env,
         JNIEnv   *jni_env,
-        jthread  thr,
-        jlong    *tid)
+        T_exceptionReport *report,
+        jobject   exception,
+        const char *default_message)
 {
-    jclass thread_class = (*jni_env)->GetObjectClass(jni_env, thr);
-    if (NULL == thread_class)
+    if (NULL != report->exception_object)
     {
-        VERBOSE_PRINT("Cannot get class of thread object\n");
-        return 1;
+        (*jni_env)->DeleteGlobalRef(jni_env, report->exception_object);
+        report->exception_object = NULL;
     }
 
-    jmethodID get_id = (*jni_env)->GetMethodID(jni_env, thread_class, "getId", "()J" );
-    if (check_and_clear_exception(jni_env) || NULL == get_id)
+    if (NULL != report->raw_stacktrace && NULL != exception)
     {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of java/lang/Thread.getId()J\n");
-        return 1;
+        report->raw_stacktrace->exception = (*jni_env)->NewGlobalRef(jni_env, exception);
+        if (NULL == report->raw_stacktrace->exception)
+        {
+            fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": can not create a global reference to an exception\n");
+        }
+    }
+
+    if (NULL == report->message)
+    {
+        report->message = report_arena_strdup(report->arena, default_message);
+        if (NULL == report->message)
+        {
+            exception_report_free(jni_env, report);
+            return;
+        }
+    }
+
+    /* The deduplicating thread dispatches the report with its counters */
+    T_reportDedup *dedup = reportDedup;
+    if (0 != report->fingerprint && NULL != dedup && !report_dedup_hold(dedup, report->fingerprint, report))
+    {
+        return;
     }
 
-    /* Thread.getId() throws nothing */
-    *tid = (*jni_env)->CallLongMethod(jni_env, thr, get_id);
+    dispatch_report(jvmti_env, jni_env, report);
+}
+
 
-    return 0;
+
+/*
+ * Returns logical true if exception occurred and clears it.
+ */
+static inline int check_and_clear_exception(
+        JNIEnv     *jni_env)
+{
+        if ((*jni_env)->ExceptionOccurred(jni_env))
+        {
+#ifdef VERBOSE
+            (*jni_env)->ExceptionDescribe(jni_env);
+#endif
+            (*jni_env)->ExceptionClear(jni_env);
+            return 1;
+        }
+
+        return 0;
 }
 
 
 
+/*
+ * Print a message when any JVM TI error occurs.
+ */
+static void print_jvmti_error(
+            jvmtiEnv   *jvmti_env,
+            jvmtiError  error_code,
+            const char *str)
+{
+    char *errnum_str;
+    const char *msg_str = str == NULL ? "" : str;
+    char *msg_err = NULL;
+    errnum_str = NULL;
+
+    /* try to convert error number to string */
+    (void)(*jvmti_env)->GetErrorName(jvmti_env, error_code, &errnum_str);
+    msg_err = errnum_str == NULL ? "Unknown" : errnum_str;
+    fprintf(stderr, "ERROR: JVMTI: %d(%s): %s\n", error_code, msg_err, msg_str);
+
+    if (NULL != errnum_str)
+        (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)errnum_str);
+}
+
+
 /*
  * Takes information about an exception and returns human readable string
  * describing the exception's occurrence.
  *
  * Cuts the description to not exceed MAX_REASON_MESSAGE_STRING_LENGTH
  * characters.
+ *
+ * @param prefix The way the exception occurred, e.g. "Caught"
+ * @returns The description allocated from given arena or NULL
  */
 static char *format_exception_reason_message(
-        int caught,
+        T_reportArena *arena,
+        const char *prefix,
         const char *exception_fqdn,
         const char *class_fqdn,
         const char *method)
 {
     const char *exception_name = exception_fqdn;
     const char *class_name = class_fqdn;
-    const char *prefix = caught ? "Caught" : "Uncaught";
 
-    char *message = (char*)calloc(MAX_REASON_MESSAGE_STRING_LENGTH + 1, sizeof(char));
-    if (message == NULL)
+    /* "%s exception %s in method %s%s%s()" without the arguments and the dot */
+    const size_t fixed_len = strlen(prefix) + strlen(" exception ") + strlen(" in method ") + strlen("()") + strlen(method);
+    size_t exception_len = strlen(exception_name);
+    size_t class_len = strlen(class_name);
+
+    /* Shorten the names in the order of their importance */
+    const char *ptr = NULL;
+    if (fixed_len + exception_len + class_len + (0 != class_len) >= MAX_REASON_MESSAGE_STRING_LENGTH
+        && NULL != (ptr = strrchr(class_name, '.')))
     {
-        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc(): out of memory");
-        return NULL;
+        /* Drop name space from method signature */
+        class_name = ptr + 1;
+        class_len = strlen(class_name);
+    }
+    if (fixed_len + exception_len + class_len + (0 != class_len) >= MAX_REASON_MESSAGE_STRING_LENGTH
+        && NULL != (ptr = strrchr(exception_name, '.')))
+    {
+        /* Drop name space from exception class signature */
+        exception_name = ptr + 1;
+        exception_len = strlen(exception_name);
+    }
+    if (fixed_len + exception_len + class_len + (0 != class_len) >= MAX_REASON_MESSAGE_STRING_LENGTH)
+    {
+        /* Drop class name from method signature */
+        class_name += class_len;
+        class_len = 0;
     }
+    /* No more place for shortening. The message will remain truncated. */
 
-    while (1)
+    size_t message_size = fixed_len + exception_len + class_len + (0 != class_len) + 1;
+    if (message_size > MAX_REASON_MESSAGE_STRING_LENGTH)
     {
-        const int message_len = snprintf(message, MAX_REASON_MESSAGE_STRING_LENGTH,
-                "%s exception %s in method %s%s%s()", prefix,
-                exception_name, class_name, ('\0' != class_name[0] ? "." : ""),
-                method);
+        message_size = MAX_REASON_MESSAGE_STRING_LENGTH;
+    }
 
-        if (message_len <= 0)
-        {
-            fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": snprintf(): can't print reason message to memory on stack\n");
-            free(message);
-            return NULL;
-        }
-        else if (message_len >= MAX_REASON_MESSAGE_STRING_LENGTH)
-        {
-            const char *ptr = NULL;
-            if (NULL != (ptr = strrchr(class_name, '.')))
-            {
-                /* Drop name space from method signature */
-                class_name = ptr + 1;
-                continue;
-            }
-            else if(NULL != (ptr = strrchr(exception_name, '.')))
-            {
-                /* Drop name space from exception class signature */
-                exception_name = ptr + 1;
-                continue;
-            }
-            else if (class_name[0] != '\0')
-            {
-                /* Drop class name from method signature */
-                class_name += strlen(class_name);
-                continue;
-            }
-            /* No more place for shortening. The message will remain truncated. */
-        }
+    char *message = (char*)report_arena_alloc(arena, message_size);
+    if (message == NULL)
+    {
+        return NULL;
+    }
 
-        return message;
+    const int message_len = snprintf(message, message_size,
+            "%s exception %s in method %s%s%s()", prefix,
+            exception_name, class_name, ('\0' != class_name[0] ? "." : ""),
+            method);
+
+    if (message_len <= 0)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": snprintf(): can't print reason message to memory on stack\n");
+        return NULL;
     }
+
+    return message;
 }
 
 
@@ -912,40 +1415,6 @@ static char* format_class_name(char *class_signature, char replace_to)
 
 
 
-/*
- * Format class signature into a form suitable for ClassLoader.getResource()
- * Class names have form "Ljava/lang/String;"
- * Requested form        "java/lang/String"
- */
-char* format_class_name_for_JNI_call(char *class_signature)
-{
-    char *output;
-    /* make sure we don't end with NPE */
-    if (class_signature != NULL)
-    {
-        /* replace 'L' from the beggining of class signature */
-        output = class_signature;
-        if (output[0] == 'L')
-        {
-            output++; /* goto to the next character */
-        }
-        /* replace last character in the class name */
-        /* if this character is ';' */
-        char *last_char = output + strlen(output) - 1;
-        if (*last_char == ';')
-        {
-            *last_char = '.';
-        }
-    }
-    else
-    {
-        return NULL;
-    }
-    return output;
-}
-
-
-
 /*
  * Check if any JVM TI error have occured.
  */
@@ -1229,7 +1698,12 @@ static char *get_main_class(
         return NULL;
     }
 
-    char *path_to_class = get_path_to_class(jvmti_env, jni_env, cls, upd_class_name, GET_PATH_METHOD_NAME);
+    const T_jniCache *cache = jni_cache_get(jni_env);
+    char *path_to_class = NULL;
+    if (NULL != cache)
+    {
+        path_to_class = get_path_to_class(jvmti_env, jni_env, cls, upd_class_name, cache->url_get_path);
+    }
 
     free(upd_class_name);
 
@@ -1340,11 +1814,12 @@ static void print_jvm_environment_variables_to_file(FILE *out)
 /*
  * Goes throw the list of FQDN static methods returning java.Lang.String, tries
  * to call them and returns their results in an array terminated by empty
- * entry.
+ * entry allocated from given arena.
  */
 static T_infoPair *collect_additional_debug_information(
         jvmtiEnv *jvmti_env,
-        JNIEnv   *jni_env)
+        JNIEnv   *jni_env,
+        T_reportArena *arena)
 {
     if (NULL == globalConfig.fqdnDebugMethods)
     {
@@ -1358,10 +1833,9 @@ static T_infoPair *collect_additional_debug_information(
         ++cnt;
     }
 
-    T_infoPair *ret_val = (T_infoPair *)malloc(sizeof(*ret_val) * (cnt + 1));
+    T_infoPair *ret_val = (T_infoPair *)report_arena_alloc(arena, sizeof(*ret_val) * (cnt + 1));
     if (NULL == ret_val)
     {
-        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory");
         return NULL;
     }
 
@@ -1369,10 +1843,10 @@ static T_infoPair *collect_additional_debug_information(
     iter = (const char *const *)globalConfig.fqdnDebugMethods;
     for( ; NULL != *iter; ++iter)
     {
-        char *debug_class_name_str = strdup(*iter);
+        /* Wasted until the arena is released */
+        char *debug_class_name_str = report_arena_strdup(arena, *iter);
         if (debug_class_name_str == NULL)
         {
-            fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": strdup(): out of memory");
             /* We want to finish this method call */
             break;
         }
@@ -1383,7 +1857,7 @@ static T_infoPair *collect_additional_debug_information(
         if (NULL == debug_method_name)
         {
             fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": Debug method '%s' is not in FQDN format\n", debug_class_name_str);
-            goto next_debug_method;
+            continue;
         }
 
         debug_method_name[0] = '\0';
@@ -1399,41 +1873,43 @@ static T_infoPair *collect_additional_debug_information(
         if (NULL == debug_class)
         {
             VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not find class of '%s'\n", *iter);
-            goto next_debug_method;
+            continue;
         }
 
         jmethodID debug_method = (*jni_env)->GetStaticMethodID(jni_env, debug_class, debug_method_name, "()Ljava/lang/String;");
         if (check_and_clear_exception(jni_env) || NULL == debug_method)
         {
             VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not find debug method '%s'\n", *iter);
-            goto next_debug_method;
+            continue;
         }
 
         jstring debug_string = (*jni_env)->CallStaticObjectMethod(jni_env, debug_class, debug_method);
-        if (check_and_clear_exception(jni_env))
+        if (check_and_clear_exception(jni_env) || NULL == debug_string)
         {
-            VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Exception occurred in debug method '%s'\n", *iter);
-            goto next_debug_method;
+            VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Exception occurred in debug method '%s' or it returned null\n", *iter);
+            continue;
         }
 
         info->label = *iter;
         {
-            char *tmp = (char*)(*jni_env)->GetStringUTFChars(jni_env, debug_string, NULL);
-            info->data = strdup(tmp);
-            (*jni_env)->ReleaseStringUTFChars(jni_env, debug_string, tmp);
+            /* Copy the modified UTF-8 directly to the arena */
+            const jsize utf_length = (*jni_env)->GetStringUTFLength(jni_env, debug_string);
+            info->data = (char *)report_arena_alloc(arena, utf_length + 1);
+            if (NULL != info->data)
+            {
+                (*jni_env)->GetStringUTFRegion(jni_env, debug_string, 0, (*jni_env)->GetStringLength(jni_env, debug_string), info->data);
+                info->data[utf_length] = '\0';
+            }
+            (*jni_env)->DeleteLocalRef(jni_env, debug_string);
         }
 
         if (NULL == info->data)
         {
-            fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": strdup(): out of memory");
             /* We want to finish this method call */
             break;
         }
 
         ++info;
-
-next_debug_method:
-        free(debug_class_name_str);
     }
 
     /* stop */
@@ -1446,232 +1922,764 @@ next_debug_method:
 
 
 /*
- * Called right after JVM started up.
+ * Body of the agent threads generating stack traces of queued reports and
+ * delivering them.
+ *
+ * Stack traces are generated in parallel but the reports are delivered one by
+ * one in the order they were queued.
  */
-static void JNICALL callback_on_vm_init(
+static void JNICALL report_worker_run(
             jvmtiEnv *jvmti_env,
             JNIEnv   *jni_env,
-            jthread   thread)
+            void     *arg)
 {
-    char tname[MAX_THREAD_NAME_LENGTH];
-
-    enter_critical_section(jvmti_env, shared_lock);
+    T_reportQueue *queue = (T_reportQueue *)arg;
 
-    INFO_PRINT("Got VM init event\n");
-    get_thread_name(jvmti_env , thread, tname, sizeof(tname));
-    INFO_PRINT("callbackVMInit:  %s thread\n", tname);
+    VERBOSE_PRINT("The reporting thread started\n");
 
-    fill_jvm_environment(jvmti_env);
-    fill_process_properties(jvmti_env, jni_env);
-#if PRINT_JVM_ENVIRONMENT_VARIABLES == 1
-    print_jvm_environment_variables();
-    print_process_properties();
-#endif
-    exit_critical_section(jvmti_env, shared_lock);
-}
+    /* Exceptions thrown while generating stack traces must not be reported,
+     * the thread would wait for itself in a full queue */
+    T_threadState *state = get_or_create_thread_state(jvmti_env, /*current thread*/NULL);
+    if (NULL != state)
+    {
+        state->reporting_thread = 1;
+    }
 
+    size_t ticket = 0;
+    T_exceptionReport *report = NULL;
+    while (NULL != (report = (T_exceptionReport *)report_queue_pop(queue, &ticket)))
+    {
+        exception_report_symbolize(jvmti_env, jni_env, report);
 
+        report_queue_wait_turn(queue, ticket);
+        exception_report_deliver(jni_env, report);
+        report_queue_done(queue);
+    }
 
-#if ABRT_VM_DEATH_CHECK
-/*
- * Called before JVM shuts down.
- */
-static void JNICALL callback_on_vm_death(
-            jvmtiEnv *jvmti_env,
-            JNIEnv   *env __UNUSED_VAR)
-{
-    enter_critical_section(jvmti_env, shared_lock);
-    INFO_PRINT("Got VM Death event\n");
-    exit_critical_section(jvmti_env, shared_lock);
+    VERBOSE_PRINT("The reporting thread finished\n");
 }
-#endif /* ABRT_VM_DEATH_CHECK */
 
 
 
 /*
- * Former callback_on_thread_start but it is not necessary to create an empty
- * structures and waste CPU time because it is more likely that no exception
- * will occur during the thread's lifetime. So, we converted the callback to a
- * function which can be used for initialization of the internal structures.
+ * Creates a new java.lang.Thread object for an agent thread.
  */
-static T_jthrowableCircularBuf *create_exception_buf_for_thread(
-            JNIEnv   *jni_env,
-            jlong tid)
+static jthread create_agent_thread_object(
+            JNIEnv     *jni_env,
+            const char *name)
 {
-    T_jthrowableCircularBuf *threads_exc_buf = jthrowable_circular_buf_new(jni_env, REPORTED_EXCEPTION_STACK_CAPACITY);
-    if (NULL == threads_exc_buf)
+    const T_jniCache *cache = jni_cache_get(jni_env);
+    if (NULL == cache)
+    {
+        VERBOSE_PRINT("Cannot find java.lang.Thread.<init>(Ljava/lang/String;)V method\n");
+        return NULL;
+    }
+
+    jstring thread_name = (*jni_env)->NewStringUTF(jni_env, name);
+    if (check_and_clear_exception(jni_env) || NULL == thread_name)
     {
-        fprintf(stderr, "Cannot enable check for already reported exceptions. Disabling reporting to ABRT in current thread!");
+        VERBOSE_PRINT("Cannot create a name for the agent thread\n");
         return NULL;
     }
 
-    jthread_map_push(threadMap, tid, (void *)threads_exc_buf);
-    return threads_exc_buf;
+    jthread thread = (*jni_env)->NewObject(jni_env, cache->thread_class, cache->thread_init, thread_name);
+    if (check_and_clear_exception(jni_env))
+    {
+        VERBOSE_PRINT("Cannot create the agent thread object\n");
+        thread = NULL;
+    }
+
+    (*jni_env)->DeleteLocalRef(jni_env, thread_name);
+    return thread;
 }
 
 
 
 /*
- * Called before thread end.
+ * Starts one agent thread generating and delivering reports from given queue.
+ *
+ * @returns 0 if the thread was started; otherwise non zero
  */
-static void JNICALL callback_on_thread_end(
-            jvmtiEnv *jvmti_env __UNUSED_VAR,
+static int start_report_worker_thread(
+            jvmtiEnv *jvmti_env,
             JNIEnv   *jni_env,
-            jthread  thread)
+            T_reportQueue *queue,
+            const char *name)
 {
-    INFO_PRINT("ThreadEnd\n");
-    if (NULL == threadMap)
+    jthread thread = create_agent_thread_object(jni_env, name);
+    if (NULL == thread)
     {
-        return;
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": can not create the reporting thread\n");
+        return 1;
     }
 
-    if (!jthread_map_empty(threadMap) || !jthread_map_empty(uncaughtExceptionMap))
-    {
-        jlong tid = 0;
-
-        if (get_tid(jni_env, thread, &tid))
-        {
-            VERBOSE_PRINT("Cannot free thread's exception buffer because cannot get TID");
-            return;
-        }
-
-        T_exceptionReport *rpt = (T_exceptionReport *)jthread_map_pop(uncaughtExceptionMap, tid);
-        T_jthrowableCircularBuf *threads_exc_buf = (T_jthrowableCircularBuf *)jthread_map_pop(threadMap, tid);
+    /* The worker must be attached before it can be detached by closing */
+    report_queue_attach(queue);
 
-        if (NULL != rpt)
-        {
-            if (NULL == threads_exc_buf || NULL == jthrowable_circular_buf_find(threads_exc_buf, rpt->exception_object))
-            {
-                report_stacktrace(NULL != rpt->executable ? rpt->executable : processProperties.main_class,
-                                  NULL != rpt->message ? rpt->message : "Uncaught exception",
-                                  rpt->stacktrace, rpt->additional_info);
-            }
+    jvmtiError error_code = (*jvmti_env)->RunAgentThread(jvmti_env, thread, &report_worker_run,
+            (void *)queue, JVMTI_THREAD_NORM_PRIORITY);
 
-            exception_report_free(rpt);
-        }
+    (*jni_env)->DeleteLocalRef(jni_env, thread);
 
-        if (threads_exc_buf != NULL)
-        {
-            jthrowable_circular_buf_free(threads_exc_buf);
-        }
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+    {
+        report_queue_detach(queue);
+        return 1;
     }
+
+    return 0;
 }
 
 
-#ifdef GENERATE_JVMTI_STACK_TRACE
+
 /*
- * Get line number for given method and location in this method.
+ * Creates the report queue and starts the agent threads generating stack
+ * traces and delivering reports.
+ *
+ * Reports are delivered from throwing threads if no thread can be started.
  */
-static int get_line_number(
-            jvmtiEnv  *jvmti_env,
-            jmethodID  method,
-            jlocation  location)
+static void start_report_worker(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env)
 {
-    int count;
-    int line_number = 0;
-    int i;
-    jvmtiLineNumberEntry *location_table;
-    jvmtiError error_code;
-
-    /* how can we recognize an illegal value of the location variable.
-     * Documentation says:
-     *   A 64 bit value, representing a monotonically increasing executable
-     *   position within a method. -1 indicates a native method.
-     *
-     * we use 0 for now.
-     */
-    if (NULL == method || 0 == location)
+    if (0 == globalConfig.reportQueueDepth)
     {
-        return -1;
+        VERBOSE_PRINT("Report queue is disabled, reporting from throwing threads\n");
+        return;
     }
 
-    /* read table containing line numbers and instruction indexes */
-    error_code = (*jvmti_env)->GetLineNumberTable(jvmti_env, method, &count, &location_table);
-    /* it is possible, that we are unable to read the table -> missing debuginfo etc. */
-    if (error_code != JVMTI_ERROR_NONE)
+    T_reportQueue *queue = report_queue_new(globalConfig.reportQueueDepth, globalConfig.reportQueueOverflow);
+    if (NULL == queue)
     {
-        if (location_table != NULL)
-        {
-            (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)location_table);
-        }
-        return -1;
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": can not create a report queue\n");
+        return;
     }
 
-    /* iterate over the read table */
-    for (i = 0; i < count - 1; i++)
+    unsigned started = 0;
+    for (unsigned i = 0; i < globalConfig.reportWorkers; ++i)
     {
-        jvmtiLineNumberEntry entry1 = location_table[i];
-        jvmtiLineNumberEntry entry2 = location_table[i+1];
-        /* entry1 and entry2 are copies allocated on the stack:          */
-        /*   how can we recognize that location_table[i] is valid value? */
-        /*                                                               */
-        /* we hope that all array values are valid for now               */
+        char name[sizeof(REPORT_WORKER_THREAD_NAME) + 16];
+        if (1 == globalConfig.reportWorkers)
+        {
+            snprintf(name, sizeof(name), "%s", REPORT_WORKER_THREAD_NAME);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%s %u", REPORT_WORKER_THREAD_NAME, i + 1);
+        }
 
-        /* if location is between entry1 (including) and entry2 (excluding), */
-        /* we are on the right line */
-        if (location >= entry1.start_location && location < entry2.start_location)
+        if (start_report_worker_thread(jvmti_env, jni_env, queue, name))
         {
-            line_number = entry1.line_number;
             break;
         }
+
+        ++started;
     }
 
-    /* last instruction is handled specifically */
-    if (location >= location_table[count-1].start_location)
+    if (0 == started)
     {
-        line_number = location_table[count-1].line_number;
+        report_queue_close(queue, 0);
+        report_queue_free(queue);
+        return;
     }
 
-    /* memory deallocation */
-    (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)location_table);
-    return line_number;
+    VERBOSE_PRINT("Started %u reporting threads\n", started);
+    reportQueue = queue;
 }
-#endif /* GENERATE_JVMTI_STACK_TRACE */
 
 
 
 /*
- * Return path to given class using given class loader.
+ * Delivers queued reports and lets the reporting threads finish.
+ *
+ * Waits at most 'flushtimeout' milliseconds for delivering and the same time
+ * for the threads if all reports were delivered. Reports pushed later are
+ * dropped.
  */
-static char* get_path_to_class_class_loader(
-            jvmtiEnv *jvmti_env __UNUSED_VAR,
+static void stop_report_worker(void)
+{
+    if (NULL == reportQueue || reportWorkerStopped)
+    {
+        return;
+    }
+
+    reportWorkerStopped = 1;
+
+    const int flushed = !report_queue_flush(reportQueue, globalConfig.flushTimeout);
+    if (!flushed)
+    {
+        fprintf(stderr, "Not all exception reports were delivered in %ums\n", globalConfig.flushTimeout);
+    }
+
+    if (report_queue_close(reportQueue, flushed ? globalConfig.flushTimeout : 0))
+    {
+        VERBOSE_PRINT("Some reporting threads are still running\n");
+    }
+
+    VERBOSE_PRINT("Number of dropped reports: %zu\n", report_queue_dropped(reportQueue));
+}
+
+
+
+/*
+ * The body of the agent thread releasing reports of coalesced exceptions
+ * when their deduplication windows close.
+ */
+static void JNICALL report_dedup_run(
+            jvmtiEnv *jvmti_env,
             JNIEnv   *jni_env,
-            jclass    class_loader,
-            char     *class_name,
-            const char *stringize_method_name)
+            void     *arg)
 {
-    char *out = NULL;
-    jclass class_loader_class = NULL;
+    T_reportDedup *dedup = (T_reportDedup *)arg;
 
-    char *upd_class_name = (char*)malloc(strlen(class_name) + sizeof("class") + 1);
-    if (NULL == upd_class_name)
+    VERBOSE_PRINT("The deduplicating thread started\n");
+
+    /* The thread generates stack traces if there is no report queue */
+    T_threadState *state = get_or_create_thread_state(jvmti_env, /*current thread*/NULL);
+    if (NULL != state)
+    {
+        state->reporting_thread = 1;
+    }
+
+    T_reportDedupCounts counts;
+    T_exceptionReport *report = NULL;
+    while (NULL != (report = (T_exceptionReport *)report_dedup_pop_expired(dedup, &counts)))
+    {
+        report->counters.occurrences = counts.occurrences;
+        report->counters.first_seen = counts.first_seen.tv_sec;
+        report->counters.last_seen = counts.last_seen.tv_sec;
+
+        dispatch_report(jvmti_env, jni_env, report);
+    }
+
+    VERBOSE_PRINT("The deduplicating thread finished\n");
+}
+
+
+
+/*
+ * Creates the deduplication table and starts the agent thread releasing
+ * coalesced reports.
+ *
+ * Every exception is reported on its own if the thread cannot be started.
+ */
+static void start_report_dedup(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env)
+{
+    if (0 == globalConfig.dedupWindow)
+    {
+        return;
+    }
+
+    T_reportDedup *dedup = report_dedup_new(REPORT_DEDUP_CAPACITY, globalConfig.dedupWindow);
+    if (NULL == dedup)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": can not create a deduplication table\n");
+        return;
+    }
+
+    jthread thread = create_agent_thread_object(jni_env, REPORT_DEDUP_THREAD_NAME);
+    if (NULL == thread)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": can not create the deduplicating thread\n");
+        goto start_report_dedup_failed;
+    }
+
+    /* The thread must be attached before it can be detached by closing */
+    report_dedup_attach(dedup);
+
+    jvmtiError error_code = (*jvmti_env)->RunAgentThread(jvmti_env, thread, &report_dedup_run,
+            (void *)dedup, JVMTI_THREAD_NORM_PRIORITY);
+
+    (*jni_env)->DeleteLocalRef(jni_env, thread);
+
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+    {
+        report_dedup_detach(dedup);
+        goto start_report_dedup_failed;
+    }
+
+    VERBOSE_PRINT("Coalescing repeated exceptions for %ums\n", globalConfig.dedupWindow);
+    reportDedup = dedup;
+    return;
+
+start_report_dedup_failed:
+    report_dedup_close(dedup, 0);
+    report_dedup_free(dedup);
+}
+
+
+
+/*
+ * Closes all deduplication windows and lets the deduplicating thread pass
+ * their reports on and finish.
+ *
+ * Must be called before stop_report_worker() because the deduplicating
+ * thread pushes the reports to the report queue.
+ */
+static void stop_report_dedup(void)
+{
+    if (NULL == reportDedup || reportDedupStopped)
+    {
+        return;
+    }
+
+    reportDedupStopped = 1;
+
+    if (report_dedup_close(reportDedup, globalConfig.flushTimeout))
+    {
+        fprintf(stderr, "Not all coalesced exception reports were released in %ums\n", globalConfig.flushTimeout);
+    }
+}
+
+
+
+/*
+ * Starts delivering problems to abrtd if ABRT reporting is enabled.
+ */
+static void start_abrt_socket(void)
+{
+    if ((globalConfig.reportErrosTo & ED_ABRT) == 0)
+    {
+        return;
+    }
+
+    abrtSocket = abrt_socket_new(globalConfig.abrtSocketPath, ABRT_SOCKET_CAPACITY, globalConfig.abrtBatchWindow);
+    if (NULL == abrtSocket)
+    {
+        fprintf(stderr, "Cannot deliver problems to ABRT socket '%s'\n", globalConfig.abrtSocketPath);
+    }
+}
+
+
+
+/*
+ * Waits until the queued problems are delivered to abrtd and stops the ABRT
+ * socket's thread. Problems submitted later are dropped.
+ *
+ * Must be called after stop_report_worker() which may submit problems.
+ */
+static void stop_abrt_socket(void)
+{
+    if (NULL == abrtSocket || abrtSocketStopped)
+    {
+        return;
+    }
+
+    abrtSocketStopped = 1;
+
+    const int flushed = !abrt_socket_flush(abrtSocket, globalConfig.flushTimeout);
+    if (!flushed)
+    {
+        fprintf(stderr, "Not all ABRT problems were delivered in %ums\n", globalConfig.flushTimeout);
+    }
+
+    if (abrt_socket_close(abrtSocket, flushed ? globalConfig.flushTimeout : 0))
+    {
+        VERBOSE_PRINT("The ABRT socket's thread is still running\n");
+    }
+
+    T_abrtSocketStats stats;
+    abrt_socket_get_stats(abrtSocket, &stats);
+    VERBOSE_PRINT("ABRT problems: %zu submitted, %zu delivered, %zu rejected, %zu dropped, %zu failed connects\n",
+            stats.submitted, stats.delivered, stats.rejected, stats.dropped, stats.connect_failures);
+}
+
+
+
+/*
+ * Prints counters of the agent's work.
+ */
+static void print_agent_statistics(void)
+{
+    VERBOSE_PRINT("Probed exceptions: %zu, coalesced: %zu, rate limited: %zu\n",
+            __atomic_load_n(&agentStatistics.probed, __ATOMIC_RELAXED),
+            __atomic_load_n(&agentStatistics.coalesced, __ATOMIC_RELAXED),
+            __atomic_load_n(&agentStatistics.rate_limited, __ATOMIC_RELAXED));
+}
+
+
+
+/*
+ * Called right after JVM started up.
+ */
+static void JNICALL callback_on_vm_init(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            jthread   thread)
+{
+    char tname[MAX_THREAD_NAME_LENGTH];
+
+    enter_critical_section(jvmti_env, shared_lock);
+
+    INFO_PRINT("Got VM init event\n");
+    get_thread_name(jvmti_env , thread, tname, sizeof(tname));
+    INFO_PRINT("callbackVMInit:  %s thread\n", tname);
+
+    if (jni_cache_initialize(jni_env))
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": can not resolve frequently used Java classes\n");
+    }
+
+    index_loaded_classes(jvmti_env, jni_env);
+
+    fill_jvm_environment(jvmti_env);
+    fill_process_properties(jvmti_env, jni_env);
+#if PRINT_JVM_ENVIRONMENT_VARIABLES == 1
+    print_jvm_environment_variables();
+    print_process_properties();
+#endif
+    problem_data_template_build();
+    exit_critical_section(jvmti_env, shared_lock);
+
+    /* Must be running before the first report is delivered */
+    start_abrt_socket();
+    start_report_worker(jvmti_env, jni_env);
+    start_report_dedup(jvmti_env, jni_env);
+
+    if (NULL != uncaughtHandlerJvmtiEnv && uncaught_handler_install(jni_env, &report_uncaught_exception))
+    {   /* Fall back to exception events, their capability was added in
+         * Agent_OnLoad() because it cannot be added in the live phase */
+        const int events_enabled = exception_events_required();
+        globalConfig.uncaughtDetection = UE_DETECTION_EVENTS;
+
+        if (events_enabled || JVMTI_ERROR_NONE == set_event_notification_mode(jvmti_env, JVMTI_EVENT_EXCEPTION))
+        {
+            fprintf(stderr, "Cannot install the uncaught exception handler, uncaught exceptions will be detected by exception events\n");
+        }
+        else
+        {
+            fprintf(stderr, "Cannot install the uncaught exception handler, uncaught exceptions will not be reported\n");
+        }
+    }
+    else if (!exception_events_required())
+    {   /* The capability added in Agent_OnLoad() only for the fallback slows
+         * down every thrown exception */
+        jvmtiCapabilities capabilities;
+        (void)memset(&capabilities, 0, sizeof(capabilities));
+        capabilities.can_generate_exception_events = 1;
+        jvmtiError error_code = (*jvmti_env)->RelinquishCapabilities(jvmti_env, &capabilities);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+    }
+
+    if (exception_constructors_watched())
+    {
+        watch_loaded_exception_constructors(jvmti_env, jni_env);
+    }
+}
+
+
+
+/*
+ * Called before JVM shuts down.
+ */
+static void JNICALL callback_on_vm_death(
+            jvmtiEnv *jvmti_env __UNUSED_VAR,
+            JNIEnv   *env __UNUSED_VAR)
+{
+#if ABRT_VM_DEATH_CHECK
+    enter_critical_section(jvmti_env, shared_lock);
+    INFO_PRINT("Got VM Death event\n");
+    exit_critical_section(jvmti_env, shared_lock);
+#endif /* ABRT_VM_DEATH_CHECK */
+
+    /* Do not hold the lock, the queue may wait for a throwing thread */
+    stop_report_dedup();
+    stop_report_worker();
+    stop_abrt_socket();
+
+    print_agent_statistics();
+}
+
+
+
+/*
+ * Returns the state of given thread or NULL if the thread has no state yet.
+ */
+static T_threadState *get_thread_state(
+            jvmtiEnv *jvmti_env,
+            jthread   thread)
+{
+    T_threadState *state = NULL;
+
+    jvmtiError error_code = (*jvmti_env)->GetThreadLocalStorage(jvmti_env, thread, (void **)&state);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
     {
-        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory");
         return NULL;
     }
 
-    strcpy(upd_class_name, class_name);
-    strcat(upd_class_name, "class");
+    return state;
+}
+
+
+
+/*
+ * Former callback_on_thread_start but it is not necessary to create an empty
+ * structures and waste CPU time because it is more likely that no exception
+ * will occur during the thread's lifetime. So, we converted the callback to a
+ * function which can be used for initialization of the internal structures.
+ */
+static T_threadState *create_thread_state(
+            jvmtiEnv *jvmti_env,
+            jthread   thread)
+{
+    T_threadState *state = (T_threadState *)calloc(1, sizeof(*state));
+    if (NULL == state)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc(): out of memory\n");
+        return NULL;
+    }
 
-    /* find ClassLoader class */
-    class_loader_class = (*jni_env)->FindClass(jni_env, "java/lang/ClassLoader");
-    if (check_and_clear_exception(jni_env) || class_loader_class ==  NULL)
+    jvmtiError error_code = (*jvmti_env)->SetThreadLocalStorage(jvmti_env, thread, (const void *)state);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
     {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get class of java/lang/ClassLoader\n");
-        free(upd_class_name);
+        free(state);
         return NULL;
     }
 
-    /* find method ClassLoader.getResource() */
-    jmethodID get_resource = (*jni_env)->GetMethodID(jni_env, class_loader_class, "getResource", "(Ljava/lang/String;)Ljava/net/URL;");
-    if (check_and_clear_exception(jni_env) || get_resource ==  NULL)
+    return state;
+}
+
+
+
+/*
+ * Frees memory of given thread's state.
+ *
+ * @param state Accepts NULL
+ */
+static void thread_state_free(
+            JNIEnv   *jni_env,
+            T_threadState *state)
+{
+    if (NULL == state)
+    {
+        return;
+    }
+
+    if (NULL != state->name_object)
+    {
+        (*jni_env)->DeleteWeakGlobalRef(jni_env, state->name_object);
+    }
+
+    free(state->name);
+    free(state);
+}
+
+
+
+/*
+ * Returns the name of given thread cached in its state.
+ *
+ * The name is got from JVMTI only for the first time and when the thread was
+ * renamed. Renaming is detected by comparing identity of the current value of
+ * java.lang.Thread.name with the String the name was taken from, which
+ * neither calls a Java method nor allocates memory.
+ *
+ * @returns The cached name or NULL if the name cannot be got
+ */
+static const char *get_cached_thread_name(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            jthread   thread,
+            T_threadState *state)
+{
+    const T_jniCache *cache = jni_cache_get(jni_env);
+    jobject name_object = NULL;
+
+    if (NULL != cache && NULL != cache->thread_name)
+    {
+        name_object = (*jni_env)->GetObjectField(jni_env, thread, cache->thread_name);
+        if (NULL != state->name && NULL != name_object
+            && (*jni_env)->IsSameObject(jni_env, name_object, state->name_object))
+        {
+            (*jni_env)->DeleteLocalRef(jni_env, name_object);
+            return state->name;
+        }
+    }
+    else if (NULL != state->name)
+    {   /* Renaming cannot be detected */
+        return state->name;
+    }
+
+    VERBOSE_PRINT("Caching name of a thread\n");
+
+    jvmtiThreadInfo info;
+    memset(&info, 0, sizeof(info));
+
+    char *name = NULL;
+    jvmtiError error_code = (*jvmti_env)->GetThreadInfo(jvmti_env, thread, &info);
+    if (!check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+    {
+        name = strdup(NULL != info.name ? info.name : DEFAULT_THREAD_NAME);
+        if (NULL == name)
+        {
+            fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": strdup(): out of memory\n");
+        }
+
+        if (NULL != info.name)
+        {
+            error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)info.name);
+            check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+        }
+        (*jni_env)->DeleteLocalRef(jni_env, info.thread_group);
+        (*jni_env)->DeleteLocalRef(jni_env, info.context_class_loader);
+    }
+
+    if (NULL != name)
+    {
+        free(state->name);
+        state->name = name;
+
+        if (NULL != state->name_object)
+        {
+            (*jni_env)->DeleteWeakGlobalRef(jni_env, state->name_object);
+            state->name_object = NULL;
+        }
+
+        if (NULL != name_object)
+        {
+            state->name_object = (*jni_env)->NewWeakGlobalRef(jni_env, name_object);
+        }
+    }
+
+    if (NULL != name_object)
+    {
+        (*jni_env)->DeleteLocalRef(jni_env, name_object);
+    }
+
+    return name;
+}
+
+
+
+/*
+ * Returns the state of given thread and creates it if the thread has no state
+ * yet.
+ */
+static T_threadState *get_or_create_thread_state(
+            jvmtiEnv *jvmti_env,
+            jthread   thread)
+{
+    T_threadState *state = get_thread_state(jvmti_env, thread);
+    if (NULL == state)
+    {
+        state = create_thread_state(jvmti_env, thread);
+    }
+
+    return state;
+}
+
+
+
+/*
+ * Returns non zero if given exception object was already reported.
+ *
+ * Reads only the object's tag, does not call any Java method and does not
+ * need the critical section.
+ */
+static int exception_was_reported(
+            jvmtiEnv *jvmti_env,
+            jobject   exception_object)
+{
+    jlong tag = 0;
+    jvmtiError error_code = (*jvmti_env)->GetTag(jvmti_env, exception_object, &tag);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        return 0;
+
+    return OBJECT_TAG_REPORTED_EXCEPTION == OBJECT_TAG_KIND(tag);
+}
+
+
+
+/*
+ * Marks given exception object as reported to prevent re-reporting.
+ */
+static void exception_mark_reported(
+            jvmtiEnv *jvmti_env,
+            jobject   exception_object)
+{
+    VERBOSE_PRINT("Tagging the exception as reported\n");
+    jvmtiError error_code = (*jvmti_env)->SetTag(jvmti_env, exception_object,
+            OBJECT_TAG_MAKE(NULL, OBJECT_TAG_REPORTED_EXCEPTION));
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+}
+
+
+
+/*
+ * Called before thread end.
+ */
+static void JNICALL callback_on_thread_end(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            jthread  thread)
+{
+    INFO_PRINT("ThreadEnd\n");
+
+    T_threadState *state = get_thread_state(jvmti_env, thread);
+    if (NULL != state)
+    {
+        jvmtiError error_code = (*jvmti_env)->SetThreadLocalStorage(jvmti_env, thread, NULL);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+
+        T_exceptionReport *rpt = state->uncaught_exception;
+        thread_state_free(jni_env, state);
+
+        if (NULL != rpt)
+        {
+            jobject exception = (*jni_env)->NewLocalRef(jni_env, rpt->exception_object);
+
+            if ((NULL == exception || !exception_was_reported(jvmti_env, exception))
+                && !postponed_report_rate_limited(rpt))
+            {   /* The exception is confirmed to be uncaught */
+                exception_report_describe_method(jvmti_env, jni_env, rpt, "Uncaught", rpt->method);
+                submit_report(jvmti_env, jni_env, rpt, exception, "Uncaught exception");
+            }
+            else
+            {
+                exception_report_free(jni_env, rpt);
+            }
+
+            if (NULL != exception)
+            {
+                (*jni_env)->DeleteLocalRef(jni_env, exception);
+            }
+        }
+    }
+}
+
+
+
+/*
+ * Return path to given class using given class loader.
+ */
+static char* get_path_to_class_class_loader(
+            jvmtiEnv *jvmti_env __UNUSED_VAR,
+            JNIEnv   *jni_env,
+            jclass    class_loader,
+            char     *class_name,
+            jmethodID stringize_method)
+{
+    char *out = NULL;
+
+    const T_jniCache *cache = jni_cache_get(jni_env);
+    if (NULL == cache)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of java/lang/ClassLoader.getResource(Ljava/lang/String;)Ljava/net/URL;\n");
-        free(upd_class_name);
-        (*jni_env)->DeleteLocalRef(jni_env, class_loader_class);
         return NULL;
     }
 
+    char *upd_class_name = (char*)malloc(strlen(class_name) + sizeof("class") + 1);
+    if (NULL == upd_class_name)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory");
+        return NULL;
+    }
+
+    strcpy(upd_class_name, class_name);
+    strcat(upd_class_name, "class");
+
     /* convert new class name into a Java String */
     jstring j_class_name = (*jni_env)->NewStringUTF(jni_env, upd_class_name);
     free(upd_class_name);
@@ -1682,30 +2690,16 @@ static char* get_path_to_class_class_loader(
     }
 
     /* call method ClassLoader.getResource(className) */
-    jobject url = (*jni_env)->CallObjectMethod(jni_env, class_loader, get_resource, j_class_name);
+    jobject url = (*jni_env)->CallObjectMethod(jni_env, class_loader, cache->class_loader_get_resource, j_class_name);
     if (check_and_clear_exception(jni_env) || NULL == url)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get a resource of %s\n", class_name);
         goto get_path_to_class_class_loader_lcl_refs_cleanup;
     }
 
-    /* find method URL.toString() */
-    jclass url_class = (*jni_env)->FindClass(jni_env, "java/net/URL");
-    if (check_and_clear_exception(jni_env) || NULL == url_class)
-    {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get class of java/net/URL\n");
-        goto get_path_to_class_class_loader_lcl_refs_cleanup;
-    }
-
-    jmethodID to_external_form = (*jni_env)->GetMethodID(jni_env, url_class, stringize_method_name, "()Ljava/lang/String;");
-    if (check_and_clear_exception(jni_env) || NULL == to_external_form)
-    {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of java/net/URL.%s()Ljava/lang/String;\n", stringize_method_name);
-        goto get_path_to_class_class_loader_lcl_refs_cleanup;
-    }
-
     /* call method URL.toString() */
-    jstring jstr = (jstring)(*jni_env)->CallObjectMethod(jni_env, url, to_external_form);
+    jstring jstr = (jstring)(*jni_env)->CallObjectMethod(jni_env, url, stringize_method);
+    (*jni_env)->DeleteLocalRef(jni_env, url);
     if (check_and_clear_exception(jni_env) || jstr ==  NULL)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Failed to convert an URL object to a string\n");
@@ -1717,84 +2711,238 @@ static char* get_path_to_class_class_loader(
     out = strdup(str);
     if (out == NULL)
     {
-        fprintf(stderr, "strdup(): out of memory");
+        fprintf(stderr, "strdup(): out of memory");
+    }
+
+    /* cleanup */
+    (*jni_env)->ReleaseStringUTFChars(jni_env, jstr, str);
+    (*jni_env)->DeleteLocalRef(jni_env, jstr);
+
+get_path_to_class_class_loader_lcl_refs_cleanup:
+    (*jni_env)->DeleteLocalRef(jni_env, j_class_name);
+    return out;
+}
+
+
+
+/*
+ * Return path to given class.
+ */
+static char* get_path_to_class(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            jclass    class,
+            char     *class_name,
+            jmethodID stringize_method)
+{
+    jobject class_loader = NULL;
+    (*jvmti_env)->GetClassLoader(jvmti_env, class, &class_loader);
+
+    /* class is loaded using boot classloader */
+    if (class_loader == NULL)
+    {
+        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": A class has not been loaded by a ClassLoader. Going to use the system class loader.\n");
+
+        const T_jniCache *cache = jni_cache_get(jni_env);
+        if (NULL == cache || NULL == cache->system_class_loader)
+        {
+            VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Cannot get the system class loader.");
+            return NULL;
+        }
+
+        /* Global reference, must not be deleted */
+        return get_path_to_class_class_loader(jvmti_env, jni_env, cache->system_class_loader, class_name, stringize_method);
+    }
+
+    char *path = get_path_to_class_class_loader(jvmti_env, jni_env, class_loader, class_name, stringize_method);
+    (*jni_env)->DeleteLocalRef(jni_env, class_loader);
+    return path;
+}
+
+
+
+/*
+ * Adds given class to the index of loaded classes.
+ */
+static void index_loaded_class(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            jclass    class)
+{
+    char *signature = NULL;
+    jvmtiError error_code = (*jvmti_env)->GetClassSignature(jvmti_env, class, &signature, NULL);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+    {
+        return;
+    }
+
+    /* Arrays and primitive types cannot be found on a stack */
+    if ('L' == signature[0])
+    {
+        /* Lcom/example/Class; -> com.example.Class */
+        const char *class_name = format_class_name(signature, '\0');
+        if (class_index_add(classIndex, jni_env, class_name, class))
+        {
+            VERBOSE_PRINT("Cannot add class '%s' to the index\n", class_name);
+        }
+    }
+
+    error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)signature);
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+}
+
+
+
+/*
+ * Adds all already loaded classes to the index of loaded classes.
+ *
+ * Classes loaded later are added from ClassPrepare event.
+ */
+static void index_loaded_classes(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env)
+{
+    if (NULL == classIndex)
+    {
+        return;
+    }
+
+    jint num_classes = 0;
+    jclass *loaded_classes = NULL;
+    jvmtiError error_code = (*jvmti_env)->GetLoadedClasses(jvmti_env, &num_classes, &loaded_classes);
+    if (check_jvmti_error(jvmti_env, error_code, "jvmtiEnv::GetLoadedClasses()"))
+    {
+        return;
+    }
+
+    for (jint i = 0; i < num_classes; ++i)
+    {
+        index_loaded_class(jvmti_env, jni_env, loaded_classes[i]);
+        (*jni_env)->DeleteLocalRef(jni_env, loaded_classes[i]);
+    }
+
+    error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)loaded_classes);
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+
+    VERBOSE_PRINT("Indexed %zu loaded classes\n", class_index_size(classIndex));
+}
+
+
+
+/*
+ * Returns non zero if given method is a constructor.
+ */
+static int is_constructor(
+            jvmtiEnv *jvmti_env,
+            jmethodID method)
+{
+    char *method_name = NULL;
+    jvmtiError error_code = (*jvmti_env)->GetMethodName(jvmti_env, method, &method_name, NULL, NULL);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+    {
+        return 0;
     }
 
-    /* cleanup */
-    (*jni_env)->ReleaseStringUTFChars(jni_env, jstr, str);
+    const int retval = strcmp("<init>", method_name) == 0;
 
-get_path_to_class_class_loader_lcl_refs_cleanup:
-    (*jni_env)->DeleteLocalRef(jni_env, class_loader_class);
-    (*jni_env)->DeleteLocalRef(jni_env, j_class_name);
-    return out;
+    error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)method_name);
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+
+    return retval;
 }
 
 
 
 /*
- * Wraps java.lang.ClassLoader.getSystemClassLoader()
+ * Sets breakpoints at the beginning of all constructors of given class if the
+ * class is one of the exception types reported even if they are caught.
+ *
+ * Breakpoints can be set only in the live phase. Already set breakpoints are
+ * silently skipped.
  */
-static jobject get_system_class_loader(
-            jvmtiEnv *jvmti_env __UNUSED_VAR,
-            JNIEnv   *jni_env)
+static void watch_exception_constructors(
+            jvmtiEnv *jvmti_env,
+            jclass    class)
 {
-    jobject system_class_loader = NULL;
+    char *signature = NULL;
+    jvmtiError error_code = (*jvmti_env)->GetClassSignature(jvmti_env, class, &signature, NULL);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+    {
+        return;
+    }
 
-    jclass class_loader_class = (*jni_env)->FindClass(jni_env, "java/lang/ClassLoader");
-    if (check_and_clear_exception(jni_env) || NULL == class_loader_class)
+    jint method_count = 0;
+    jmethodID *methods = NULL;
+
+    /* Lcom/example/Class; -> com.example.Class */
+    const char *class_name = 'L' == signature[0] ? format_class_name(signature, '\0') : NULL;
+    if (NULL == class_name || !exception_type_is_listed(class_name))
     {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get class of java/lang/ClassLoader\n");
-        return NULL;
+        goto watch_exception_constructors_cleanup;
     }
 
-    jmethodID get_system_class_loader_smethod =(*jni_env)->GetStaticMethodID(jni_env, class_loader_class, "getSystemClassLoader", "()Ljava/lang/ClassLoader;");
-    if (check_and_clear_exception(jni_env) || NULL == get_system_class_loader_smethod)
+    error_code = (*jvmti_env)->GetClassMethods(jvmti_env, class, &method_count, &methods);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
     {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not find method java.lang.ClassLoader.getSystemClassLoader()Ljava/lang/ClassLoader;\n");
-        goto get_system_class_loader_cleanup;
+        goto watch_exception_constructors_cleanup;
     }
 
-    system_class_loader = (*jni_env)->CallStaticObjectMethod(jni_env, class_loader_class, get_system_class_loader_smethod);
-    if (check_and_clear_exception(jni_env))
+    for (jint i = 0; i < method_count; ++i)
     {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Exception occurred: Cannot get the system class loader\n");
-        goto get_system_class_loader_cleanup;
+        if (!is_constructor(jvmti_env, methods[i]))
+        {
+            continue;
+        }
+
+        jlocation start_location;
+        jlocation end_location;
+        error_code = (*jvmti_env)->GetMethodLocation(jvmti_env, methods[i], &start_location, &end_location);
+        if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        {
+            continue;
+        }
+
+        error_code = (*jvmti_env)->SetBreakpoint(jvmti_env, methods[i], start_location);
+        if (JVMTI_ERROR_DUPLICATE != error_code && !check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        {
+            VERBOSE_PRINT("Watching a constructor of '%s'\n", class_name);
+        }
     }
 
-get_system_class_loader_cleanup:
-    (*jni_env)->DeleteLocalRef(jni_env, class_loader_class);
-    return system_class_loader;
+    error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)methods);
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+
+watch_exception_constructors_cleanup:
+    error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)signature);
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
 }
 
 
 
 /*
- * Return path to given class.
+ * Watches constructors of the listed exception types loaded before the live
+ * phase, when breakpoints could not be set.
  */
-static char* get_path_to_class(
+static void watch_loaded_exception_constructors(
             jvmtiEnv *jvmti_env,
-            JNIEnv   *jni_env,
-            jclass    class,
-            char     *class_name,
-            const char *stringize_method_name)
+            JNIEnv   *jni_env)
 {
-    jobject class_loader = NULL;
-    (*jvmti_env)->GetClassLoader(jvmti_env, class, &class_loader);
-
-    /* class is loaded using boot classloader */
-    if (class_loader == NULL)
+    jint num_classes = 0;
+    jclass *loaded_classes = NULL;
+    jvmtiError error_code = (*jvmti_env)->GetLoadedClasses(jvmti_env, &num_classes, &loaded_classes);
+    if (check_jvmti_error(jvmti_env, error_code, "jvmtiEnv::GetLoadedClasses()"))
     {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": A class has not been loaded by a ClassLoader. Going to use the system class loader.\n");
+        return;
+    }
 
-        class_loader = get_system_class_loader(jvmti_env, jni_env);
-        if (NULL == class_loader)
-        {
-            VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Cannot get the system class loader.");
-            return NULL;
-        }
+    for (jint i = 0; i < num_classes; ++i)
+    {
+        watch_exception_constructors(jvmti_env, loaded_classes[i]);
+        (*jni_env)->DeleteLocalRef(jni_env, loaded_classes[i]);
     }
 
-    return get_path_to_class_class_loader(jvmti_env, jni_env, class_loader, class_name, stringize_method_name);
+    error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)loaded_classes);
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
 }
 
 
@@ -1803,99 +2951,96 @@ static char* get_path_to_class(
  * Looks up a Class instance of given class name in the list of already loaded
  * classes.
  *
- * Calls toString() method for each entry in the result to
- * JVMTI::GetLoadedClasses() and compares its result to the given class name.
+ * Uses the index of loaded classes, so the class is not searched by calling
+ * getName() of every loaded class.
  */
 static jclass find_class_in_loaded_class(
-            jvmtiEnv   *jvmti_env,
+            jvmtiEnv   *jvmti_env __UNUSED_VAR,
             JNIEnv     *jni_env,
             const char *searched_class_name)
 {
-    jclass result = NULL;
-    jint num_classes = 0;
-    jclass *loaded_classes;
-    jvmtiError error = (*jvmti_env)->GetLoadedClasses(jvmti_env, &num_classes, &loaded_classes);
-    if (check_jvmti_error(jvmti_env, error, "jvmtiEnv::GetLoadedClasses()"))
+    if (NULL == classIndex)
     {
         return NULL;
     }
 
-    jclass class_class = (*jni_env)->FindClass(jni_env, "java/lang/Class");
-    if (check_and_clear_exception(jni_env) || NULL == class_class)
+    jclass result = class_index_find(classIndex, jni_env, searched_class_name);
+    if (NULL != result)
     {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get class of java/lang/Class\n");
-        goto find_class_in_loaded_class_cleanup;
+        VERBOSE_PRINT("The class was found in the index of loaded classes\n");
     }
 
-    jmethodID get_name_method = (*jni_env)->GetMethodID(jni_env, class_class, "getName", "()Ljava/lang/String;");
-    if (check_and_clear_exception(jni_env) || NULL == get_name_method)
+    return result;
+}
+
+
+
+/*
+ * Returns cached metadata of given class. Computes and caches the metadata
+ * if the class has none yet.
+ */
+static const T_classMetadata *get_class_metadata(
+            jvmtiEnv       *jvmti_env,
+            JNIEnv         *jni_env,
+            const T_jniCache *cache,
+            jclass          class,
+            char           *class_name)
+{
+    const T_classMetadata *metadata = class_metadata_get(jvmti_env, class);
+    if (NULL != metadata)
     {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of java/lang/Class.getName()Ljava/lang/String;\n");
-        (*jni_env)->DeleteLocalRef(jni_env, class_class);
-        goto find_class_in_loaded_class_cleanup;
+        return metadata;
     }
 
-    for (jint i = 0; NULL == result && i < num_classes; ++i)
+    char *updated_cls_name_str = create_updated_class_name(class_name);
+    if (NULL == updated_cls_name_str)
     {
-        jobject class_name = (*jni_env)->CallObjectMethod(jni_env, loaded_classes[i], get_name_method);
-        if (check_and_clear_exception(jni_env) || NULL == class_name)
-        {
-            VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get name of a loaded class\n");
-            continue;
-        }
-
-        char *class_name_cstr = (char*)(*jni_env)->GetStringUTFChars(jni_env, class_name, NULL);
-        if (strcmp(searched_class_name, class_name_cstr) == 0)
-        {
-            VERBOSE_PRINT("The class was found in the array of loaded classes\n");
-            result = loaded_classes[i];
-        }
-
-        (*jni_env)->ReleaseStringUTFChars(jni_env, class_name, class_name_cstr);
-        (*jni_env)->DeleteLocalRef(jni_env, class_name);
+        return NULL;
     }
 
-find_class_in_loaded_class_cleanup:
-    if (NULL != loaded_classes)
-        (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)loaded_classes);
+    char *location = get_path_to_class(jvmti_env, jni_env, class, updated_cls_name_str, cache->url_to_external_form);
+    char *fs_path = get_path_to_class(jvmti_env, jni_env, class, updated_cls_name_str, cache->url_get_path);
+    if (NULL != fs_path)
+        fs_path = extract_fs_path(fs_path);
 
-    return result;
+    free(updated_cls_name_str);
+
+    return class_metadata_attach(jvmti_env, class, class_metadata_new(location, fs_path));
 }
 
 
 
 /*
  * Print one method from stack frame.
+ *
+ * The file system path of the frame's class is allocated from given arena.
  */
 static int print_stack_trace_element(
             jvmtiEnv       *jvmti_env,
             JNIEnv         *jni_env,
             jobject         stack_frame,
-            char           *stack_trace_str,
-            unsigned        max_length,
+            T_stringBuilder *stack_trace,
+            T_reportArena  *arena,
             char           **class_fs_path)
 {
-    jclass stack_frame_class = (*jni_env)->GetObjectClass(jni_env, stack_frame);
-    jmethodID get_class_name_method = (*jni_env)->GetMethodID(jni_env, stack_frame_class, "getClassName", "()Ljava/lang/String;");
-    if (check_and_clear_exception(jni_env) || get_class_name_method == NULL)
+    const T_jniCache *cache = jni_cache_get(jni_env);
+    if (NULL == cache)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of $(Frame class).getClassName()Ljava/lang/String;\n");
-        (*jni_env)->DeleteLocalRef(jni_env, stack_frame_class);
         return -1;
     }
 
-    jstring class_name_of_frame_method = (*jni_env)->CallObjectMethod(jni_env, stack_frame, get_class_name_method);
+    jstring class_name_of_frame_method = (*jni_env)->CallObjectMethod(jni_env, stack_frame, cache->stack_trace_element_get_class_name);
     if (check_and_clear_exception(jni_env) || class_name_of_frame_method == NULL)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get class name of a class on a frame\n");
-        (*jni_env)->DeleteLocalRef(jni_env, stack_frame_class);
         return -1;
     }
 
     char *cls_name_str = (char*)(*jni_env)->GetStringUTFChars(jni_env, class_name_of_frame_method, NULL);
     string_replace(cls_name_str, '.', '/');
     jclass class_of_frame_method = (*jni_env)->FindClass(jni_env, cls_name_str);
-    char *class_location = NULL;
+    const char *class_location = NULL;
 
     if (check_and_clear_exception(jni_env) || NULL == class_of_frame_method)
     {
@@ -1907,51 +3052,267 @@ static int print_stack_trace_element(
 
     if (NULL != class_of_frame_method)
     {
-        char *updated_cls_name_str = create_updated_class_name(cls_name_str);
-        if (updated_cls_name_str != NULL)
+        /* The frame is formatted by the reporting thread long after the
+         * method left the stack, so its class might have been unloaded in the
+         * meantime. The metadata belong to the class tag and are released by
+         * callback_on_object_free(); the local reference keeps the class
+         * reachable and must be held until class_location is printed. */
+        const T_classMetadata *metadata = get_class_metadata(jvmti_env, jni_env, cache, class_of_frame_method, cls_name_str);
+        if (NULL != metadata)
         {
-            class_location = get_path_to_class(jvmti_env, jni_env, class_of_frame_method, updated_cls_name_str, TO_EXTERNAL_FORM_METHOD_NAME);
+            class_location = class_metadata_location(metadata);
 
-            if (NULL != class_fs_path)
+            if (NULL != class_fs_path && NULL != class_metadata_fs_path(metadata))
             {
-                *class_fs_path = get_path_to_class(jvmti_env, jni_env, class_of_frame_method, updated_cls_name_str, GET_PATH_METHOD_NAME);
-                if (NULL != *class_fs_path)
-                    *class_fs_path = extract_fs_path(*class_fs_path);
+                *class_fs_path = report_arena_strdup(arena, class_metadata_fs_path(metadata));
             }
-
-            free(updated_cls_name_str);
         }
-        (*jni_env)->DeleteLocalRef(jni_env, class_of_frame_method);
     }
     (*jni_env)->ReleaseStringUTFChars(jni_env, class_name_of_frame_method, cls_name_str);
+    (*jni_env)->DeleteLocalRef(jni_env, class_name_of_frame_method);
 
-    jmethodID to_string_method = (*jni_env)->GetMethodID(jni_env, stack_frame_class, "toString", "()Ljava/lang/String;");
-    (*jni_env)->DeleteLocalRef(jni_env, stack_frame_class);
-    if (check_and_clear_exception(jni_env) || to_string_method == NULL)
-    {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of $(Frame class).toString()Ljava/lang/String;\n");
-        return -1;
-    }
-
-    jobject orig_str = (*jni_env)->CallObjectMethod(jni_env, stack_frame, to_string_method);
+    jobject orig_str = (*jni_env)->CallObjectMethod(jni_env, stack_frame, cache->object_to_string);
     if (check_and_clear_exception(jni_env) || NULL == orig_str)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get a string representation of a class on a frame\n");
         (*jni_env)->DeleteLocalRef(jni_env, orig_str);
+        (*jni_env)->DeleteLocalRef(jni_env, class_of_frame_method);
         return -1;
     }
 
-    char *str = (char*)(*jni_env)->GetStringUTFChars(jni_env, orig_str, NULL);
-    int wrote = snprintf(stack_trace_str, max_length, "\tat %s [%s]\n", str, class_location == NULL ? "unknown" : class_location);
-    if (wrote > 0 && stack_trace_str[wrote-1] != '\n')
+    const size_t frame_begin = string_builder_length(stack_trace);
+    int wrote = 0;
+    if (string_builder_append(stack_trace, "\tat ")
+        || string_builder_append_jstring(stack_trace, jni_env, orig_str)
+        || string_builder_printf(stack_trace, " [%s]\n", class_location == NULL ? "unknown" : class_location))
     {   /* the length limit was reached and frame is printed only partially */
         /* so in order to not show partial frames clear current frame's data */
         VERBOSE_PRINT("Too many frames or too long frame. Finishing stack trace generation.");
-        stack_trace_str[0] = '\0';
-        wrote = 0;
+        string_builder_truncate(stack_trace, frame_begin);
+    }
+    else
+    {
+        wrote = (int)(string_builder_length(stack_trace) - frame_begin);
     }
-    (*jni_env)->ReleaseStringUTFChars(jni_env, orig_str, str);
     (*jni_env)->DeleteLocalRef(jni_env, orig_str);
+    (*jni_env)->DeleteLocalRef(jni_env, class_of_frame_method);
+    return wrote;
+}
+
+
+
+/*
+ * Gets file system path to the class declaring given method.
+ *
+ * @returns The path allocated from given arena or NULL
+ */
+static char *get_method_class_fs_path(
+            jvmtiEnv         *jvmti_env,
+            JNIEnv           *jni_env,
+            const T_jniCache *cache,
+            jmethodID         method,
+            T_reportArena    *arena)
+{
+    jclass class = NULL;
+    char *class_signature = NULL;
+    char *fs_path = NULL;
+
+    jvmtiError error_code = (*jvmti_env)->GetMethodDeclaringClass(jvmti_env, method, &class);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        return NULL;
+
+    error_code = (*jvmti_env)->GetClassSignature(jvmti_env, class, &class_signature, NULL);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        goto get_method_class_fs_path_cleanup;
+
+    /* Ljava/lang/String; -> java/lang/String */
+    char *class_name = format_class_name(class_signature, '\0');
+    string_replace(class_name, '.', '/');
+
+    const T_classMetadata *metadata = get_class_metadata(jvmti_env, jni_env, cache, class, class_name);
+    if (NULL != metadata && NULL != class_metadata_fs_path(metadata))
+    {
+        fs_path = report_arena_strdup(arena, class_metadata_fs_path(metadata));
+    }
+
+    error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)class_signature);
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+
+get_method_class_fs_path_cleanup:
+    (*jni_env)->DeleteLocalRef(jni_env, class);
+    return fs_path;
+}
+
+
+
+/*
+ * Print one frame of a stack got from JVMTI.
+ *
+ * The frame has the same format as the frames printed by
+ * print_stack_trace_element(). Formatted frames are cached.
+ */
+static int print_jvmti_stack_frame(
+            jvmtiEnv             *jvmti_env,
+            JNIEnv               *jni_env,
+            const T_jniCache     *cache,
+            const jvmtiFrameInfo *frame,
+            T_stringBuilder      *stack_trace)
+{
+    int wrote = frame_cache_append_frame(frameCache, frame->method, frame->location, stack_trace);
+    if (0 <= wrote)
+    {
+        return wrote;
+    }
+
+    jclass class = NULL;
+    char *class_signature = NULL;
+    char *method_name = NULL;
+    char *source_file_name = NULL;
+    char *frame_str = NULL;
+
+    jvmtiError error_code = (*jvmti_env)->GetMethodDeclaringClass(jvmti_env, frame->method, &class);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        return -1;
+
+    error_code = (*jvmti_env)->GetClassSignature(jvmti_env, class, &class_signature, NULL);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        goto print_jvmti_stack_frame_cleanup;
+
+    error_code = (*jvmti_env)->GetMethodName(jvmti_env, frame->method, &method_name, NULL, NULL);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        goto print_jvmti_stack_frame_cleanup;
+
+    /* Classes compiled without debug info have no source file name */
+    error_code = (*jvmti_env)->GetSourceFileName(jvmti_env, class, &source_file_name);
+    if (JVMTI_ERROR_NONE != error_code)
+    {
+        VERBOSE_PRINT("Cannot get source file name of a class on a frame (JVMTI error %d)\n", (int)error_code);
+        source_file_name = NULL;
+    }
+
+    /* Ljava/lang/String; -> java/lang/String */
+    char *class_name = format_class_name(class_signature, '\0');
+    string_replace(class_name, '.', '/');
+    const T_classMetadata *metadata = get_class_metadata(jvmti_env, jni_env, cache, class, class_name);
+    string_replace(class_name, '/', '.');
+
+    const char *class_location = NULL == metadata ? NULL : class_metadata_location(metadata);
+    if (NULL == class_location)
+    {
+        class_location = "unknown";
+    }
+
+    /* The same format as StackTraceElement.toString() */
+    int length = -1;
+    if (-1 == frame->location)
+    {
+        length = asprintf(&frame_str, "\tat %s.%s(Native Method) [%s]\n", class_name, method_name, class_location);
+    }
+    else
+    {
+        const int line_number = frame_cache_get_line_number(frameCache, jvmti_env, frame->method, frame->location);
+        if (NULL != source_file_name && 0 <= line_number)
+        {
+            length = asprintf(&frame_str, "\tat %s.%s(%s:%d) [%s]\n", class_name, method_name, source_file_name, line_number, class_location);
+        }
+        else if (NULL != source_file_name)
+        {
+            length = asprintf(&frame_str, "\tat %s.%s(%s) [%s]\n", class_name, method_name, source_file_name, class_location);
+        }
+        else
+        {
+            length = asprintf(&frame_str, "\tat %s.%s(Unknown Source) [%s]\n", class_name, method_name, class_location);
+        }
+    }
+
+    if (0 > length)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": asprintf(): out of memory\n");
+        frame_str = NULL;
+        goto print_jvmti_stack_frame_cleanup;
+    }
+
+    frame_cache_put_frame(frameCache, frame->method, frame->location, frame_str);
+
+    if (0 == string_builder_append_n(stack_trace, frame_str, length))
+    {
+        wrote = length;
+    }
+    else
+    {   /* the length limit was reached, do not show partial frames */
+        VERBOSE_PRINT("Too many frames or too long frame. Finishing stack trace generation.");
+        wrote = 0;
+    }
+
+print_jvmti_stack_frame_cleanup:
+    free(frame_str);
+
+    if (NULL != source_file_name)
+    {
+        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)source_file_name);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+    }
+    if (NULL != method_name)
+    {
+        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)method_name);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+    }
+    if (NULL != class_signature)
+    {
+        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)class_signature);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+    }
+    (*jni_env)->DeleteLocalRef(jni_env, class);
+
+    return wrote;
+}
+
+
+
+/*
+ * Print frames of a stack captured by capture_raw_stack_trace().
+ *
+ * Does not call any Java method for frames which were already printed.
+ */
+static int print_jvmti_stack_trace(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            const T_rawStackTrace *raw,
+            T_stringBuilder *stack_trace,
+            T_reportArena *arena,
+            char     **executable)
+{
+    const T_jniCache *cache = jni_cache_get(jni_env);
+    if (NULL == cache)
+    {
+        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of java/lang/ClassLoader.getResource(Ljava/lang/String;)Ljava/net/URL;\n");
+        return -1;
+    }
+
+    int wrote = 0;
+    for (jint i = 0; i < raw->frame_count; ++i)
+    {
+        const int frame_wrote = print_jvmti_stack_frame(jvmti_env,
+                jni_env,
+                cache,
+                raw->frames + i,
+                stack_trace);
+
+        if (frame_wrote <= 0)
+        {   /* <  0 : failed to get information about the frame */
+            /* == 0 : wrote nothing: the length limit was reached and no more */
+            /* frames can be added to the stack trace */
+            break;
+        }
+
+        wrote += frame_wrote;
+    }
+
+    if (NULL != executable && NULL != raw->bottom_method)
+    {
+        *executable = get_method_class_fs_path(jvmti_env, jni_env, cache, raw->bottom_method, arena);
+    }
+
     return wrote;
 }
 
@@ -1959,60 +3320,60 @@ static int print_stack_trace_element(
 
 /*
  * Generates standard Java exception stack trace with file system path to the file
+ *
+ * The frames are taken from the raw stack trace if it has frames and the stack
+ * trace engine is 'jvmti'; otherwise from the exception object.
  */
 static int print_exception_stack_trace(
             jvmtiEnv *jvmti_env,
             JNIEnv   *jni_env,
             jobject   exception,
-            char     *stack_trace_str,
-            size_t    max_stack_trace_lenght,
+            const T_rawStackTrace *raw,
+            T_stringBuilder *stack_trace,
+            T_reportArena *arena,
             char     **executable)
 {
-
-    jclass exception_class = (*jni_env)->GetObjectClass(jni_env, exception);
-    jmethodID to_string_method = (*jni_env)->GetMethodID(jni_env, exception_class, "toString", "()Ljava/lang/String;");
-    if (check_and_clear_exception(jni_env) || to_string_method == NULL)
+    const T_jniCache *cache = jni_cache_get(jni_env);
+    if (NULL == cache)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of $(Exception class).toString()Ljava/lang/String;\n");
-        (*jni_env)->DeleteLocalRef(jni_env, exception_class);
         return -1;
     }
 
-    jobject exception_str = (*jni_env)->CallObjectMethod(jni_env, exception, to_string_method);
+    jobject exception_str = (*jni_env)->CallObjectMethod(jni_env, exception, cache->object_to_string);
     if (check_and_clear_exception(jni_env) || exception_str == NULL)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get a string representation of a class on a frame\n");
-        (*jni_env)->DeleteLocalRef(jni_env, exception_class);
         return -1;
     }
 
-    char *str = (char*)(*jni_env)->GetStringUTFChars(jni_env, exception_str, NULL);
-    int wrote = snprintf(stack_trace_str, max_stack_trace_lenght, "%s\n", str);
-    if (wrote < 0 )
-    {   /* this should never happen, snprintf() usually works w/o errors */
-        return -1;
-    }
-    if (wrote > 0 && stack_trace_str[wrote-1] != '\n')
+    const size_t exception_begin = string_builder_length(stack_trace);
+    if (string_builder_append_jstring(stack_trace, jni_env, exception_str)
+        || string_builder_append_n(stack_trace, "\n", 1))
     {
         VERBOSE_PRINT("Too long exception string. Not generating stack trace at all.");
         /* in order to not show partial exception clear current frame's data */
-        stack_trace_str[0] = '\0';
+        string_builder_truncate(stack_trace, exception_begin);
+        (*jni_env)->DeleteLocalRef(jni_env, exception_str);
         return 0;
     }
 
-    (*jni_env)->ReleaseStringUTFChars(jni_env, exception_str, str);
     (*jni_env)->DeleteLocalRef(jni_env, exception_str);
+    int wrote = (int)(string_builder_length(stack_trace) - exception_begin);
 
-    jmethodID get_stack_trace_method = (*jni_env)->GetMethodID(jni_env, exception_class, "getStackTrace", "()[Ljava/lang/StackTraceElement;");
-    (*jni_env)->DeleteLocalRef(jni_env, exception_class);
-
-    if (check_and_clear_exception(jni_env) || get_stack_trace_method == NULL)
+    if (ST_ENGINE_JVMTI == globalConfig.stackTraceEngine && NULL != raw && NULL != raw->frames)
     {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of $(Exception class).getStackTrace()[Ljava/lang/StackTraceElement;\n");
-        return wrote;
+        const int frames_wrote = print_jvmti_stack_trace(jvmti_env,
+                jni_env,
+                raw,
+                stack_trace,
+                arena,
+                executable);
+
+        return frames_wrote < 0 ? wrote : wrote + frames_wrote;
     }
 
-    jobject stack_trace_array = (*jni_env)->CallObjectMethod(jni_env, exception, get_stack_trace_method);
+    jobject stack_trace_array = (*jni_env)->CallObjectMethod(jni_env, exception, cache->throwable_get_stack_trace);
     if (check_and_clear_exception(jni_env) || stack_trace_array ==  NULL)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get a stack trace from an exception object\n");
@@ -2028,271 +3389,561 @@ static int print_exception_stack_trace(
         const int frame_wrote = print_stack_trace_element(jvmti_env,
                 jni_env,
                 frame_element,
-                stack_trace_str + wrote,
-                max_stack_trace_lenght - wrote,
+                stack_trace,
+                arena,
                 ((NULL != executable && array_size - 1 == i) ? executable : NULL));
 
-        (*jni_env)->DeleteLocalRef(jni_env, frame_element);
+        (*jni_env)->DeleteLocalRef(jni_env, frame_element);
+
+        if (frame_wrote <= 0)
+        {   /* <  0 : this should never happen, snprintf() usually works w/o errors */
+            /* == 0 : wrote nothing: the length limit was reached and no more */
+            /* frames can be added to the stack trace */
+            break;
+        }
+
+        wrote += frame_wrote;
+    }
+
+    (*jni_env)->DeleteLocalRef(jni_env, stack_trace_array);
+
+    return wrote;
+}
+
+/*
+ * Captures data needed for generating the stack trace of a thrown exception.
+ *
+ * Only the frames of the throwing thread are captured; names, lines and
+ * locations are resolved later by generate_thread_stack_trace(). The frames
+ * are captured whatever the stack trace engine is because the 'throwable'
+ * engine needs them if the exception object is not available any more.
+ *
+ * @param arena Memory of the report
+ * @param thread The throwing thread or NULL if the frames are taken from the
+ *        exception object
+ * @param executable Capture the bottom most method of the stack too
+ * @returns Memory allocated from the arena or NULL
+ */
+static T_rawStackTrace *capture_raw_stack_trace(
+            jvmtiEnv      *jvmti_env,
+            T_reportArena *arena,
+            jthread        thread,
+            const char    *thread_name,
+            int            executable)
+{
+    T_rawStackTrace *raw = (T_rawStackTrace *)report_arena_alloc(arena, sizeof(*raw));
+    if (NULL == raw)
+    {
+        return NULL;
+    }
+
+    memset(raw, 0, sizeof(*raw));
+    raw->executable = executable;
+    raw->thread_name = report_arena_strdup(arena, thread_name);
+    if (NULL == raw->thread_name)
+    {
+        return NULL;
+    }
+
+    /* The frames cannot be formatted without the frame cache */
+    if (NULL == thread || NULL == frameCache)
+    {
+        return raw;
+    }
+
+    /* The stack of the current thread cannot change while it is being
+     * captured, so only the needed frames are allocated */
+    jint frame_count = 0;
+    jvmtiError error_code = (*jvmti_env)->GetFrameCount(jvmti_env, thread, &frame_count);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)) || 0 == frame_count)
+    {   /* fall back to the frames of the exception object */
+        return raw;
+    }
+
+    const jint max_depth = frame_count < (jint)globalConfig.stackTraceDepth ? frame_count : (jint)globalConfig.stackTraceDepth;
+    raw->frames = (jvmtiFrameInfo *)report_arena_alloc(arena, max_depth * sizeof(*raw->frames));
+    if (NULL == raw->frames)
+    {
+        return raw;
+    }
+
+    error_code = (*jvmti_env)->GetStackTrace(jvmti_env, thread, 0, max_depth, raw->frames, &(raw->frame_count));
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)) || 0 == raw->frame_count)
+    {   /* fall back to the frames of the exception object */
+        raw->frames = NULL;
+        raw->frame_count = 0;
+        return raw;
+    }
 
-        if (frame_wrote <= 0)
-        {   /* <  0 : this should never happen, snprintf() usually works w/o errors */
-            /* == 0 : wrote nothing: the length limit was reached and no more */
-            /* frames can be added to the stack trace */
-            break;
-        }
+    VERBOSE_PRINT("Number of records filled: %d\n", (int)raw->frame_count);
 
-        wrote += frame_wrote;
+    if (executable)
+    {
+        /* The executable is determined by the bottom most frame which need
+         * not be in the array if the stack is deeper than the limit */
+        raw->bottom_method = raw->frames[raw->frame_count - 1].method;
+        if (frame_count > raw->frame_count)
+        {
+            jlocation bottom_location;
+            error_code = (*jvmti_env)->GetFrameLocation(jvmti_env, thread, frame_count - 1, &(raw->bottom_method), &bottom_location);
+            if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+                raw->bottom_method = NULL;
+        }
     }
 
-    (*jni_env)->DeleteLocalRef(jni_env, stack_trace_array);
-
-    return wrote;
+    return raw;
 }
 
+
+
+/*
+ * Generates the text of the stack trace of an exception thrown by a thread
+ * including its causes.
+ *
+ * @returns The text allocated from given arena or NULL
+ */
 static char *generate_thread_stack_trace(
             jvmtiEnv *jvmti_env,
             JNIEnv   *jni_env,
-            char     *thread_name,
-            jobject  exception,
+            const T_rawStackTrace *raw,
+            T_reportArena *arena,
             char     **executable)
 {
-    char  *stack_trace_str;
-    /* allocate string which will contain stack trace */
-    stack_trace_str = (char*)calloc(MAX_STACK_TRACE_STRING_LENGTH + 1, sizeof(char));
-    if (stack_trace_str == NULL)
+    jobject exception = raw->exception;
+
+    /* The text is built in the thread's builder whose memory is reused by
+     * all reports generated by the thread and only the result is copied */
+    T_stringBuilder *stack_trace = string_builder_get_thread_builder(globalConfig.stackTraceSize);
+    if (NULL == stack_trace)
     {
-        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc(): out of memory");
         return NULL;
     }
 
-    int wrote = snprintf(stack_trace_str, MAX_STACK_TRACE_STRING_LENGTH, "Exception in thread \"%s\" ", thread_name);
-    int exception_wrote = print_exception_stack_trace(jvmti_env,
+    if (string_builder_printf(stack_trace, "Exception in thread \"%s\" ", raw->thread_name))
+    {
+        VERBOSE_PRINT("Too long thread name. Not generating stack trace at all.");
+        return NULL;
+    }
+
+    /* Only the top most exception is being thrown by the thread */
+    const int exception_wrote = print_exception_stack_trace(jvmti_env,
             jni_env,
             exception,
-            stack_trace_str + wrote,
-            MAX_STACK_TRACE_STRING_LENGTH - wrote,
+            raw,
+            stack_trace,
+            arena,
             executable);
 
     if (exception_wrote <= 0)
     {
-        free(stack_trace_str);
         return NULL;
     }
 
-    wrote += exception_wrote;
-
-    /* GetObjectClass() throws nothing */
-    jclass exception_class = (*jni_env)->GetObjectClass(jni_env, exception);
-    if (NULL == exception_class)
-    {
-        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Cannot get class of an object\n");
-        return stack_trace_str;
-    }
-
-    jmethodID get_cause_method = (*jni_env)->GetMethodID(jni_env, exception_class, "getCause", "()Ljava/lang/Throwable;");
-    (*jni_env)->DeleteLocalRef(jni_env, exception_class);
-
-    if (check_and_clear_exception(jni_env) || NULL == get_cause_method)
+    const T_jniCache *cache = jni_cache_get(jni_env);
+    if (NULL == cache)
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of $(Exception class).getCause()Ljava/lang/Throwable;\n");
-        return stack_trace_str;
+        goto generate_thread_stack_trace_copy;
     }
 
+    const jmethodID get_cause_method = cache->throwable_get_cause;
+
     jobject cause = (*jni_env)->CallObjectMethod(jni_env, exception, get_cause_method);
     if (check_and_clear_exception(jni_env))
     {
         VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Failed to get an inner exception of the top most one;\n");
-        return stack_trace_str;
+        goto generate_thread_stack_trace_copy;
     }
 
     while (NULL != cause)
     {
-        if ((size_t)(MAX_STACK_TRACE_STRING_LENGTH - wrote) < (sizeof(CAUSED_STACK_TRACE_HEADER) - 1))
+        const size_t cause_begin = string_builder_length(stack_trace);
+        if (string_builder_append_n(stack_trace, CAUSED_STACK_TRACE_HEADER, sizeof(CAUSED_STACK_TRACE_HEADER) - 1))
         {
             VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Full exception stack trace buffer. Cannot add a cause.");
             (*jni_env)->DeleteLocalRef(jni_env, cause);
             break;
         }
 
-        strcat(stack_trace_str + wrote, CAUSED_STACK_TRACE_HEADER);
-        wrote += sizeof(CAUSED_STACK_TRACE_HEADER) - 1;
-
         const int cause_wrote = print_exception_stack_trace(jvmti_env,
                 jni_env,
                 cause,
-                stack_trace_str + wrote,
-                MAX_STACK_TRACE_STRING_LENGTH - wrote,
+                /*Frames of the cause*/NULL,
+                stack_trace,
+                arena,
                 /*No executable*/NULL);
 
         if (cause_wrote <= 0)
-        {   /* <  0 : this should never happen, snprintf() usually works w/o errors */
+        {   /* <  0 : failed to get a string representation of the cause */
             /* == 0 : wrote nothing: the length limit was reached and no more */
             /* cause can be added to the stack trace */
+            string_builder_truncate(stack_trace, cause_begin);
+            (*jni_env)->DeleteLocalRef(jni_env, cause);
             break;
         }
 
-        wrote += cause_wrote;
-
         jobject next_cause = (*jni_env)->CallObjectMethod(jni_env, cause, get_cause_method);
         (*jni_env)->DeleteLocalRef(jni_env, cause);
         if (check_and_clear_exception(jni_env))
         {
             VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Failed to get an inner exception of another inner one;\n");
-            return stack_trace_str;
+            break;
         }
         cause = next_cause;
     }
 
-    return stack_trace_str;
+generate_thread_stack_trace_copy:
+    return report_arena_strndup(arena, string_builder_cstr(stack_trace), string_builder_length(stack_trace));
 }
 
-#ifdef GENERATE_JVMTI_STACK_TRACE
+
+
 /*
- * Print one method from stack frame.
+ * Generates the text of the stack trace of an exception which is not
+ * available any more from the frames captured when it was thrown.
+ *
+ * The exception is described only by its type, its message and causes are
+ * lost.
+ *
+ * @returns The text allocated from given arena or NULL
  */
-static void print_one_method_from_stack(
-            jvmtiEnv       *jvmti_env,
-            JNIEnv         *jni_env,
-            jvmtiFrameInfo  stack_frame,
-            char           *stack_trace_str)
+static char *generate_frames_stack_trace(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            const T_rawStackTrace *raw,
+            const char *exception_type_name,
+            T_reportArena *arena,
+            char     **executable)
 {
-    jvmtiError  error_code;
-    jclass      declaring_class;
-    char       *method_name = NULL;
-    char       *declaring_class_name = NULL;
-    char       *source_file_name = NULL;
+    T_stringBuilder *stack_trace = string_builder_get_thread_builder(globalConfig.stackTraceSize);
+    if (NULL == stack_trace)
+    {
+        return NULL;
+    }
 
-    error_code = (*jvmti_env)->GetMethodName(jvmti_env, stack_frame.method, &method_name, NULL, NULL);
-    if (error_code != JVMTI_ERROR_NONE)
+    if (string_builder_printf(stack_trace, "Exception in thread \"%s\" %s\n", raw->thread_name, exception_type_name))
     {
-        return;
+        VERBOSE_PRINT("Too long thread name or exception type. Not generating stack trace at all.");
+        return NULL;
     }
-    error_code = (*jvmti_env)->GetMethodDeclaringClass(jvmti_env, stack_frame.method, &declaring_class);
-    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
-        goto print_one_method_from_stack_cleanup;
 
-    error_code = (*jvmti_env)->GetClassSignature(jvmti_env, declaring_class, &declaring_class_name, NULL);
+    if (print_jvmti_stack_trace(jvmti_env, jni_env, raw, stack_trace, arena, executable) <= 0)
+    {
+        return NULL;
+    }
+
+    return report_arena_strndup(arena, string_builder_cstr(stack_trace), string_builder_length(stack_trace));
+}
+
+
+
+/*
+ * Computes a fingerprint of an exception from its type and the top
+ * 'probedepth' frames of the current thread's stack. Cheap enough for every
+ * thrown exception, no names are resolved.
+ *
+ * @returns A non zero fingerprint or 0 if the stack is not available
+ */
+static uint64_t get_stack_fingerprint(
+            jvmtiEnv   *jvmti_env,
+            const char *exception_type_name)
+{
+    jvmtiFrameInfo frames[MAX_PROBE_DEPTH];
+    jint count = 0;
+    jvmtiError error_code = (*jvmti_env)->GetStackTrace(jvmti_env, /*current thread*/NULL, 0,
+            (jint)globalConfig.probeDepth, frames, &count);
     if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
-        goto print_one_method_from_stack_cleanup;
+    {
+        return 0;
+    }
 
-    if (error_code != JVMTI_ERROR_NONE)
+    /* FNV-1a */
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (const char *c = null2empty(exception_type_name); '\0' != *c; ++c)
     {
-        return;
+        hash = (hash ^ (unsigned char)*c) * UINT64_C(0x100000001b3);
     }
-    char *updated_class_name = format_class_name_for_JNI_call(declaring_class_name);
-    int line_number = get_line_number(jvmti_env, stack_frame.method, stack_frame.location);
-    if (declaring_class != NULL)
+
+    for (jint i = 0; i < count; ++i)
     {
-        error_code = (*jvmti_env)->GetSourceFileName(jvmti_env, declaring_class, &source_file_name);
-        if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
-            goto print_one_method_from_stack_cleanup;
+        hash = (hash ^ ((uint64_t)(uintptr_t)frames[i].method >> 3)) * UINT64_C(0x100000001b3);
+        hash = (hash ^ (uint64_t)frames[i].location) * UINT64_C(0x100000001b3);
     }
 
-    char buf[1000];
-    char line_number_buf[20];
-    if (line_number >= 0)
+    hash ^= hash >> 29;
+    return 0 == hash ? 1 : hash;
+}
+
+
+
+/*
+ * The first stage of processing a thrown exception which is not reported
+ * yet. Identifies the exception by a fingerprint of its top frames and checks
+ * whether it is counted to a pending coalesced report or exceeds the rate
+ * limit. Nothing is resolved or allocated for such exceptions.
+ *
+ * A postponed exception is neither coalesced nor charged to the rate limit
+ * because most of them are caught by native code later. Its fingerprint is
+ * charged by postponed_report_rate_limited() once its report is emitted.
+ *
+ * @param postponed The report of the exception is postponed
+ * @param fingerprint Set to the fingerprint if the report of the exception
+ *        is to be held until its deduplication window closes or, if the
+ *        exception is postponed, to be charged to the rate limit; otherwise 0
+ * @param suppressed Set to a number of similar exceptions suppressed since
+ *        the previous report
+ * @returns Non zero if the exception is not to be reported
+ */
+static int probe_exception(
+            jvmtiEnv   *jvmti_env,
+            const char *exception_type_name,
+            int         postponed,
+            uint64_t   *fingerprint,
+            size_t     *suppressed)
+{
+    *fingerprint = 0;
+    *suppressed = 0;
+
+    T_reportDedup *dedup = postponed ? NULL : reportDedup;
+    if (NULL == dedup && NULL == reportLimiter)
     {
-        sprintf(line_number_buf, "%d", line_number);
+        return 0;
     }
-    else
+
+    __atomic_add_fetch(&agentStatistics.probed, 1, __ATOMIC_RELAXED);
+
+    const uint64_t hash = get_stack_fingerprint(jvmti_env, exception_type_name);
+    if (0 == hash)
     {
-        strcpy(line_number_buf, "Unknown location");
+        return 0;
     }
 
-    char *class_location = get_path_to_class(jvmti_env, jni_env, declaring_class, updated_class_name, TO_EXTERNAL_FORM_METHOD_NAME);
-    sprintf(buf, "\tat %s%s(%s:%s) [%s]\n", updated_class_name, method_name, source_file_name, line_number_buf, class_location == NULL ? "unknown" : class_location);
-    free(class_location);
-    strncat(stack_trace_str, buf, MAX_STACK_TRACE_STRING_LENGTH - strlen(stack_trace_str) - 1);
+    /* Repeats of a coalesced exception are only counted */
+    if (NULL != dedup)
+    {
+        if (!report_dedup_occurred(dedup, hash))
+        {
+            __atomic_add_fetch(&agentStatistics.coalesced, 1, __ATOMIC_RELAXED);
+            VERBOSE_PRINT("Coalescing a repeated '%s'\n", null2empty(exception_type_name));
+            return 1;
+        }
 
-#ifdef VERBOSE
-    if (line_number >= 0)
+        *fingerprint = hash;
+    }
+
+    if (postponed)
     {
-        printf("\tat %s%s(%s:%d location)\n", updated_class_name, method_name, source_file_name, line_number);
+        *fingerprint = hash;
+        return 0;
     }
-    else
+
+    if (NULL != reportLimiter && !report_limiter_acquire(reportLimiter, hash, suppressed))
     {
-        printf("\tat %s%s(%s:Unknown location)\n", updated_class_name, method_name, source_file_name);
+        __atomic_add_fetch(&agentStatistics.rate_limited, 1, __ATOMIC_RELAXED);
+        VERBOSE_PRINT("Suppressing a report of '%s' exceeding the rate limit\n", null2empty(exception_type_name));
+        return 1;
     }
-#endif
 
-print_one_method_from_stack_cleanup:
-    /* cleanup */
-    if (NULL != method_name)
+    return 0;
+}
+
+
+
+/*
+ * Charges a postponed report which is about to be emitted to the rate limit
+ * and accounts exceptions suppressed since the previous report to it.
+ *
+ * @returns Non zero if the report exceeds the rate limit and is not to be
+ *          emitted
+ */
+static int postponed_report_rate_limited(
+            T_exceptionReport *rpt)
+{
+    if (NULL == reportLimiter || 0 == rpt->limit_fingerprint)
     {
-        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char*)method_name);
-        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+        return 0;
     }
-    if (NULL != declaring_class_name)
+
+    if (!report_limiter_acquire(reportLimiter, rpt->limit_fingerprint, &rpt->counters.suppressed))
     {
-        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char*)declaring_class_name);
-        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+        __atomic_add_fetch(&agentStatistics.rate_limited, 1, __ATOMIC_RELAXED);
+        VERBOSE_PRINT("Suppressing a report of '%s' exceeding the rate limit\n", null2empty(rpt->exception_type_name));
+        return 1;
     }
-    if (NULL != source_file_name)
+
+    return 0;
+}
+
+
+
+/*
+ * Creates a report of a thrown exception which is not described yet
+ *
+ * Only what cannot be got later is captured, i.e. the frames of the throwing
+ * thread. The report must be described by @exception_report_describe before
+ * it is submitted. The text of the stack trace is generated later by the
+ * reporting thread.
+ *
+ * @param thread The throwing thread whose stack is captured or NULL if the
+ *        frames are taken from the exception object
+ * @returns A report allocated from its own arena or NULL
+ */
+static T_exceptionReport *exception_report_new_pending(
+            jvmtiEnv   *jvmti_env,
+            const char *exception_type_name,
+            jthread     thread,
+            const char *thread_name,
+            size_t      suppressed,
+            uint64_t    fingerprint)
+{
+    /* All data of the report are released at once */
+    T_exceptionReport *rpt = NULL;
+    T_reportArena *arena = report_arena_acquire();
+    if (NULL == arena || NULL == (rpt = (T_exceptionReport *)report_arena_alloc(arena, sizeof(*rpt))))
     {
-        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char*)source_file_name);
-        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+        VERBOSE_PRINT("Cannot allocate memory of the report\n");
+        report_arena_release(arena);
+        return NULL;
     }
+
+    memset(rpt, 0, sizeof(*rpt));
+    rpt->arena = arena;
+
+    rpt->exception_type_name = NULL == exception_type_name
+            ? NULL
+            : report_arena_strdup(rpt->arena, exception_type_name);
+
+    rpt->raw_stacktrace = capture_raw_stack_trace(jvmti_env, rpt->arena, thread, thread_name,
+            globalConfig.executableFlags & ABRT_EXECUTABLE_THREAD);
+
+    rpt->counters = (T_reportCounters){ .suppressed = suppressed };
+    rpt->fingerprint = fingerprint;
+
+    return rpt;
 }
-#endif /* GENERATE_JVMTI_STACK_TRACE */
 
 
-#ifdef GENERATE_JVMTI_STACK_TRACE
+
 /*
- * Print stack trace for given thread.
+ * Formats the message of a report and collects return values of the debug
+ * methods
+ *
+ * @param occurrence The way the exception occurred, e.g. "Caught"
  */
-static char *generate_stack_trace(
-            jvmtiEnv *jvmti_env,
-            JNIEnv   *jni_env,
-            jthread   thread,
-            char     *thread_name,
-            char     *exception_class_name)
+static void exception_report_describe(
+            jvmtiEnv   *jvmti_env,
+            JNIEnv     *jni_env,
+            T_exceptionReport *rpt,
+            const char *occurrence,
+            const char *class_name,
+            const char *method_name)
 {
-    jvmtiError     error_code;
-    jvmtiFrameInfo stack_frames[MAX_STACK_TRACE_DEPTH];
+    rpt->message = format_exception_reason_message(rpt->arena, occurrence,
+            rpt->exception_type_name, class_name, method_name);
+
+    rpt->additional_info = collect_additional_debug_information(jvmti_env, jni_env, rpt->arena);
+}
+
 
-    char  *stack_trace_str;
-    char  buf[1000];
-    int count = -1;
-    int i;
 
-    /* allocate string which will contain stack trace */
-    stack_trace_str = (char*)calloc(MAX_STACK_TRACE_STRING_LENGTH + 1, sizeof(char));
-    if (stack_trace_str == NULL)
+/*
+ * Describes a report by the method where the exception occurred
+ *
+ * @param occurrence The way the exception occurred, e.g. "Caught"
+ */
+static void exception_report_describe_method(
+            jvmtiEnv   *jvmti_env,
+            JNIEnv     *jni_env,
+            T_exceptionReport *rpt,
+            const char *occurrence,
+            jmethodID   method)
+{
+    char *method_name_ptr = NULL;
+    char *class_signature_ptr = NULL;
+    const char *class_name_ptr = "";
+    jclass method_class = NULL;
+
+    jvmtiError error_code = (*jvmti_env)->GetMethodName(jvmti_env, method, &method_name_ptr, NULL, NULL);
+    if (!check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
     {
-        fprintf(stderr, "calloc(): out of memory");
-        return NULL;
+        error_code = (*jvmti_env)->GetMethodDeclaringClass(jvmti_env, method, &method_class);
+        if (!check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        {
+            error_code = (*jvmti_env)->GetClassSignature(jvmti_env, method_class, &class_signature_ptr, NULL);
+            if (!check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+            {
+                /* readable class name */
+                class_name_ptr = format_class_name(class_signature_ptr, '\0');
+            }
+
+            (*jni_env)->DeleteLocalRef(jni_env, method_class);
+        }
     }
 
-    /* get stack trace */
-    error_code = (*jvmti_env)->GetStackTrace(jvmti_env, thread, 0, MAX_STACK_TRACE_DEPTH, stack_frames, &count);
-    VERBOSE_PRINT("Number of records filled: %d\n", count);
-    /* error or is stack trace empty? */
-    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__))
-            || count < 1)
+    exception_report_describe(jvmti_env, jni_env, rpt, occurrence, class_name_ptr,
+            NULL != method_name_ptr ? method_name_ptr : "unknown");
+
+    if (NULL != method_name_ptr)
     {
-        free(stack_trace_str);
-        return NULL;
+        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)method_name_ptr);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+    }
+    if (NULL != class_signature_ptr)
+    {
+        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)class_signature_ptr);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
     }
+}
 
-    sprintf(buf, "Exception in thread \"%s\" %s\n", thread_name, exception_class_name);
-    strncat(stack_trace_str, buf, MAX_STACK_TRACE_STRING_LENGTH - strlen(stack_trace_str) - 1);
 
-    /* print content of stack frames */
-    for (i = 0; i < count; i++) {
-        jvmtiFrameInfo stack_frame = stack_frames[i];
-        print_one_method_from_stack(jvmti_env, jni_env, stack_frame, stack_trace_str);
+
+/*
+ * Creates a described report of a thrown exception
+ *
+ * @param occurrence The way the exception occurred, e.g. "Caught"
+ * @param thread The throwing thread whose stack is captured or NULL if the
+ *        frames are taken from the exception object
+ * @returns A report allocated from its own arena or NULL
+ */
+static T_exceptionReport *exception_report_new(
+            jvmtiEnv   *jvmti_env,
+            JNIEnv     *jni_env,
+            const char *occurrence,
+            const char *exception_type_name,
+            const char *class_name,
+            const char *method_name,
+            jthread     thread,
+            const char *thread_name,
+            size_t      suppressed,
+            uint64_t    fingerprint)
+{
+    T_exceptionReport *rpt = exception_report_new_pending(jvmti_env, exception_type_name, thread, thread_name,
+            suppressed, fingerprint);
+    if (NULL != rpt)
+    {
+        exception_report_describe(jvmti_env, jni_env, rpt, occurrence, class_name, method_name);
     }
 
-    VERBOSE_PRINT(
-    "Exception Stack Trace\n"
-    "=====================\n"
-    "Stack Trace Depth: %d\n"
-    "%s\n", count, stack_trace_str);
+    return rpt;
+}
+
 
 
-    return stack_trace_str;
+/*
+ * Enables or disables ExceptionCatch events of given thread.
+ *
+ * The events are needed only while the thread has a postponed report of an
+ * uncaught exception, so threads catching many exceptions do not pay for them
+ * in the meantime.
+ */
+static void set_exception_catch_events(
+            jvmtiEnv      *jvmti_env,
+            jthread        thread,
+            jvmtiEventMode mode)
+{
+    jvmtiError error_code = (*jvmti_env)->SetEventNotificationMode(jvmti_env, mode, JVMTI_EVENT_EXCEPTION_CATCH, thread);
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
 }
-#endif /* GENERATE_JVMTI_STACK_TRACE */
 
 
 
@@ -2309,146 +3960,93 @@ static void JNICALL callback_on_exception(
             jmethodID catch_method,
             jlocation catch_location __UNUSED_VAR)
 {
-    /* This is caught exception and no caught exception is to be reported */
-    if (NULL != catch_method && NULL == globalConfig.reportedCaughExceptionTypes)
+    /* This is caught exception and no caught exception is to be reported or
+     * the listed types are reported by their constructors */
+    if (NULL != catch_method
+        && (NULL == globalConfig.reportedCaughExceptionTypes || exception_constructors_watched()))
+        return;
+
+    /* Uncaught exceptions are reported by the agent's handler */
+    if (NULL == catch_method && UE_DETECTION_HANDLER == globalConfig.uncaughtDetection)
+        return;
+
+    T_threadState *state = get_thread_state(jvmti_env, thr);
+    if (NULL != state && state->reporting_thread)
         return;
 
     char *exception_type_name = NULL;
 
-    /* all operations should be processed in critical section */
-    enter_critical_section(jvmti_env, shared_lock);
+    /* Per-thread state does not need the critical section; the sinks are
+     * protected by submit_report() */
+    T_exceptionReport *caught_report = NULL;
 
     /* readable class names */
     if (catch_method == NULL || exception_is_intended_to_be_reported(jvmti_env, jni_env, exception_object, &exception_type_name))
     {
-        char tname[MAX_THREAD_NAME_LENGTH];
-        get_thread_name(jvmti_env, thr, tname, sizeof(tname));
+        if (NULL == state)
+            state = create_thread_state(jvmti_env, thr);
 
-        jlong tid = 0;
-        T_jthrowableCircularBuf *threads_exc_buf = NULL;
+        char tname_buffer[MAX_THREAD_NAME_LENGTH];
+        const char *tname = NULL;
 
-        if (NULL != threadMap && 0 == get_tid(jni_env, thr, &tid))
+        if (NULL != state)
         {
-            threads_exc_buf = (T_jthrowableCircularBuf *)jthread_map_get(threadMap, tid);
-            VERBOSE_PRINT("Got circular buffer for thread %p\n", (void *)threads_exc_buf);
+            tname = get_cached_thread_name(jvmti_env, jni_env, thr, state);
         }
         else
         {
-            VERBOSE_PRINT("Cannot get thread's ID. Disabling reporting to ABRT.");
+            VERBOSE_PRINT("Cannot get thread's state. Uncaught exception will not be postponed.");
         }
 
-        if (NULL == threads_exc_buf || NULL == jthrowable_circular_buf_find(threads_exc_buf, exception_object))
+        if (NULL == tname)
         {
-            jvmtiError error_code;
-            jclass method_class;
-            char *method_name_ptr = NULL;
-            char *method_signature_ptr = NULL;
-            char *class_name_ptr = NULL;
-            char *class_signature_ptr = NULL;
-
-            error_code = (*jvmti_env)->GetMethodName(jvmti_env, method, &method_name_ptr, &method_signature_ptr, NULL);
-            if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
-                goto callback_on_exception_cleanup;
-
-            error_code = (*jvmti_env)->GetMethodDeclaringClass(jvmti_env, method, &method_class);
-            if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
-                goto callback_on_exception_cleanup;
-
-            error_code = (*jvmti_env)->GetClassSignature(jvmti_env, method_class, &class_signature_ptr, NULL);
-            if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
-                goto callback_on_exception_cleanup;
-
-            class_name_ptr = format_class_name(class_signature_ptr, '.');
-
-            /* Remove trailing '.' */
-            const ssize_t class_name_len = strlen(class_name_ptr);
-            if (class_name_len > 0)
-                class_name_ptr[class_name_len - 1] = '\0';
+            get_thread_name(jvmti_env, thr, tname_buffer, sizeof(tname_buffer));
+            tname = tname_buffer;
+        }
 
+        if (!exception_was_reported(jvmti_env, exception_object))
+        {
             if (NULL == exception_type_name)
                 exception_type_name = get_exception_type_name(jvmti_env, jni_env, exception_object);
 
-            char *message = format_exception_reason_message(/*caught?*/NULL != catch_method,
-                    exception_type_name, class_name_ptr, method_name_ptr);
-
-            char *executable = NULL;
-            char *stack_trace_str = generate_thread_stack_trace(jvmti_env, jni_env, tname, exception_object,
-                    (globalConfig.executableFlags & ABRT_EXECUTABLE_THREAD) ? &executable : NULL);
-
-            T_infoPair *additional_info = collect_additional_debug_information(jvmti_env, jni_env);
-
-            const char *report_message = message;
-            if (NULL == report_message)
-                report_message = (NULL != catch_method) ? "Caught exception" : "Uncaught exception";
+            /* Nothing is captured for coalesced repeats and for exceptions
+             * exceeding the rate */
+            uint64_t fingerprint = 0;
+            size_t suppressed = 0;
+            if (probe_exception(jvmti_env, exception_type_name, /*postponed?*/NULL == catch_method, &fingerprint, &suppressed))
+                goto callback_on_exception_cleanup;
 
             if (NULL == catch_method)
-            {   /* Postpone reporting of uncaught exceptions as they may be caught by a native function */
-                T_exceptionReport *rpt = malloc(sizeof(*rpt));
-                if (NULL == rpt)
-                {
-                    fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory");
+            {   /* Postpone reporting of uncaught exceptions as they may be caught by a native function.
+                 * Most of them are caught, hence only the frames are captured now and the report is
+                 * described once the exception is known to be uncaught. */
+                T_exceptionReport *rpt = NULL;
+                if (NULL != state && NULL == state->uncaught_exception
+                    && NULL != (rpt = exception_report_new_pending(jvmti_env, exception_type_name, thr, tname, /*suppressed*/0, /*fingerprint*/0))
+                    && NULL != (rpt->exception_object = (*jni_env)->NewGlobalRef(jni_env, exception_object)))
+                {   /* The exception is kept alive until it is caught or the thread ends
+                     * because its stack trace is generated from the exception object
+                     * by the reporting thread */
+                    rpt->method = method;
+                    rpt->limit_fingerprint = fingerprint;
+                    state->uncaught_exception = rpt;
+                    set_exception_catch_events(jvmti_env, thr, JVMTI_ENABLE);
                 }
                 else
                 {
-                    rpt->message = message;
-                    message = NULL;
-
-                    rpt->exception_type_name = exception_type_name;
-                    exception_type_name = NULL;
-
-                    rpt->stacktrace = stack_trace_str;
-                    stack_trace_str = NULL;
-
-                    rpt->executable = executable;
-                    executable = NULL;
-
-                    rpt->additional_info = additional_info;
-                    additional_info = NULL;
-
-                    rpt->exception_object = exception_object;
-
-                    jthread_map_push(uncaughtExceptionMap, tid, (T_exceptionReport *)rpt);
+                    VERBOSE_PRINT("Cannot postpone reporting of the uncaught exception\n");
+                    exception_report_free(jni_env, rpt);
                 }
             }
             else
             {
-                report_stacktrace(NULL != executable ? executable : processProperties.main_class,
-                        report_message,
-                        stack_trace_str,
-                        additional_info);
-
-                if (NULL == threads_exc_buf)
-                    threads_exc_buf = create_exception_buf_for_thread(jni_env, tid);
-
-                if (NULL != threads_exc_buf)
+                caught_report = exception_report_new_pending(jvmti_env, exception_type_name, thr, tname, suppressed, fingerprint);
+                if (NULL != caught_report)
                 {
-                    VERBOSE_PRINT("Pushing to circular buffer\n");
-                    jthrowable_circular_buf_push(threads_exc_buf, exception_object);
+                    exception_report_describe_method(jvmti_env, jni_env, caught_report, "Caught", method);
+                    exception_mark_reported(jvmti_env, exception_object);
                 }
             }
-
-            free(executable);
-            free(message);
-            free(stack_trace_str);
-            info_pair_vector_free(additional_info);
-
-callback_on_exception_cleanup:
-        /* cleapup */
-            if (method_name_ptr != NULL)
-            {
-                error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)method_name_ptr);
-                check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
-            }
-            if (method_signature_ptr != NULL)
-            {
-                error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)method_signature_ptr);
-                check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
-            }
-            if (class_signature_ptr != NULL)
-            {
-                error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)class_signature_ptr);
-                check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
-            }
         }
         else
         {
@@ -2456,12 +4054,16 @@ callback_on_exception_cleanup:
         }
     }
 
+callback_on_exception_cleanup:
     if (NULL != exception_type_name)
     {
         free(exception_type_name);
     }
 
-    exit_critical_section(jvmti_env, shared_lock);
+    if (NULL != caught_report)
+    {
+        submit_report(jvmti_env, jni_env, caught_report, exception_object, "Caught exception");
+    }
 }
 
 
@@ -2471,81 +4073,51 @@ callback_on_exception_cleanup:
 static void JNICALL callback_on_exception_catch(
             jvmtiEnv *jvmti_env,
             JNIEnv   *jni_env,
-            jthread   thread,
-            jmethodID method,
-            jlocation location __UNUSED_VAR,
-            jobject   exception_object)
-{
-    if (jthread_map_empty(uncaughtExceptionMap))
-        return;
-
-    /* all operations should be processed in critical section */
-    enter_critical_section(jvmti_env, shared_lock);
-
-    jclass class;
-
-    jlong tid = 0;
-
-    if (get_tid(jni_env, thread, &tid))
-    {
-        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": Cannot clear uncaught exceptions");
-        goto callback_on_exception_catch_exit;
-    }
+            jthread   thread,
+            jmethodID method,
+            jlocation location __UNUSED_VAR,
+            jobject   exception_object)
+{
+    T_threadState *state = get_thread_state(jvmti_env, thread);
+    if (NULL == state || NULL == state->uncaught_exception)
+        return;
 
-    T_exceptionReport *rpt = (T_exceptionReport *)jthread_map_get(uncaughtExceptionMap, tid);
-    if (NULL == rpt)
-    {
-        goto callback_on_exception_catch_exit;
-    }
+    /* Per-thread state does not need the critical section; the sinks are
+     * protected by submit_report() */
+    T_exceptionReport *caught_report = NULL;
 
-    jclass object_class = (*jni_env)->FindClass(jni_env, "java/lang/Object");
-    if (check_and_clear_exception(jni_env) || NULL == object_class)
-    {
-        VERBOSE_PRINT("Cannot find java/lang/Object class");
-        goto callback_on_exception_catch_exit;
-    }
+    jclass class;
 
-    jmethodID equal_method = (*jni_env)->GetMethodID(jni_env, object_class, "equals", "(Ljava/lang/Object;)Z");
-    if (check_and_clear_exception(jni_env) || NULL == equal_method)
-    {
-        VERBOSE_PRINT("Cannot find java.lang.Object.equals(Ljava/lang/Object;)Z method");
-        (*jni_env)->DeleteLocalRef(jni_env, object_class);
-        goto callback_on_exception_catch_exit;
-    }
+    T_exceptionReport *rpt = state->uncaught_exception;
 
-    jboolean equal_objects = (*jni_env)->CallBooleanMethod(jni_env, exception_object, equal_method, rpt->exception_object);
-    if (check_and_clear_exception(jni_env) || !equal_objects)
+    /* Compares identities, never calls overridden equals() */
+    if (!(*jni_env)->IsSameObject(jni_env, exception_object, rpt->exception_object))
     {
-        VERBOSE_PRINT("Cannot determine whether the caught exception is also the uncaught exception");
-        (*jni_env)->DeleteLocalRef(jni_env, object_class);
+        VERBOSE_PRINT("The caught exception is not the uncaught exception");
         goto callback_on_exception_catch_exit;
     }
 
-    /* Faster than get()-pop() approach is faster because it is search-and-search-free but
-     * pop()-push() approach is search-free-and-search-malloc
+    /* The report is removed only if the caught exception is the uncaught one.
      *
      * JVM always catches java.security.PrivilegedActionException while
      * handling uncaught java.lang.ClassNotFoundException throw by
      * initialization of the system (native) class loader.
      */
-    jthread_map_pop(uncaughtExceptionMap, tid);
+    state->uncaught_exception = NULL;
+    set_exception_catch_events(jvmti_env, thread, JVMTI_DISABLE);
 
-    if (exception_is_intended_to_be_reported(jvmti_env, jni_env, rpt->exception_object, &(rpt->exception_type_name)))
+    /* The type name is kept in the report's arena */
+    char *exception_type_name = rpt->exception_type_name;
+    const int intended = exception_is_intended_to_be_reported(jvmti_env, jni_env, exception_object, &exception_type_name);
+    if (exception_type_name != rpt->exception_type_name)
     {
-        jlong tid = 0;
-        T_jthrowableCircularBuf *threads_exc_buf = NULL;
-
-        if (NULL != threadMap && 0 == get_tid(jni_env, thread, &tid))
-        {
-            threads_exc_buf = (T_jthrowableCircularBuf *)jthread_map_get(threadMap, tid);
-            VERBOSE_PRINT("Got circular buffer for thread %p\n", (void *)threads_exc_buf);
-        }
-        else
-        {
-            VERBOSE_PRINT("Cannot get thread's ID. Disabling reporting to ABRT.");
-        }
+        rpt->exception_type_name = report_arena_strdup(rpt->arena, exception_type_name);
+        free(exception_type_name);
+    }
 
-        if (NULL == threads_exc_buf || NULL == jthrowable_circular_buf_find(threads_exc_buf, rpt->exception_object))
+    if (intended)
+    {
+        if (!exception_was_reported(jvmti_env, exception_object) && !postponed_report_rate_limited(rpt))
         {
             char *method_name_ptr = NULL;
             char *method_signature_ptr = NULL;
@@ -2568,19 +4140,12 @@ static void JNICALL callback_on_exception_catch(
 
             /* readable class name */
             char *class_name_ptr = format_class_name(class_signature_ptr, '\0');
-            char *message = format_exception_reason_message(/*caught*/1, rpt->exception_type_name,  class_name_ptr, method_name_ptr);
-            report_stacktrace(NULL != rpt->executable ? rpt->executable : processProperties.main_class,
-                              NULL != message ? message : "Caught exception",
-                              rpt->stacktrace, rpt->additional_info);
+            exception_report_describe(jvmti_env, jni_env, rpt, "Caught", class_name_ptr, method_name_ptr);
 
-            if (NULL == threads_exc_buf)
-                threads_exc_buf = create_exception_buf_for_thread(jni_env, tid);
+            exception_mark_reported(jvmti_env, exception_object);
 
-            if (NULL != threads_exc_buf)
-            {
-                VERBOSE_PRINT("Pushing to circular buffer\n");
-                jthrowable_circular_buf_push(threads_exc_buf, rpt->exception_object);
-            }
+            caught_report = rpt;
+            rpt = NULL;
 
 callback_on_exception_catch_cleanup:
             /* cleapup */
@@ -2597,10 +4162,280 @@ callback_on_exception_catch_cleanup:
         }
     }
 
-    exception_report_free(rpt);
+    if (NULL != rpt)
+    {
+        exception_report_free(jni_env, rpt);
+    }
 
 callback_on_exception_catch_exit:
-    exit_critical_section(jvmti_env, shared_lock);
+    if (NULL != caught_report)
+    {
+        submit_report(jvmti_env, jni_env, caught_report, exception_object, "Caught exception");
+    }
+}
+
+
+
+/*
+ * Gets the class and the method of the top frame of an exception object
+ *
+ * @param class_name Set to a mallocated FQDN of the class or NULL
+ * @param method_name Set to a mallocated name of the method or NULL
+ */
+static void get_throwing_method(
+            JNIEnv  *jni_env,
+            jobject  exception,
+            char   **class_name,
+            char   **method_name)
+{
+    *class_name = NULL;
+    *method_name = NULL;
+
+    const T_jniCache *cache = jni_cache_get(jni_env);
+    if (NULL == cache)
+    {
+        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get methodID of java/lang/StackTraceElement.getMethodName()Ljava/lang/String;\n");
+        return;
+    }
+
+    jobject stack_trace_array = (*jni_env)->CallObjectMethod(jni_env, exception, cache->throwable_get_stack_trace);
+    if (check_and_clear_exception(jni_env) || NULL == stack_trace_array)
+    {
+        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not get a stack trace from an exception object\n");
+        return;
+    }
+
+    if (0 == (*jni_env)->GetArrayLength(jni_env, stack_trace_array))
+    {
+        (*jni_env)->DeleteLocalRef(jni_env, stack_trace_array);
+        return;
+    }
+
+    jobject frame_element = (*jni_env)->GetObjectArrayElement(jni_env, stack_trace_array, 0);
+    (*jni_env)->DeleteLocalRef(jni_env, stack_trace_array);
+
+    const jmethodID getters[] = { cache->stack_trace_element_get_class_name, cache->stack_trace_element_get_method_name };
+    char **results[] = { class_name, method_name };
+    for (size_t i = 0; i < sizeof(getters)/sizeof(getters[0]); ++i)
+    {
+        jstring name = (*jni_env)->CallObjectMethod(jni_env, frame_element, getters[i]);
+        if (check_and_clear_exception(jni_env) || NULL == name)
+        {
+            continue;
+        }
+
+        const char *name_utf = (*jni_env)->GetStringUTFChars(jni_env, name, NULL);
+        if (NULL != name_utf)
+        {
+            *(results[i]) = strdup(name_utf);
+            (*jni_env)->ReleaseStringUTFChars(jni_env, name, name_utf);
+        }
+
+        (*jni_env)->DeleteLocalRef(jni_env, name);
+    }
+
+    (*jni_env)->DeleteLocalRef(jni_env, frame_element);
+}
+
+
+
+/*
+ * Called by the agent's default uncaught exception handler.
+ *
+ * The thread is not throwing anymore, hence the frames and the throwing
+ * method are taken from the exception object. Similar exceptions are not
+ * probed because the stack of the handler says nothing about the exception.
+ */
+static void report_uncaught_exception(
+            JNIEnv    *jni_env,
+            jobject    thread,
+            jthrowable exception)
+{
+    jvmtiEnv *jvmti_env = uncaughtHandlerJvmtiEnv;
+
+    T_threadState *state = get_thread_state(jvmti_env, thread);
+    if ((NULL != state && state->reporting_thread) || exception_was_reported(jvmti_env, exception))
+        return;
+
+    char *exception_type_name = get_exception_type_name(jvmti_env, jni_env, exception);
+    if (NULL == exception_type_name)
+    {
+        VERBOSE_PRINT("Cannot get the type of the uncaught exception\n");
+        return;
+    }
+
+    char *class_name = NULL;
+    char *method_name = NULL;
+    get_throwing_method(jni_env, exception, &class_name, &method_name);
+
+    char tname_buffer[MAX_THREAD_NAME_LENGTH];
+    const char *tname = NULL == state ? NULL : get_cached_thread_name(jvmti_env, jni_env, thread, state);
+    if (NULL == tname)
+    {
+        get_thread_name(jvmti_env, thread, tname_buffer, sizeof(tname_buffer));
+        tname = tname_buffer;
+    }
+
+    T_exceptionReport *rpt = exception_report_new(jvmti_env, jni_env, "Uncaught", exception_type_name,
+            NULL != class_name ? class_name : "", NULL != method_name ? method_name : "unknown",
+            /*frames of the exception*/NULL, tname, /*suppressed*/0, /*fingerprint*/0);
+
+    free(method_name);
+    free(class_name);
+    free(exception_type_name);
+
+    if (NULL != rpt)
+    {
+        exception_mark_reported(jvmti_env, exception);
+        submit_report(jvmti_env, jni_env, rpt, exception, "Uncaught exception");
+    }
+
+    /* The handler passes the exception on */
+    check_and_clear_exception(jni_env);
+}
+
+
+
+/**
+ * Called when a constructor of a listed exception type is entered.
+ *
+ * The exception is reported once its outermost constructor returns and its
+ * message and stack trace are filled, hence constructors called by
+ * constructors of the same object are not watched.
+ */
+static void JNICALL callback_on_breakpoint(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            jthread   thread,
+            jmethodID method __UNUSED_VAR,
+            jlocation location __UNUSED_VAR)
+{
+    T_threadState *state = get_thread_state(jvmti_env, thread);
+    if (NULL != state && state->reporting_thread)
+        return;
+
+    jobject exception_object = NULL;
+    jvmtiError error_code = (*jvmti_env)->GetLocalObject(jvmti_env, thread, 0, /*this*/0, &exception_object);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        return;
+
+    /* this(...) or super(...) */
+    jmethodID caller = NULL;
+    jlocation caller_location;
+    error_code = (*jvmti_env)->GetFrameLocation(jvmti_env, thread, 1, &caller, &caller_location);
+    if (JVMTI_ERROR_NONE == error_code && is_constructor(jvmti_env, caller))
+    {
+        jobject caller_object = NULL;
+        error_code = (*jvmti_env)->GetLocalObject(jvmti_env, thread, 1, /*this*/0, &caller_object);
+        const int chained = JVMTI_ERROR_NONE == error_code
+                && (*jni_env)->IsSameObject(jni_env, exception_object, caller_object);
+
+        if (NULL != caller_object)
+            (*jni_env)->DeleteLocalRef(jni_env, caller_object);
+
+        if (chained)
+            goto callback_on_breakpoint_cleanup;
+    }
+
+    error_code = (*jvmti_env)->NotifyFramePop(jvmti_env, thread, 0);
+    check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+
+callback_on_breakpoint_cleanup:
+    (*jni_env)->DeleteLocalRef(jni_env, exception_object);
+}
+
+
+
+/**
+ * Called when the outermost constructor of a listed exception type returns.
+ *
+ * The exception is reported as created by the method calling the
+ * constructor. The frames are taken from the exception object because the
+ * constructor is still on the stack.
+ */
+static void JNICALL callback_on_frame_pop(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            jthread   thread,
+            jmethodID method __UNUSED_VAR,
+            jboolean  was_popped_by_exception)
+{
+    /* The exception was not created */
+    if (was_popped_by_exception)
+        return;
+
+    jobject exception_object = NULL;
+    jvmtiError error_code = (*jvmti_env)->GetLocalObject(jvmti_env, thread, 0, /*this*/0, &exception_object);
+    if (check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        return;
+
+    char *exception_type_name = NULL;
+    char *method_name_ptr = NULL;
+    char *class_signature_ptr = NULL;
+    const char *class_name_ptr = "";
+    T_exceptionReport *rpt = NULL;
+
+    /* Subclasses of the listed types are not reported */
+    if (exception_was_reported(jvmti_env, exception_object)
+        || !exception_is_intended_to_be_reported(jvmti_env, jni_env, exception_object, &exception_type_name))
+        goto callback_on_frame_pop_cleanup;
+
+    uint64_t fingerprint = 0;
+    size_t suppressed = 0;
+    if (probe_exception(jvmti_env, exception_type_name, /*postponed?*/0, &fingerprint, &suppressed))
+        goto callback_on_frame_pop_cleanup;
+
+    jmethodID creator = NULL;
+    jlocation creator_location;
+    jclass creator_class = NULL;
+    error_code = (*jvmti_env)->GetFrameLocation(jvmti_env, thread, 1, &creator, &creator_location);
+    if (JVMTI_ERROR_NONE == error_code)
+    {
+        error_code = (*jvmti_env)->GetMethodName(jvmti_env, creator, &method_name_ptr, NULL, NULL);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+
+        error_code = (*jvmti_env)->GetMethodDeclaringClass(jvmti_env, creator, &creator_class);
+        if (!check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+        {
+            error_code = (*jvmti_env)->GetClassSignature(jvmti_env, creator_class, &class_signature_ptr, NULL);
+            if (!check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__)))
+                class_name_ptr = format_class_name(class_signature_ptr, '\0');
+        }
+    }
+
+    T_threadState *state = get_thread_state(jvmti_env, thread);
+    char tname_buffer[MAX_THREAD_NAME_LENGTH];
+    const char *tname = NULL == state ? NULL : get_cached_thread_name(jvmti_env, jni_env, thread, state);
+    if (NULL == tname)
+    {
+        get_thread_name(jvmti_env, thread, tname_buffer, sizeof(tname_buffer));
+        tname = tname_buffer;
+    }
+
+    rpt = exception_report_new(jvmti_env, jni_env, "Created", exception_type_name,
+            class_name_ptr, NULL != method_name_ptr ? method_name_ptr : "unknown",
+            /*frames of the exception*/NULL, tname, suppressed, fingerprint);
+
+    if (NULL != rpt)
+    {
+        exception_mark_reported(jvmti_env, exception_object);
+        submit_report(jvmti_env, jni_env, rpt, exception_object, "Created exception");
+    }
+
+callback_on_frame_pop_cleanup:
+    if (NULL != method_name_ptr)
+    {
+        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)method_name_ptr);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+    }
+    if (NULL != class_signature_ptr)
+    {
+        error_code = (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)class_signature_ptr);
+        check_jvmti_error(jvmti_env, error_code, __FILE__ ":" STRINGIZE(__LINE__));
+    }
+
+    free(exception_type_name);
+    (*jni_env)->DeleteLocalRef(jni_env, exception_object);
 }
 
 
@@ -2636,20 +4471,50 @@ static void JNICALL callback_on_object_alloc(
 
 
 
-#if ABRT_OBJECT_FREE_CHECK
 /**
- * Called when an object is freed.
+ * Called when a tagged object is freed.
  */
 static void JNICALL callback_on_object_free(
-            jvmtiEnv *jvmti_env,
-            jlong tag __UNUSED_VAR)
+            jvmtiEnv *jvmti_env __UNUSED_VAR,
+            jlong tag)
 {
+#if ABRT_OBJECT_FREE_CHECK
     enter_critical_section(jvmti_env, shared_lock);
     VERBOSE_PRINT("object free\n");
     exit_critical_section(jvmti_env, shared_lock);
-}
 #endif /* ABRT_OBJECT_FREE_CHECK */
 
+    /* An unloaded class, its methods might be reused */
+    if (0 == class_metadata_object_free(tag) && NULL != frameCache)
+        frame_cache_invalidate(frameCache);
+}
+
+
+
+/**
+ * Called when a class is loaded and its methods can be called.
+ */
+static void JNICALL callback_on_class_prepare(
+            jvmtiEnv *jvmti_env,
+            JNIEnv   *jni_env,
+            jthread   thread __UNUSED_VAR,
+            jclass    class)
+{
+    if (NULL != classIndex)
+    {
+        index_loaded_class(jvmti_env, jni_env, class);
+    }
+
+    /* Classes prepared before the live phase are watched on VM init */
+    jvmtiPhase phase;
+    if (exception_constructors_watched()
+        && JVMTI_ERROR_NONE == (*jvmti_env)->GetPhase(jvmti_env, &phase)
+        && JVMTI_PHASE_LIVE == phase)
+    {
+        watch_exception_constructors(jvmti_env, class);
+    }
+}
+
 
 
 #if ABRT_GARBAGE_COLLECTION_TIMEOUT_CHECK
@@ -2683,7 +4548,7 @@ static void JNICALL callback_on_gc_finish(
         char str[100];
         sprintf(str, "GC took more time than expected: %d\n", diff);
         INFO_PRINT("%s\n", str);
-        register_abrt_event(processProperties.main_class, str, (unsigned char *)"GC thread", "no stack trace");
+        register_abrt_event(processProperties.main_class, str, (unsigned char *)"GC thread", "no stack trace", NULL);
     }
     exit_critical_section(jvmti_env, gc_lock);
 }
@@ -2758,8 +4623,26 @@ callback_on_compiled_method_load_cleanup:
 
 
 
+/*
+ * Returns non zero if JVMTI exception events are needed
+ *
+ * Not needed if the agent's uncaught exception handler detects uncaught
+ * exceptions and the listed types are either not configured or detected by
+ * breakpoints in their constructors.
+ */
+static int exception_events_required(void)
+{
+    return UE_DETECTION_EVENTS == globalConfig.uncaughtDetection
+        || (NULL != globalConfig.reportedCaughExceptionTypes && !exception_constructors_watched());
+}
+
+
+
 /*
  * Sel all required JVMTi capabilities.
+ *
+ * Only the capabilities used by the configured features are requested
+ * because some of them keep JVM from running at full speed.
  */
 jvmtiError set_capabilities(jvmtiEnv *jvmti_env)
 {
@@ -2768,19 +4651,32 @@ jvmtiError set_capabilities(jvmtiEnv *jvmti_env)
 
     /* Add JVMTI capabilities */
     (void)memset(&capabilities, 0, sizeof(jvmtiCapabilities));
-    capabilities.can_signal_thread = 1;
-    capabilities.can_get_owned_monitor_info = 1;
-    capabilities.can_generate_method_entry_events = 1;
-    capabilities.can_generate_method_exit_events = 1;
-    capabilities.can_generate_frame_pop_events = 1;
-    capabilities.can_generate_exception_events = 1;
+    /* Exception events slow down every thrown exception; the agent's uncaught
+     * exception handler falls back to them if it cannot be installed, otherwise
+     * the capability is relinquished in callback_on_vm_init() */
+    capabilities.can_generate_exception_events = exception_events_required()
+        || UE_DETECTION_HANDLER == globalConfig.uncaughtDetection;
+    /* 'this' of constructors of the listed exception types */
+    capabilities.can_generate_breakpoint_events = exception_constructors_watched();
+    capabilities.can_generate_frame_pop_events = exception_constructors_watched();
+    capabilities.can_access_local_variables = exception_constructors_watched();
+#if ABRT_OBJECT_ALLOCATION_SIZE_CHECK
     capabilities.can_generate_vm_object_alloc_events = 1;
+#endif /* ABRT_OBJECT_ALLOCATION_SIZE_CHECK */
+    /* Reported exceptions and classes with metadata are tagged, the metadata
+     * are released when the classes are unloaded */
+    capabilities.can_tag_objects = 1;
     capabilities.can_generate_object_free_events = 1;
+#if ABRT_GARBAGE_COLLECTION_TIMEOUT_CHECK
     capabilities.can_generate_garbage_collection_events = 1;
+#endif /* ABRT_GARBAGE_COLLECTION_TIMEOUT_CHECK */
+#if ABRT_COMPILED_METHOD_LOAD_CHECK
     capabilities.can_generate_compiled_method_load_events = 1;
+#endif /* ABRT_COMPILED_METHOD_LOAD_CHECK */
+    /* Frames of the throwing thread are formatted by the agent if the engine
+     * is 'jvmti' or if the exception object is not available */
     capabilities.can_get_line_numbers = 1;
     capabilities.can_get_source_file_name = 1;
-    capabilities.can_tag_objects = 1;
 
     error_code = (*jvmti_env)->AddCapabilities(jvmti_env, &capabilities);
     check_jvmti_error(jvmti_env, error_code, "Unable to get necessary JVMTI capabilities.");
@@ -2803,10 +4699,8 @@ jvmtiError register_all_callback_functions(jvmtiEnv *jvmti_env)
     /* JVMTI_EVENT_VM_INIT */
     callbacks.VMInit = &callback_on_vm_init;
 
-#if ABRT_VM_DEATH_CHECK
     /* JVMTI_EVENT_VM_DEATH */
     callbacks.VMDeath = &callback_on_vm_death;
-#endif /* ABRT_VM_DEATH_CHECK */
 
     /* JVMTI_EVENT_THREAD_END */
     callbacks.ThreadEnd = &callback_on_thread_end;
@@ -2817,15 +4711,22 @@ jvmtiError register_all_callback_functions(jvmtiEnv *jvmti_env)
     /* JVMTI_EVENT_EXCEPTION_CATCH */
     callbacks.ExceptionCatch = &callback_on_exception_catch;
 
+    /* JVMTI_EVENT_BREAKPOINT */
+    callbacks.Breakpoint = &callback_on_breakpoint;
+
+    /* JVMTI_EVENT_FRAME_POP */
+    callbacks.FramePop = &callback_on_frame_pop;
+
 #if ABRT_OBJECT_ALLOCATION_SIZE_CHECK
     /* JVMTI_EVENT_VM_OBJECT_ALLOC */
     callbacks.VMObjectAlloc = &callback_on_object_alloc;
 #endif
 
-#if ABRT_OBJECT_FREE_CHECK
     /* JVMTI_EVENT_OBJECT_FREE */
     callbacks.ObjectFree = &callback_on_object_free;
-#endif
+
+    /* JVMTI_EVENT_CLASS_PREPARE */
+    callbacks.ClassPrepare = &callback_on_class_prepare;
 
 #if ABRT_GARBAGE_COLLECTION_TIMEOUT_CHECK
     /* JVMTI_EVENT_GARBAGE_COLLECTION_START */
@@ -2873,24 +4774,30 @@ jvmtiError set_event_notification_modes(jvmtiEnv* jvmti_env)
         return error_code;
     }
 
-#if ABRT_VM_DEATH_CHECK
     if ((error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_VM_DEATH)) != JNI_OK)
     {
         return error_code;
     }
-#endif /* ABRT_VM_DEATH_CHECK */
 
     if ((error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_THREAD_END)) != JNI_OK)
     {
         return error_code;
     }
 
-    if ((error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_EXCEPTION)) != JNI_OK)
+    if (exception_events_required()
+        && (error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_EXCEPTION)) != JNI_OK)
     {
         return error_code;
     }
 
-    if ((error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_EXCEPTION_CATCH)) != JNI_OK)
+    /* JVMTI_EVENT_EXCEPTION_CATCH is enabled only for threads with a
+     * postponed uncaught exception */
+
+    /* Frame pops are generated only for constructors of the listed exception
+     * types */
+    if (exception_constructors_watched()
+        && ((error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_BREAKPOINT)) != JNI_OK
+            || (error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_FRAME_POP)) != JNI_OK))
     {
         return error_code;
     }
@@ -2902,12 +4809,17 @@ jvmtiError set_event_notification_modes(jvmtiEnv* jvmti_env)
     }
 #endif /* ABRT_OBJECT_ALLOCATION_SIZE_CHECK */
 
-#if ABRT_OBJECT_FREE_CHECK
+    /* Releases metadata of unloaded classes */
     if ((error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_OBJECT_FREE)) != JNI_OK)
     {
         return error_code;
     }
-#endif /* ABRT_OBJECT_FREE_CHECK */
+
+    /* Keeps the index of loaded classes up to date */
+    if ((error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_CLASS_PREPARE)) != JNI_OK)
+    {
+        return error_code;
+    }
 
 #if ABRT_GARBAGE_COLLECTION_TIMEOUT_CHECK
     if ((error_code = set_event_notification_mode(jvmti_env, JVMTI_EVENT_GARBAGE_COLLECTION_START)) != JNI_OK)
@@ -3020,6 +4932,11 @@ JNIEXPORT jint JNICALL Agent_OnLoad(
 
     print_jvmti_version(jvmti_env);
 
+    if (UE_DETECTION_HANDLER == globalConfig.uncaughtDetection)
+    {
+        uncaughtHandlerJvmtiEnv = jvmti_env;
+    }
+
     /* set required JVM TI agent capabilities */
     if ((error_code = set_capabilities(jvmti_env)) != JNI_OK)
     {
@@ -3032,6 +4949,29 @@ JNIEXPORT jint JNICALL Agent_OnLoad(
         return error_code;
     }
 
+    frameCache = frame_cache_new(FRAME_CACHE_CAPACITY);
+    if (NULL == frameCache && ST_ENGINE_JVMTI == globalConfig.stackTraceEngine)
+    {
+        fprintf(stderr, "Cannot create the frame cache, stack traces will be taken from exception objects\n");
+        globalConfig.stackTraceEngine = ST_ENGINE_THROWABLE;
+    }
+
+    if (0 != globalConfig.rateLimit)
+    {
+        reportLimiter = report_limiter_new(globalConfig.rateLimit, globalConfig.rateLimitBurst);
+        if (NULL == reportLimiter)
+        {
+            fprintf(stderr, "Cannot create the report limiter, all exceptions will be reported\n");
+        }
+    }
+
+    /* must exist before ClassPrepare events are enabled */
+    classIndex = class_index_new();
+    if (NULL == classIndex)
+    {
+        fprintf(stderr, "Cannot create the index of loaded classes, classes not visible to the system class loader will have unknown location\n");
+    }
+
     /* set notification modes for all callback functions */
     if ((error_code = set_event_notification_modes(jvmti_env)) != JNI_OK)
     {
@@ -3052,19 +4992,6 @@ JNIEXPORT jint JNICALL Agent_OnLoad(
     }
 #endif
 
-    threadMap = jthread_map_new();
-    if (NULL == threadMap)
-    {
-        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": can not create a set of reported exceptions\n");
-        return -1;
-    }
-
-    uncaughtExceptionMap = jthread_map_new();
-    if (NULL == uncaughtExceptionMap)
-    {
-        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": can not create a set of uncaught exceptions\n");
-        return -1;
-    }
     return JNI_OK;
 }
 
@@ -3084,6 +5011,70 @@ JNIEXPORT void JNICALL Agent_OnUnload(JavaVM *vm __UNUSED_VAR)
 
     already_called = 1;
 
+    /* VM death event might not have been delivered */
+    stop_report_dedup();
+    if (NULL != reportDedup)
+    {
+        T_exceptionReport *report = NULL;
+        while (NULL != (report = (T_exceptionReport *)report_dedup_try_pop(reportDedup)))
+        {
+            exception_report_free(NULL, report);
+        }
+
+        /* Cannot be freed while the deduplicating thread is in the table */
+        if (!report_dedup_close(reportDedup, 0))
+        {
+            report_dedup_free(reportDedup);
+        }
+
+        reportDedup = NULL;
+    }
+
+    stop_report_worker();
+
+    if (NULL != reportQueue)
+    {
+        T_exceptionReport *report = NULL;
+        while (NULL != (report = (T_exceptionReport *)report_queue_try_pop(reportQueue)))
+        {
+            exception_report_free(NULL, report);
+        }
+
+        /* Cannot be freed while the reporting thread is in the queue */
+        if (!report_queue_close(reportQueue, 0))
+        {
+            report_queue_free(reportQueue);
+        }
+
+        reportQueue = NULL;
+    }
+
+    stop_abrt_socket();
+    if (NULL != abrtSocket)
+    {
+        /* Cannot be freed while the thread is sending problems */
+        if (!abrt_socket_close(abrtSocket, 0))
+        {
+            abrt_socket_free(abrtSocket);
+        }
+
+        abrtSocket = NULL;
+    }
+
+    /* The VM is gone, so the weak references are not deleted */
+    class_index_free(classIndex, NULL);
+    classIndex = NULL;
+
+    frame_cache_free(frameCache);
+    frameCache = NULL;
+
+    report_limiter_free(reportLimiter);
+    reportLimiter = NULL;
+
+    report_arena_cleanup();
+
+    problem_data_template_free();
+
     pthread_mutex_destroy(&abrt_print_mutex);
 
     INFO_PRINT("Agent_OnUnLoad\n");
@@ -3094,9 +5085,6 @@ JNIEXPORT void JNICALL Agent_OnUnload(JavaVM *vm __UNUSED_VAR)
     {
         fclose(fout);
     }
-
-    jthread_map_free(uncaughtExceptionMap);
-    jthread_map_free(threadMap);
 }
 
 
@@ -28,6 +28,7 @@
 
 
 #include <pthread.h>
+#include <stdint.h>
 
 /*
  * Shared mutex for synchronization of writing.
@@ -86,6 +87,73 @@ enum {
 
 
 
+/*
+ * JVMTI object tags used by the agent are pointers to agent's structures
+ * with the kind of the structure stored in the lowest bits. Malloced memory
+ * is aligned enough to keep these bits zero. Use with jni.h included.
+ */
+#define OBJECT_TAG_KIND_MASK ((jlong)0x7)
+
+enum {
+    OBJECT_TAG_CLASS_METADATA = 1, ///< T_classMetadata attached to a jclass
+    OBJECT_TAG_REPORTED_EXCEPTION = 2, ///< an already reported jthrowable, no pointer
+};
+
+#define OBJECT_TAG_MAKE(pointer, kind) ((jlong)(intptr_t)(pointer) | (jlong)(kind))
+#define OBJECT_TAG_KIND(tag) ((int)((tag) & OBJECT_TAG_KIND_MASK))
+#define OBJECT_TAG_POINTER(tag) ((void *)(intptr_t)((tag) & ~OBJECT_TAG_KIND_MASK))
+
+
+
+/*
+ * Max. number of top frames of a thrown exception's stack looked at before
+ * a report is created
+ */
+#define MAX_PROBE_DEPTH 64
+
+
+
+/*
+ * Determines what happens to a report when the report queue is full
+ */
+typedef enum {
+    RQ_OVERFLOW_BLOCK = 0,    ///< Wait until there is a free slot
+    RQ_OVERFLOW_DROP_NEWEST,  ///< Throw away the new report
+    RQ_OVERFLOW_DROP_OLDEST,  ///< Throw away the oldest queued report
+} T_reportQueueOverflow;
+
+
+
+/*
+ * Determines where frames of a reported exception come from
+ */
+typedef enum {
+    ST_ENGINE_THROWABLE = 0,  ///< Throwable.getStackTrace() of the exception object
+    ST_ENGINE_JVMTI,          ///< JVMTI GetStackTrace() of the throwing thread
+} T_stackTraceEngine;
+
+
+
+/*
+ * Determines how uncaught exceptions are detected
+ */
+typedef enum {
+    UE_DETECTION_EVENTS = 0,  ///< JVMTI Exception and ExceptionCatch events of every thrown exception
+    UE_DETECTION_HANDLER,     ///< Default uncaught exception handler implemented by the agent
+} T_uncaughtDetection;
+
+
+
+/*
+ * Determines how exceptions of the types listed in 'caught' are detected
+ */
+typedef enum {
+    CE_DETECTION_EVENTS = 0,  ///< JVMTI Exception events of every thrown exception
+    CE_DETECTION_CONSTRUCTOR, ///< Breakpoints in constructors of the listed types
+} T_caughtDetection;
+
+
+
 typedef struct {
     /* Global configuration of report destination */
     T_errorDestination reportErrosTo;
@@ -106,6 +174,62 @@ typedef struct {
      * reported */
     char **fqdnDebugMethods;
 
+    /* Maximal number of reports waiting for the reporting thread; 0 means
+     * reports are submitted directly from the throwing thread */
+    unsigned reportQueueDepth;
+
+    /* What to do with a report when the queue is full */
+    T_reportQueueOverflow reportQueueOverflow;
+
+    /* Number of reporting threads turning queued reports into text */
+    unsigned reportWorkers;
+
+    /* Maximal number of milliseconds spent by delivering of queued reports
+     * at exit */
+    unsigned flushTimeout;
+
+    /* Source of stack trace frames */
+    T_stackTraceEngine stackTraceEngine;
+
+    /* Maximal number of frames got from JVMTI */
+    unsigned stackTraceDepth;
+
+    /* Maximal number of characters of a reported stack trace */
+    unsigned stackTraceSize;
+
+    /* Read environment of the process for every ABRT report instead of once
+     * at start up */
+    int resampleEnviron;
+
+    /* Path to abrtd's Unix socket */
+    char *abrtSocketPath;
+
+    /* Number of milliseconds spent by gathering problems delivered to abrtd
+     * at once; 0 means problems are delivered immediately */
+    unsigned abrtBatchWindow;
+
+    /* Maximal number of reports of similar exceptions per minute; 0 means
+     * the rate is not limited */
+    unsigned rateLimit;
+
+    /* Number of reports of similar exceptions allowed at once */
+    unsigned rateLimitBurst;
+
+    /* Number of milliseconds during which repeated caught exceptions with
+     * the same stack are coalesced into one report; 0 means every exception
+     * is reported on its own */
+    unsigned dedupWindow;
+
+    /* Number of top frames identifying similar exceptions for coalescing and
+     * rate limiting */
+    unsigned probeDepth;
+
+    /* Source of uncaught exceptions */
+    T_uncaughtDetection uncaughtDetection;
+
+    /* Source of exceptions of the types listed in reportedCaughExceptionTypes */
+    T_caughtDetection caughtDetection;
+
     int configured;
 } T_configuration;
 
@@ -0,0 +1,610 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "abrt_socket.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <assert.h>
+
+
+/*
+ * The only request accepted by abrtd, followed by problem data items
+ */
+#define ABRT_SOCKET_REQUEST_HEADER "POST / HTTP/1.1\r\n\r\n"
+
+/*
+ * The beginning of abrtd's response to a created problem
+ */
+#define ABRT_SOCKET_CREATED_RESPONSE "HTTP/1.1 201 "
+
+/*
+ * Maximal number of problems sent at once, abrtd serves only several
+ * clients at the same time
+ */
+#define ABRT_SOCKET_BATCH_CAPACITY 8
+
+/*
+ * Bounds of the delay between attempts to connect to abrtd
+ */
+#define ABRT_SOCKET_MIN_BACKOFF_MS 100
+#define ABRT_SOCKET_MAX_BACKOFF_MS 30000
+
+/*
+ * Maximal number of seconds spent by a single read or write
+ */
+#define ABRT_SOCKET_IO_TIMEOUT_S 5
+
+
+
+typedef struct abrt_socket_problem {
+    struct abrt_socket_problem *next; ///< next queued problem
+    size_t length;                    ///< length of data
+    char data[];                      ///< request header and items
+} T_abrtSocketProblem;
+
+
+
+struct abrt_socket {
+    pthread_mutex_t mutex;
+    pthread_cond_t submitted;         ///< signaled when a problem is queued or socket is closed
+    pthread_cond_t idle;              ///< signaled when a batch is done or sender finished
+    pthread_t sender;                 ///< thread sending queued problems
+    char *path;                       ///< path to abrtd's socket
+    size_t capacity;                  ///< maximal number of queued problems
+    unsigned batch_window_ms;         ///< time for gathering a batch
+    T_abrtSocketProblem *first;       ///< the oldest queued problem
+    T_abrtSocketProblem *last;        ///< the newest queued problem
+    size_t queued;                    ///< number of queued problems
+    size_t busy;                      ///< number of problems being sent
+    int closed;                       ///< no more problems are accepted
+    int finished;                     ///< the sender left
+    int joined;                       ///< the sender was joined
+    int detached;                     ///< the sender was detached
+    T_abrtSocketStats stats;          ///< statistics
+};
+
+
+
+/*
+ * Converts a relative timeout to an absolute time suitable for
+ * pthread_cond_timedwait()
+ */
+static void abrt_socket_deadline(unsigned timeout_ms, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec += 1;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+
+
+/*
+ * Connects to abrtd
+ *
+ * @returns A socket descriptor or -1 if abrtd is not available
+ */
+static int abrt_socket_connect(const char *path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (0 > fd)
+    {
+        VERBOSE_PRINT("Cannot create a socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* A hung abrtd must not block the sender forever */
+    struct timeval timeout = { .tv_sec = ABRT_SOCKET_IO_TIMEOUT_S, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    if (0 != connect(fd, (struct sockaddr *)&address, sizeof(address)))
+    {
+        VERBOSE_PRINT("Cannot connect to '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+
+/*
+ * Writes whole problem and tells abrtd that no more data follow
+ *
+ * @returns 0 on success; otherwise non zero
+ */
+static int abrt_socket_write_problem(int fd, const T_abrtSocketProblem *problem)
+{
+    size_t written = 0;
+    while (written < problem->length)
+    {
+        /* Do not get SIGPIPE if abrtd closed the connection */
+        const ssize_t r = send(fd, problem->data + written, problem->length - written, MSG_NOSIGNAL);
+        if (0 > r)
+        {
+            if (EINTR == errno)
+                continue;
+
+            VERBOSE_PRINT("Cannot write problem data to abrtd: %s\n", strerror(errno));
+            return 1;
+        }
+
+        written += (size_t)r;
+    }
+
+    if (0 != shutdown(fd, SHUT_WR))
+    {
+        VERBOSE_PRINT("Cannot finish problem data: %s\n", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Reads abrtd's response
+ *
+ * @returns 0 if the problem was created; otherwise non zero
+ */
+static int abrt_socket_read_response(int fd)
+{
+    char response[64];
+    size_t length = 0;
+    while (length < sizeof(response) - 1)
+    {
+        const ssize_t r = recv(fd, response + length, sizeof(response) - 1 - length, 0);
+        if (0 > r && EINTR == errno)
+            continue;
+
+        if (0 > r)
+        {
+            VERBOSE_PRINT("Cannot read response of abrtd: %s\n", strerror(errno));
+            return 1;
+        }
+
+        if (0 == r)
+            break;
+
+        length += (size_t)r;
+    }
+
+    response[length] = '\0';
+    return strncmp(response, ABRT_SOCKET_CREATED_RESPONSE, strlen(ABRT_SOCKET_CREATED_RESPONSE));
+}
+
+
+
+/*
+ * Sends a batch of problems
+ *
+ * @returns A number of problems which were sent; the remaining problems were
+ *          not sent because abrtd is not available
+ */
+static size_t abrt_socket_send_batch(
+        const char *path,
+        T_abrtSocketProblem **batch,
+        size_t count,
+        T_abrtSocketStats *stats)
+{
+    int fds[ABRT_SOCKET_BATCH_CAPACITY];
+    size_t connected = 0;
+    while (connected < count && 0 <= (fds[connected] = abrt_socket_connect(path)))
+    {
+        ++connected;
+    }
+
+    /* All problems are written before the first response is read */
+    for (size_t i = 0; i < connected; ++i)
+    {
+        if (abrt_socket_write_problem(fds[i], batch[i]))
+        {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+
+    for (size_t i = 0; i < connected; ++i)
+    {
+        const int created = 0 <= fds[i] && 0 == abrt_socket_read_response(fds[i]);
+        fprintf(stderr, "ABRT problem creation: '%s'\n", created ? "success" : "failure");
+
+        if (created)
+            ++stats->delivered;
+        else
+            ++stats->rejected;
+
+        if (0 <= fds[i])
+            close(fds[i]);
+    }
+
+    return connected;
+}
+
+
+
+/*
+ * Body of the thread sending queued problems
+ */
+static void *abrt_socket_sender_run(void *arg)
+{
+    T_abrtSocket *sock = (T_abrtSocket *)arg;
+    T_abrtSocketProblem *batch[ABRT_SOCKET_BATCH_CAPACITY];
+    unsigned backoff_ms = 0;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&sock->mutex);
+
+    while (1)
+    {
+        while (!sock->closed && 0 == sock->queued)
+        {
+            pthread_cond_wait(&sock->submitted, &sock->mutex);
+        }
+
+        if (0 != backoff_ms)
+        {   /* abrtd was not available, do not try it again immediately */
+            abrt_socket_deadline(backoff_ms, &deadline);
+            while (!sock->closed && ETIMEDOUT != pthread_cond_timedwait(&sock->submitted, &sock->mutex, &deadline))
+                ;
+        }
+        else if (0 != sock->batch_window_ms && sock->queued < ABRT_SOCKET_BATCH_CAPACITY)
+        {   /* gather more problems for the batch */
+            abrt_socket_deadline(sock->batch_window_ms, &deadline);
+            while (!sock->closed && sock->queued < ABRT_SOCKET_BATCH_CAPACITY
+                    && ETIMEDOUT != pthread_cond_timedwait(&sock->submitted, &sock->mutex, &deadline))
+                ;
+        }
+
+        if (sock->closed)
+        {
+            break;
+        }
+
+        size_t count = 0;
+        while (count < ABRT_SOCKET_BATCH_CAPACITY && NULL != sock->first)
+        {
+            batch[count++] = sock->first;
+            sock->first = sock->first->next;
+        }
+
+        if (NULL == sock->first)
+        {
+            sock->last = NULL;
+        }
+
+        sock->queued -= count;
+        sock->busy = count;
+
+        T_abrtSocketStats stats;
+        memset(&stats, 0, sizeof(stats));
+
+        pthread_mutex_unlock(&sock->mutex);
+        const size_t sent = abrt_socket_send_batch(sock->path, batch, count, &stats);
+        pthread_mutex_lock(&sock->mutex);
+
+        for (size_t i = 0; i < sent; ++i)
+        {
+            free(batch[i]);
+        }
+
+        if (sent < count)
+        {
+            backoff_ms = 0 == backoff_ms ? ABRT_SOCKET_MIN_BACKOFF_MS : 2 * backoff_ms;
+            if (backoff_ms > ABRT_SOCKET_MAX_BACKOFF_MS)
+            {
+                backoff_ms = ABRT_SOCKET_MAX_BACKOFF_MS;
+            }
+
+            VERBOSE_PRINT("abrtd is not available, next attempt in %ums\n", backoff_ms);
+            ++sock->stats.connect_failures;
+
+            /* Return the problems to the front of the queue in their order */
+            for (size_t i = count; i > sent; --i)
+            {
+                T_abrtSocketProblem *problem = batch[i - 1];
+                if (sock->closed)
+                {
+                    ++sock->stats.dropped;
+                    free(problem);
+                    continue;
+                }
+
+                problem->next = sock->first;
+                sock->first = problem;
+                if (NULL == sock->last)
+                {
+                    sock->last = problem;
+                }
+                ++sock->queued;
+            }
+        }
+        else
+        {
+            backoff_ms = 0;
+        }
+
+        sock->stats.delivered += stats.delivered;
+        sock->stats.rejected += stats.rejected;
+        sock->busy = 0;
+        pthread_cond_broadcast(&sock->idle);
+    }
+
+    sock->finished = 1;
+    pthread_cond_broadcast(&sock->idle);
+    pthread_mutex_unlock(&sock->mutex);
+
+    return NULL;
+}
+
+
+
+T_abrtSocket *abrt_socket_new(const char *path, size_t capacity, unsigned batch_window_ms)
+{
+    assert(0 != capacity || !"Cannot use 0 capacity in ABRT socket");
+
+    if (strlen(path) >= sizeof(((struct sockaddr_un *)NULL)->sun_path))
+    {
+        fprintf(stderr, "Too long path to ABRT socket '%s'\n", path);
+        return NULL;
+    }
+
+    T_abrtSocket *sock = (T_abrtSocket *)calloc(1, sizeof(*sock));
+    if (NULL == sock)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        return NULL;
+    }
+
+    sock->path = strdup(path);
+    if (NULL == sock->path)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": strdup() error\n");
+        free(sock);
+        return NULL;
+    }
+
+    sock->capacity = capacity;
+    sock->batch_window_ms = batch_window_ms;
+
+    pthread_mutex_init(&sock->mutex, /*use default attributes*/NULL);
+    pthread_cond_init(&sock->submitted, /*use default attributes*/NULL);
+    pthread_cond_init(&sock->idle, /*use default attributes*/NULL);
+
+    if (0 != pthread_create(&sock->sender, /*use default attributes*/NULL, abrt_socket_sender_run, sock))
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": pthread_create() error\n");
+        sock->finished = 1;
+        abrt_socket_free(sock);
+        return NULL;
+    }
+
+    return sock;
+}
+
+
+
+void abrt_socket_free(T_abrtSocket *sock)
+{
+    if (NULL == sock)
+    {
+        return;
+    }
+
+    assert(sock->finished || !"Cannot free ABRT socket with running sender");
+
+    pthread_cond_destroy(&sock->idle);
+    pthread_cond_destroy(&sock->submitted);
+    pthread_mutex_destroy(&sock->mutex);
+
+    free(sock->path);
+    free(sock);
+}
+
+
+
+int abrt_socket_append_item(T_stringBuilder *problem, const char *name, const char *value)
+{
+    const size_t begin = string_builder_length(problem);
+    if (string_builder_append(problem, name)
+        || string_builder_append_n(problem, "=", 1)
+        || string_builder_append(problem, value)
+        /* items are separated by '\0' */
+        || string_builder_append_n(problem, "", 1))
+    {
+        string_builder_truncate(problem, begin);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+int abrt_socket_submit(T_abrtSocket *sock, const char *problem, size_t length)
+{
+    assert(NULL != sock || !"Cannot submit a problem to NULL socket");
+
+    const size_t header_length = sizeof(ABRT_SOCKET_REQUEST_HEADER) - 1;
+    T_abrtSocketProblem *item = (T_abrtSocketProblem *)malloc(sizeof(*item) + header_length + length);
+    if (NULL == item)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory\n");
+        return 1;
+    }
+
+    item->next = NULL;
+    item->length = header_length + length;
+    memcpy(item->data, ABRT_SOCKET_REQUEST_HEADER, header_length);
+    memcpy(item->data + header_length, problem, length);
+
+    pthread_mutex_lock(&sock->mutex);
+
+    int retval = 1;
+    if (sock->closed || sock->queued >= sock->capacity)
+    {
+        VERBOSE_PRINT("Cannot queue a problem for abrtd: %zu queued\n", sock->queued);
+        ++sock->stats.dropped;
+        goto abrt_socket_submit_unlock;
+    }
+
+    if (NULL == sock->last)
+    {
+        sock->first = item;
+    }
+    else
+    {
+        sock->last->next = item;
+    }
+
+    sock->last = item;
+    item = NULL;
+
+    ++sock->queued;
+    ++sock->stats.submitted;
+    retval = 0;
+
+    pthread_cond_signal(&sock->submitted);
+
+abrt_socket_submit_unlock:
+    pthread_mutex_unlock(&sock->mutex);
+    free(item);
+    return retval;
+}
+
+
+
+int abrt_socket_flush(T_abrtSocket *sock, unsigned timeout_ms)
+{
+    assert(NULL != sock || !"Cannot flush NULL socket");
+
+    struct timespec deadline;
+    abrt_socket_deadline(timeout_ms, &deadline);
+
+    pthread_mutex_lock(&sock->mutex);
+
+    int retval = 0;
+    while (0 != sock->queued || 0 != sock->busy)
+    {
+        if (sock->finished || ETIMEDOUT == pthread_cond_timedwait(&sock->idle, &sock->mutex, &deadline))
+        {
+            VERBOSE_PRINT("Timed out while flushing ABRT socket: %zu queued, %zu busy\n", sock->queued, sock->busy);
+            retval = 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&sock->mutex);
+    return retval;
+}
+
+
+
+int abrt_socket_close(T_abrtSocket *sock, unsigned timeout_ms)
+{
+    assert(NULL != sock || !"Cannot close NULL socket");
+
+    struct timespec deadline;
+    abrt_socket_deadline(timeout_ms, &deadline);
+
+    pthread_mutex_lock(&sock->mutex);
+
+    sock->closed = 1;
+    pthread_cond_broadcast(&sock->submitted);
+
+    /* Problems which were not sent yet are dropped */
+    while (NULL != sock->first)
+    {
+        T_abrtSocketProblem *problem = sock->first;
+        sock->first = problem->next;
+        free(problem);
+        ++sock->stats.dropped;
+    }
+    sock->last = NULL;
+    sock->queued = 0;
+
+    while (!sock->finished)
+    {
+        if (ETIMEDOUT == pthread_cond_timedwait(&sock->idle, &sock->mutex, &deadline))
+        {
+            VERBOSE_PRINT("Timed out while closing ABRT socket: %zu busy\n", sock->busy);
+            break;
+        }
+    }
+
+    int retval = 0;
+    if (sock->detached)
+    {   /* the sender might not have left the mutex yet */
+        retval = 1;
+    }
+    else if (sock->finished)
+    {
+        if (!sock->joined)
+        {
+            pthread_join(sock->sender, NULL);
+            sock->joined = 1;
+        }
+    }
+    else
+    {   /* the sender will never be joined */
+        pthread_detach(sock->sender);
+        sock->detached = 1;
+        retval = 1;
+    }
+
+    pthread_mutex_unlock(&sock->mutex);
+    return retval;
+}
+
+
+
+void abrt_socket_get_stats(T_abrtSocket *sock, T_abrtSocketStats *stats)
+{
+    assert(NULL != sock || !"Cannot get statistics of NULL socket");
+
+    pthread_mutex_lock(&sock->mutex);
+    *stats = sock->stats;
+    pthread_mutex_unlock(&sock->mutex);
+}
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,143 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __ABRT_SOCKET_H__
+#define __ABRT_SOCKET_H__
+
+
+#include "string_builder.h"
+
+#include <stddef.h>
+
+
+/*
+ * Delivers problem data to abrtd from a background thread
+ *
+ * abrtd accepts exactly one problem per connection; the client writes the
+ * request header and 'name=value\0' items, shuts down writing and reads the
+ * response. Submitted problems are gathered for a short window and sent in
+ * batches: connections for all problems of a batch are opened and written
+ * before any response is read, so abrtd processes them in parallel and the
+ * sender waits only once per batch. Problems are kept and the connection is
+ * retried with an exponential back off if abrtd is not running.
+ */
+typedef struct abrt_socket T_abrtSocket;
+
+
+
+/*
+ * Statistics of problem submissions
+ */
+typedef struct {
+    size_t submitted;         ///< accepted by @abrt_socket_submit
+    size_t delivered;         ///< created by abrtd
+    size_t rejected;          ///< refused by abrtd or lost by an I/O error
+    size_t dropped;           ///< not sent because of a full queue or closing
+    size_t connect_failures;  ///< failed attempts to connect to abrtd
+} T_abrtSocketStats;
+
+
+
+/*
+ * Starts a thread delivering problems to the socket
+ *
+ * @param path Path to abrtd's Unix socket
+ * @param capacity Maximal number of problems waiting for delivery
+ * @param batch_window_ms Number of milliseconds spent by gathering problems
+ *                        sent in one batch, 0 sends problems immediately
+ * @returns Mallocated memory which must be released by @abrt_socket_free
+ */
+T_abrtSocket *abrt_socket_new(const char *path, size_t capacity, unsigned batch_window_ms);
+
+
+
+/*
+ * Frees socket's memory
+ *
+ * The socket must be successfully closed by @abrt_socket_close.
+ *
+ * @param sock Pointer to @abrt_socket. Accepts NULL
+ */
+void abrt_socket_free(T_abrtSocket *sock);
+
+
+
+/*
+ * Appends a text item of problem data in the form expected by abrtd
+ *
+ * @param problem Problem data being built
+ * @param name Name of the item
+ * @param value Contents of the item
+ * @returns 0 on success; otherwise non zero and the problem is not changed
+ */
+int abrt_socket_append_item(T_stringBuilder *problem, const char *name, const char *value);
+
+
+
+/*
+ * Queues a copy of problem data for delivery
+ *
+ * @param sock Socket
+ * @param problem Items appended by @abrt_socket_append_item
+ * @param length Number of bytes of the items
+ * @returns 0 if the problem was queued; otherwise non zero
+ */
+int abrt_socket_submit(T_abrtSocket *sock, const char *problem, size_t length);
+
+
+
+/*
+ * Waits until all queued problems are delivered
+ *
+ * @param sock Socket
+ * @param timeout_ms A maximal number of milliseconds to wait
+ * @returns 0 if no problem is waiting or being sent; otherwise non zero
+ */
+int abrt_socket_flush(T_abrtSocket *sock, unsigned timeout_ms);
+
+
+
+/*
+ * Refuses further problems, drops the queued ones and stops the thread
+ *
+ * @param sock Socket
+ * @param timeout_ms A maximal number of milliseconds to wait for the thread
+ *                   which may be sending a batch
+ * @returns 0 if the thread finished; otherwise non zero and the socket must
+ *          not be freed
+ */
+int abrt_socket_close(T_abrtSocket *sock, unsigned timeout_ms);
+
+
+
+/*
+ * Gets statistics of problem submissions
+ *
+ * @param sock Socket
+ * @param stats Filled statistics
+ */
+void abrt_socket_get_stats(T_abrtSocket *sock, T_abrtSocketStats *stats);
+
+
+
+#endif // __ABRT_SOCKET_H__
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,322 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "class_index.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+
+
+/*
+ * Initial number of buckets, must be a power of 2
+ */
+#define CLASS_INDEX_INITIAL_BUCKETS 1024
+
+
+
+typedef struct class_index_item {
+    unsigned long hash;                   ///< hash of class name
+    char *class_name;                     ///< fully qualified class name
+    jweak class;                          ///< weak reference to the class
+    struct class_index_item *next;        ///< a next item in the same bucket
+} T_classIndexItem;
+
+
+
+struct class_index {
+    pthread_mutex_t mutex;
+    T_classIndexItem **buckets;           ///< bucket heads
+    size_t bucket_count;                  ///< number of buckets, a power of 2
+    size_t size;                          ///< number of items
+    size_t added_since_sweep;             ///< items added since the last removal of unloaded classes
+};
+
+
+
+T_classIndex *class_index_new(void)
+{
+    T_classIndex *index = (T_classIndex *)calloc(1, sizeof(*index));
+    if (NULL == index)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        return NULL;
+    }
+
+    index->buckets = (T_classIndexItem **)calloc(CLASS_INDEX_INITIAL_BUCKETS, sizeof(*index->buckets));
+    if (NULL == index->buckets)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        free(index);
+        return NULL;
+    }
+
+    index->bucket_count = CLASS_INDEX_INITIAL_BUCKETS;
+    pthread_mutex_init(&index->mutex, /*use default attributes*/NULL);
+
+    return index;
+}
+
+
+
+static void class_index_item_free(T_classIndexItem *item, JNIEnv *jni_env)
+{
+    if (NULL != jni_env)
+    {
+        (*jni_env)->DeleteWeakGlobalRef(jni_env, item->class);
+    }
+
+    free(item->class_name);
+    free(item);
+}
+
+
+
+void class_index_free(T_classIndex *index, JNIEnv *jni_env)
+{
+    if (NULL == index)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < index->bucket_count; ++i)
+    {
+        T_classIndexItem *item = index->buckets[i];
+        while (NULL != item)
+        {
+            T_classIndexItem *next = item->next;
+            class_index_item_free(item, jni_env);
+            item = next;
+        }
+    }
+
+    pthread_mutex_destroy(&index->mutex);
+    free(index->buckets);
+    free(index);
+}
+
+
+
+/*
+ * djb2 string hash
+ */
+static unsigned long class_index_hash(const char *class_name)
+{
+    unsigned long hash = 5381;
+    for (const unsigned char *c = (const unsigned char *)class_name; '\0' != *c; ++c)
+    {
+        hash = ((hash << 5) + hash) + *c;
+    }
+
+    return hash;
+}
+
+
+
+static inline int class_index_item_unloaded(T_classIndexItem *item, JNIEnv *jni_env)
+{
+    return (*jni_env)->IsSameObject(jni_env, item->class, NULL);
+}
+
+
+
+/*
+ * Removes items of unloaded classes from one bucket
+ */
+static void class_index_sweep_bucket(T_classIndex *index, JNIEnv *jni_env, size_t bucket)
+{
+    T_classIndexItem **link = &index->buckets[bucket];
+    while (NULL != *link)
+    {
+        T_classIndexItem *item = *link;
+        if (class_index_item_unloaded(item, jni_env))
+        {
+            VERBOSE_PRINT("Removing unloaded class '%s' from the index\n", item->class_name);
+            *link = item->next;
+            class_index_item_free(item, jni_env);
+            --index->size;
+        }
+        else
+        {
+            link = &item->next;
+        }
+    }
+}
+
+
+
+/*
+ * Doubles the number of buckets
+ *
+ * The index is left untouched if memory cannot be allocated.
+ */
+static void class_index_grow(T_classIndex *index)
+{
+    const size_t bucket_count = index->bucket_count * 2;
+    T_classIndexItem **buckets = (T_classIndexItem **)calloc(bucket_count, sizeof(*buckets));
+    if (NULL == buckets)
+    {
+        VERBOSE_PRINT("Cannot grow the class index to %zu buckets\n", bucket_count);
+        return;
+    }
+
+    for (size_t i = 0; i < index->bucket_count; ++i)
+    {
+        T_classIndexItem *item = index->buckets[i];
+        while (NULL != item)
+        {
+            T_classIndexItem *next = item->next;
+            const size_t bucket = item->hash & (bucket_count - 1);
+            item->next = buckets[bucket];
+            buckets[bucket] = item;
+            item = next;
+        }
+    }
+
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucket_count = bucket_count;
+}
+
+
+
+int class_index_add(T_classIndex *index, JNIEnv *jni_env, const char *class_name, jclass class)
+{
+    assert(NULL != index || !"Cannot add a class to NULL index");
+    assert(NULL != class_name || !"Cannot add a class without name");
+    assert(NULL != class || !"Cannot add NULL class");
+
+    const unsigned long hash = class_index_hash(class_name);
+    int retval = 1;
+
+    pthread_mutex_lock(&index->mutex);
+
+    /* Classes are unloaded in bulks together with their class loaders. The
+     * whole index is swept once as many classes were added as it kept after
+     * the last sweep so the cost of sweeping is amortized over additions. */
+    if (index->added_since_sweep >= index->size - index->added_since_sweep)
+    {
+        for (size_t i = 0; i < index->bucket_count; ++i)
+        {
+            class_index_sweep_bucket(index, jni_env, i);
+        }
+
+        index->added_since_sweep = 0;
+    }
+
+    const size_t bucket = hash & (index->bucket_count - 1);
+    for (T_classIndexItem *item = index->buckets[bucket]; NULL != item; item = item->next)
+    {
+        if (item->hash == hash
+            && 0 == strcmp(item->class_name, class_name)
+            && (*jni_env)->IsSameObject(jni_env, item->class, class))
+        {
+            retval = 0;
+            goto class_index_add_unlock;
+        }
+    }
+
+    T_classIndexItem *item = (T_classIndexItem *)malloc(sizeof(*item));
+    if (NULL == item)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory\n");
+        goto class_index_add_unlock;
+    }
+
+    item->class_name = strdup(class_name);
+    if (NULL == item->class_name)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": strdup(): out of memory\n");
+        free(item);
+        goto class_index_add_unlock;
+    }
+
+    item->class = (*jni_env)->NewWeakGlobalRef(jni_env, class);
+    if (NULL == item->class)
+    {
+        VERBOSE_PRINT("Cannot create a weak reference to class '%s'\n", class_name);
+        free(item->class_name);
+        free(item);
+        goto class_index_add_unlock;
+    }
+
+    item->hash = hash;
+    item->next = index->buckets[bucket];
+    index->buckets[bucket] = item;
+    ++index->size;
+    ++index->added_since_sweep;
+    retval = 0;
+
+    if (index->size > index->bucket_count)
+    {
+        class_index_grow(index);
+    }
+
+class_index_add_unlock:
+    pthread_mutex_unlock(&index->mutex);
+    return retval;
+}
+
+
+
+jclass class_index_find(T_classIndex *index, JNIEnv *jni_env, const char *class_name)
+{
+    assert(NULL != index || !"Cannot find a class in NULL index");
+    assert(NULL != class_name || !"Cannot find a class without name");
+
+    const unsigned long hash = class_index_hash(class_name);
+    jclass result = NULL;
+
+    pthread_mutex_lock(&index->mutex);
+
+    const size_t bucket = hash & (index->bucket_count - 1);
+    for (T_classIndexItem *item = index->buckets[bucket]; NULL == result && NULL != item; item = item->next)
+    {
+        if (item->hash == hash && 0 == strcmp(item->class_name, class_name))
+        {
+            /* NULL if the class has been unloaded */
+            result = (jclass)(*jni_env)->NewLocalRef(jni_env, item->class);
+        }
+    }
+
+    pthread_mutex_unlock(&index->mutex);
+
+    return result;
+}
+
+
+
+size_t class_index_size(T_classIndex *index)
+{
+    assert(NULL != index || !"Cannot get size of NULL index");
+
+    pthread_mutex_lock(&index->mutex);
+    const size_t size = index->size;
+    pthread_mutex_unlock(&index->mutex);
+
+    return size;
+}
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,109 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __CLASS_INDEX_H__
+#define __CLASS_INDEX_H__
+
+
+
+/*
+ * JNI types
+ */
+#include <jni.h>
+
+#include <stddef.h>
+
+
+
+/*
+ * A hash table mapping fully qualified class names (java.lang.String) to
+ * weak global references of all loaded classes having that name. There may
+ * be more classes of the same name, each defined by a different class loader.
+ *
+ * The index does not prevent classes from being unloaded. References to
+ * unloaded classes are removed lazily.
+ */
+typedef struct class_index T_classIndex;
+
+
+
+/*
+ * Initializes a new index
+ *
+ * @returns Mallocated memory which must be released by @class_index_free
+ */
+T_classIndex *class_index_new(void);
+
+
+
+/*
+ * Frees index's memory
+ *
+ * @param index Pointer to @class_index. Accepts NULL
+ * @param jni_env JNI environment used for deleting weak references or NULL
+ *        if the VM is gone and the references need not be deleted
+ */
+void class_index_free(T_classIndex *index, JNIEnv *jni_env);
+
+
+
+/*
+ * Adds a class to the index
+ *
+ * A class which is already indexed is not added twice.
+ *
+ * @param index Index
+ * @param jni_env JNI environment of the current thread
+ * @param class_name Fully qualified class name as returned by Class.getName()
+ * @param class A class
+ * @returns 0 on success; otherwise non zero
+ */
+int class_index_add(T_classIndex *index, JNIEnv *jni_env, const char *class_name, jclass class);
+
+
+
+/*
+ * Finds a loaded class of given name
+ *
+ * If there are more classes of that name, returns one of them.
+ *
+ * @param index Index
+ * @param jni_env JNI environment of the current thread
+ * @param class_name Fully qualified class name as returned by Class.getName()
+ * @returns A new local reference to the class or NULL if no such class is
+ *          loaded
+ */
+jclass class_index_find(T_classIndex *index, JNIEnv *jni_env, const char *class_name);
+
+
+
+/*
+ * Gets a number of indexed classes including not yet removed unloaded ones
+ *
+ * @param index Index
+ */
+size_t class_index_size(T_classIndex *index);
+
+
+
+#endif // __CLASS_INDEX_H__
+
+
+
+/*
+ * finito
+ */
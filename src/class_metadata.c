@@ -0,0 +1,173 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "class_metadata.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <assert.h>
+
+
+
+struct class_metadata {
+    char *location;    ///< URL of the class file
+    char *fs_path;     ///< file system path to the class file or to the JAR
+};
+
+
+
+/*
+ * Serializes GetTag()-SetTag() pairs of concurrent attaches
+ */
+static pthread_mutex_t s_attachMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+T_classMetadata *class_metadata_new(char *location, char *fs_path)
+{
+    T_classMetadata *metadata = (T_classMetadata *)malloc(sizeof(*metadata));
+    if (NULL == metadata)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory\n");
+        free(location);
+        free(fs_path);
+        return NULL;
+    }
+
+    assert(0 == ((intptr_t)metadata & OBJECT_TAG_KIND_MASK) || !"Misaligned memory cannot be used in a tag");
+
+    metadata->location = location;
+    metadata->fs_path = fs_path;
+
+    return metadata;
+}
+
+
+
+void class_metadata_free(T_classMetadata *metadata)
+{
+    if (NULL == metadata)
+    {
+        return;
+    }
+
+    free(metadata->location);
+    free(metadata->fs_path);
+    free(metadata);
+}
+
+
+
+static T_classMetadata *class_metadata_from_tag(jlong tag)
+{
+    if (0 == tag || OBJECT_TAG_CLASS_METADATA != OBJECT_TAG_KIND(tag))
+    {
+        return NULL;
+    }
+
+    return (T_classMetadata *)OBJECT_TAG_POINTER(tag);
+}
+
+
+
+const T_classMetadata *class_metadata_get(jvmtiEnv *jvmti_env, jclass class)
+{
+    jlong tag = 0;
+    if (JVMTI_ERROR_NONE != (*jvmti_env)->GetTag(jvmti_env, class, &tag))
+    {
+        VERBOSE_PRINT("Cannot get tag of a class\n");
+        return NULL;
+    }
+
+    return class_metadata_from_tag(tag);
+}
+
+
+
+const T_classMetadata *class_metadata_attach(jvmtiEnv *jvmti_env, jclass class, T_classMetadata *metadata)
+{
+    if (NULL == metadata)
+    {
+        return NULL;
+    }
+
+    T_classMetadata *result = metadata;
+
+    pthread_mutex_lock(&s_attachMutex);
+
+    jlong tag = 0;
+    if (JVMTI_ERROR_NONE != (*jvmti_env)->GetTag(jvmti_env, class, &tag))
+    {
+        VERBOSE_PRINT("Cannot get tag of a class\n");
+        result = NULL;
+    }
+    else if (0 != tag)
+    {
+        /* Either attached by other thread or tagged for other purpose */
+        result = class_metadata_from_tag(tag);
+    }
+    else if (JVMTI_ERROR_NONE != (*jvmti_env)->SetTag(jvmti_env, class, OBJECT_TAG_MAKE(metadata, OBJECT_TAG_CLASS_METADATA)))
+    {
+        VERBOSE_PRINT("Cannot set tag of a class\n");
+        result = NULL;
+    }
+
+    pthread_mutex_unlock(&s_attachMutex);
+
+    if (result != metadata)
+    {
+        class_metadata_free(metadata);
+    }
+
+    return result;
+}
+
+
+
+int class_metadata_object_free(jlong tag)
+{
+    T_classMetadata *metadata = class_metadata_from_tag(tag);
+    if (NULL == metadata)
+    {
+        return 1;
+    }
+
+    class_metadata_free(metadata);
+    return 0;
+}
+
+
+
+const char *class_metadata_location(const T_classMetadata *metadata)
+{
+    return metadata->location;
+}
+
+
+
+const char *class_metadata_fs_path(const T_classMetadata *metadata)
+{
+    return metadata->fs_path;
+}
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,125 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __CLASS_METADATA_H__
+#define __CLASS_METADATA_H__
+
+
+
+/*
+ * JNI and JVMTI types
+ */
+#include <jni.h>
+#include <jvmti.h>
+
+
+
+/*
+ * An opaque structure holding information about a loaded class which is
+ * expensive to compute, e.g. the class's location. The structure is attached
+ * to the class by a JVMTI object tag and released when the class is unloaded.
+ * It is not modified once attached, so it can be read without locking.
+ */
+typedef struct class_metadata T_classMetadata;
+
+
+
+/*
+ * Initializes a new instance
+ *
+ * @param location URL of the class file or NULL. The structure takes ownership.
+ * @param fs_path File system path of the class file or its JAR or NULL. The
+ *        structure takes ownership.
+ * @returns Mallocated memory which must be released by @class_metadata_free
+ *          or attached to a class by @class_metadata_attach; NULL on failure
+ */
+T_classMetadata *class_metadata_new(char *location, char *fs_path);
+
+
+
+/*
+ * Frees metadata's memory
+ *
+ * @param metadata Pointer to @class_metadata. Accepts NULL
+ */
+void class_metadata_free(T_classMetadata *metadata);
+
+
+
+/*
+ * Gets metadata attached to a class
+ *
+ * @param jvmti_env JVMTI environment with can_tag_objects capability
+ * @param class A class
+ * @returns The attached metadata or NULL
+ */
+const T_classMetadata *class_metadata_get(jvmtiEnv *jvmti_env, jclass class);
+
+
+
+/*
+ * Attaches metadata to a class
+ *
+ * If other thread has attached metadata to the class in the meantime, the
+ * given metadata are freed and the already attached are returned.
+ *
+ * @param jvmti_env JVMTI environment with can_tag_objects capability
+ * @param class A class
+ * @param metadata Metadata, the function takes ownership
+ * @returns The metadata attached to the class; NULL if tagging failed
+ */
+const T_classMetadata *class_metadata_attach(jvmtiEnv *jvmti_env, jclass class, T_classMetadata *metadata);
+
+
+
+/*
+ * Releases metadata of an unloaded class
+ *
+ * Must be called from JVMTI ObjectFree event callback.
+ *
+ * @param tag Tag of the freed object. Tags of other kinds are ignored
+ * @returns 0 if the tag belonged to class metadata; otherwise non zero
+ */
+int class_metadata_object_free(jlong tag);
+
+
+
+/*
+ * Gets URL of the class file
+ *
+ * @returns A string or NULL if the location is unknown
+ */
+const char *class_metadata_location(const T_classMetadata *metadata);
+
+
+
+/*
+ * Gets file system path to the class file or to the JAR containing it
+ *
+ * @returns A string or NULL if the path is unknown
+ */
+const char *class_metadata_fs_path(const T_classMetadata *metadata);
+
+
+
+#endif // __CLASS_METADATA_H__
+
+
+
+/*
+ * finito
+ */
@@ -6,18 +6,36 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <limits.h>
 
 
 
 enum {
-    OPT_abrt         = 1 << 0,
-    OPT_syslog       = 1 << 1,
-    OPT_journald     = 1 << 2,
-    OPT_output       = 1 << 3,
-    OPT_caught       = 1 << 4,
-    OPT_executable   = 1 << 5,
-    OPT_conffile     = 1 << 6,
-    OPT_debugmethod  = 1 << 7,
+    OPT_abrt            = 1 << 0,
+    OPT_syslog          = 1 << 1,
+    OPT_journald        = 1 << 2,
+    OPT_output          = 1 << 3,
+    OPT_caught          = 1 << 4,
+    OPT_executable      = 1 << 5,
+    OPT_conffile        = 1 << 6,
+    OPT_debugmethod     = 1 << 7,
+    OPT_queuedepth      = 1 << 8,
+    OPT_queueoverflow   = 1 << 9,
+    OPT_flushtimeout    = 1 << 10,
+    OPT_stacktrace      = 1 << 11,
+    OPT_stacktracedepth = 1 << 12,
+    OPT_workers         = 1 << 13,
+    OPT_stacktracesize  = 1 << 14,
+    OPT_resampleenviron = 1 << 15,
+    OPT_abrtsocket      = 1 << 16,
+    OPT_abrtbatchwindow = 1 << 17,
+    OPT_ratelimit       = 1 << 18,
+    OPT_ratelimitburst  = 1 << 19,
+    OPT_dedupwindow     = 1 << 20,
+    OPT_probedepth      = 1 << 21,
+    OPT_uncaught        = 1 << 22,
+    OPT_caughtdetection = 1 << 23,
 };
 
 
@@ -27,6 +45,39 @@ enum {
  */
 static const char *const s_defaultConfFile = "java.conf";
 
+/*
+ * The socket abrtd listens on
+ */
+static const char *const s_defaultAbrtSocket = VAR_RUN"/abrt/abrt.socket";
+
+
+
+/* Default number of reports waiting for the reporting thread */
+#define DEFAULT_REPORT_QUEUE_DEPTH 64
+
+/* Default and maximal number of reporting threads */
+#define DEFAULT_REPORT_WORKERS 1
+#define MAX_REPORT_WORKERS 32
+
+/* Default number of milliseconds spent by flushing the report queue */
+#define DEFAULT_FLUSH_TIMEOUT 5000
+
+/* Default number of frames got from JVMTI, the same as JVM's default limit */
+#define DEFAULT_STACK_TRACE_DEPTH 1024
+
+/* Default and minimal number of characters of a reported stack trace */
+#define DEFAULT_STACK_TRACE_SIZE 10000
+#define MIN_STACK_TRACE_SIZE 256
+
+/* Default number of milliseconds spent by gathering problems for abrtd */
+#define DEFAULT_ABRT_BATCH_WINDOW 20
+
+/* Default number of reports of similar exceptions allowed at once */
+#define DEFAULT_RATE_LIMIT_BURST 10
+
+/* Default number of top frames identifying similar exceptions */
+#define DEFAULT_PROBE_DEPTH 8
+
 
 
 typedef struct {
@@ -42,6 +93,19 @@ void configuration_initialize(T_configuration *conf)
     conf->reportErrosTo = ED_JOURNALD;
     conf->outputFileName = DISABLED_LOG_OUTPUT;
     conf->configurationFileName = (char *)s_defaultConfFile;
+    conf->reportQueueDepth = DEFAULT_REPORT_QUEUE_DEPTH;
+    conf->reportQueueOverflow = RQ_OVERFLOW_BLOCK;
+    conf->reportWorkers = DEFAULT_REPORT_WORKERS;
+    conf->flushTimeout = DEFAULT_FLUSH_TIMEOUT;
+    conf->stackTraceEngine = ST_ENGINE_THROWABLE;
+    conf->stackTraceDepth = DEFAULT_STACK_TRACE_DEPTH;
+    conf->stackTraceSize = DEFAULT_STACK_TRACE_SIZE;
+    conf->abrtSocketPath = (char *)s_defaultAbrtSocket;
+    conf->abrtBatchWindow = DEFAULT_ABRT_BATCH_WINDOW;
+    conf->rateLimitBurst = DEFAULT_RATE_LIMIT_BURST;
+    conf->probeDepth = DEFAULT_PROBE_DEPTH;
+    conf->uncaughtDetection = UE_DETECTION_EVENTS;
+    conf->caughtDetection = CE_DETECTION_EVENTS;
 }
 
 
@@ -58,6 +122,11 @@ void configuration_destroy(T_configuration *conf)
         free(conf->configurationFileName);
     }
 
+    if (conf->abrtSocketPath != s_defaultAbrtSocket)
+    {
+        free(conf->abrtSocketPath);
+    }
+
     free(conf->reportedCaughExceptionTypes);
     free(conf->fqdnDebugMethods);
 }
@@ -296,6 +365,388 @@ static int parse_option_debugmethod(T_configuration *conf, const char *value, T_
 
 
 
+/*
+ * Converts a string to an unsigned number
+ *
+ * Refuses empty strings, negative numbers, trailing garbage and numbers
+ * greater than UINT_MAX.
+ */
+static int parse_unsigned_value(const char *value, unsigned *result)
+{
+    if (NULL == value || '\0' == value[0])
+    {
+        fprintf(stderr, "Value cannot be empty\n");
+        return 1;
+    }
+
+    if (NULL != strchr(value, '-'))
+    {
+        fprintf(stderr, "Value must not be negative '%s'\n", value);
+        return 1;
+    }
+
+    char *end = NULL;
+    errno = 0;
+    const unsigned long number = strtoul(value, &end, 10);
+    if (0 != errno || '\0' != *end || number > UINT_MAX)
+    {
+        fprintf(stderr, "Not an unsigned number '%s'\n", value);
+        return 1;
+    }
+
+    *result = (unsigned)number;
+    return 0;
+}
+
+
+
+static int parse_option_queuedepth(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned depth = 0;
+    if (parse_unsigned_value(value, &depth))
+    {
+        return 1;
+    }
+
+    VERBOSE_PRINT("Using report queue depth %u\n", depth);
+    conf->reportQueueDepth = depth;
+    return 0;
+}
+
+
+
+static int parse_option_queueoverflow(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    if (NULL == value || '\0' == value[0])
+    {
+        fprintf(stderr, "Value cannot be empty\n");
+        return 1;
+    }
+    else if (strcmp("block", value) == 0)
+    {
+        VERBOSE_PRINT("Wait for a free slot in the full report queue\n");
+        conf->reportQueueOverflow = RQ_OVERFLOW_BLOCK;
+    }
+    else if (strcmp("dropnewest", value) == 0)
+    {
+        VERBOSE_PRINT("Drop new reports if the report queue is full\n");
+        conf->reportQueueOverflow = RQ_OVERFLOW_DROP_NEWEST;
+    }
+    else if (strcmp("dropoldest", value) == 0)
+    {
+        VERBOSE_PRINT("Drop the oldest report if the report queue is full\n");
+        conf->reportQueueOverflow = RQ_OVERFLOW_DROP_OLDEST;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown value '%s'\n", value);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+static int parse_option_workers(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned workers = 0;
+    if (parse_unsigned_value(value, &workers))
+    {
+        return 1;
+    }
+
+    if (0 == workers || workers > MAX_REPORT_WORKERS)
+    {
+        fprintf(stderr, "Number of reporting threads must be from 1 to %d '%s'\n", MAX_REPORT_WORKERS, value);
+        return 1;
+    }
+
+    VERBOSE_PRINT("Using %u reporting threads\n", workers);
+    conf->reportWorkers = workers;
+    return 0;
+}
+
+
+
+static int parse_option_flushtimeout(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned timeout = 0;
+    if (parse_unsigned_value(value, &timeout))
+    {
+        return 1;
+    }
+
+    VERBOSE_PRINT("Using flush timeout %ums\n", timeout);
+    conf->flushTimeout = timeout;
+    return 0;
+}
+
+
+
+static int parse_option_stacktrace(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    if (NULL == value || '\0' == value[0])
+    {
+        fprintf(stderr, "Value cannot be empty\n");
+        return 1;
+    }
+    else if (strcmp("throwable", value) == 0)
+    {
+        VERBOSE_PRINT("Get stack trace frames from the exception object\n");
+        conf->stackTraceEngine = ST_ENGINE_THROWABLE;
+    }
+    else if (strcmp("jvmti", value) == 0)
+    {
+        VERBOSE_PRINT("Get stack trace frames from the throwing thread\n");
+        conf->stackTraceEngine = ST_ENGINE_JVMTI;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown value '%s'\n", value);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+static int parse_option_stacktracedepth(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned depth = 0;
+    if (parse_unsigned_value(value, &depth))
+    {
+        return 1;
+    }
+
+    if (0 == depth || depth > INT_MAX)
+    {
+        fprintf(stderr, "Stack trace depth out of range '%s'\n", value);
+        return 1;
+    }
+
+    VERBOSE_PRINT("Using stack trace depth %u\n", depth);
+    conf->stackTraceDepth = depth;
+    return 0;
+}
+
+
+
+static int parse_option_resampleenviron(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    if (value != NULL && (strcasecmp("on", value) == 0 || strcasecmp("yes", value) == 0))
+    {
+        VERBOSE_PRINT("Reading environment of the process for every ABRT report\n");
+        conf->resampleEnviron = 1;
+    }
+    else if (value != NULL && (strcasecmp("off", value) == 0 || strcasecmp("no", value) == 0))
+    {
+        VERBOSE_PRINT("Reading environment of the process once\n");
+        conf->resampleEnviron = 0;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown value '%s'\n", value ? value : "(None)");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+static int parse_option_stacktracesize(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned size = 0;
+    if (parse_unsigned_value(value, &size))
+    {
+        return 1;
+    }
+
+    if (MIN_STACK_TRACE_SIZE > size || size > INT_MAX)
+    {
+        fprintf(stderr, "Stack trace size out of range '%s'\n", value);
+        return 1;
+    }
+
+    VERBOSE_PRINT("Using stack trace size %u\n", size);
+    conf->stackTraceSize = size;
+    return 0;
+}
+
+
+
+static int parse_option_abrtsocket(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    if (NULL == value || '\0' == value[0])
+    {
+        fprintf(stderr, "Value cannot be empty\n");
+        return 1;
+    }
+
+    char *path = strdup(value);
+    if (NULL == path)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": strdup(abrtsocket): out of memory\n");
+        return 1;
+    }
+
+    if (conf->abrtSocketPath != s_defaultAbrtSocket)
+    {
+        free(conf->abrtSocketPath);
+    }
+
+    VERBOSE_PRINT("Using ABRT socket '%s'\n", path);
+    conf->abrtSocketPath = path;
+    return 0;
+}
+
+
+
+static int parse_option_abrtbatchwindow(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned window = 0;
+    if (parse_unsigned_value(value, &window))
+    {
+        return 1;
+    }
+
+    VERBOSE_PRINT("Using ABRT batch window %ums\n", window);
+    conf->abrtBatchWindow = window;
+    return 0;
+}
+
+
+
+static int parse_option_ratelimit(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned rate = 0;
+    if (parse_unsigned_value(value, &rate))
+    {
+        return 1;
+    }
+
+    VERBOSE_PRINT("Limiting reports of similar exceptions to %u per minute\n", rate);
+    conf->rateLimit = rate;
+    return 0;
+}
+
+
+
+static int parse_option_ratelimitburst(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned burst = 0;
+    if (parse_unsigned_value(value, &burst))
+    {
+        return 1;
+    }
+
+    if (0 == burst)
+    {
+        fprintf(stderr, "Rate limit burst must be positive '%s'\n", value);
+        return 1;
+    }
+
+    VERBOSE_PRINT("Allowing %u reports of similar exceptions at once\n", burst);
+    conf->rateLimitBurst = burst;
+    return 0;
+}
+
+
+
+static int parse_option_dedupwindow(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned window = 0;
+    if (parse_unsigned_value(value, &window))
+    {
+        return 1;
+    }
+
+    VERBOSE_PRINT("Coalescing repeated exceptions for %ums\n", window);
+    conf->dedupWindow = window;
+    return 0;
+}
+
+
+
+static int parse_option_probedepth(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    unsigned depth = 0;
+    if (parse_unsigned_value(value, &depth))
+    {
+        return 1;
+    }
+
+    if (0 == depth || MAX_PROBE_DEPTH < depth)
+    {
+        fprintf(stderr, "Probe depth must be from 1 to %d '%s'\n", MAX_PROBE_DEPTH, value);
+        return 1;
+    }
+
+    VERBOSE_PRINT("Identifying similar exceptions by %u top frames\n", depth);
+    conf->probeDepth = depth;
+    return 0;
+}
+
+
+
+static int parse_option_uncaught(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    if (NULL == value || '\0' == value[0])
+    {
+        fprintf(stderr, "Value cannot be empty\n");
+        return 1;
+    }
+    else if (strcmp("events", value) == 0)
+    {
+        VERBOSE_PRINT("Detect uncaught exceptions by JVMTI exception events\n");
+        conf->uncaughtDetection = UE_DETECTION_EVENTS;
+    }
+    else if (strcmp("handler", value) == 0)
+    {
+        VERBOSE_PRINT("Detect uncaught exceptions by the default uncaught exception handler\n");
+        conf->uncaughtDetection = UE_DETECTION_HANDLER;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown value '%s'\n", value);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+static int parse_option_caughtdetection(T_configuration *conf, const char *value, T_context *context __UNUSED_VAR)
+{
+    if (NULL == value || '\0' == value[0])
+    {
+        fprintf(stderr, "Value cannot be empty\n");
+        return 1;
+    }
+    else if (strcmp("events", value) == 0)
+    {
+        VERBOSE_PRINT("Detect caught exceptions by JVMTI exception events\n");
+        conf->caughtDetection = CE_DETECTION_EVENTS;
+    }
+    else if (strcmp("constructor", value) == 0)
+    {
+        VERBOSE_PRINT("Detect caught exceptions by breakpoints in their constructors\n");
+        conf->caughtDetection = CE_DETECTION_CONSTRUCTOR;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown value '%s'\n", value);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
 static void parse_key_value(T_configuration *conf, const char *key, const char *value, T_context *context)
 {
     static struct parse_pair {
@@ -311,6 +762,22 @@ static void parse_key_value(T_configuration *conf, const char *key, const char *
         { OPT_executable, "executable", parse_option_executable },
         { OPT_conffile, "conffile", parse_option_conffile },
         { OPT_debugmethod, "debugmethod", parse_option_debugmethod },
+        { OPT_queuedepth, "queuedepth", parse_option_queuedepth },
+        { OPT_queueoverflow, "queueoverflow", parse_option_queueoverflow },
+        { OPT_workers, "workers", parse_option_workers },
+        { OPT_flushtimeout, "flushtimeout", parse_option_flushtimeout },
+        { OPT_stacktrace, "stacktrace", parse_option_stacktrace },
+        { OPT_stacktracedepth, "stacktracedepth", parse_option_stacktracedepth },
+        { OPT_stacktracesize, "stacktracesize", parse_option_stacktracesize },
+        { OPT_resampleenviron, "resampleenviron", parse_option_resampleenviron },
+        { OPT_abrtsocket, "abrtsocket", parse_option_abrtsocket },
+        { OPT_abrtbatchwindow, "abrtbatchwindow", parse_option_abrtbatchwindow },
+        { OPT_ratelimit, "ratelimit", parse_option_ratelimit },
+        { OPT_ratelimitburst, "ratelimitburst", parse_option_ratelimitburst },
+        { OPT_dedupwindow, "dedupwindow", parse_option_dedupwindow },
+        { OPT_probedepth, "probedepth", parse_option_probedepth },
+        { OPT_uncaught, "uncaught", parse_option_uncaught },
+        { OPT_caughtdetection, "caughtdetection", parse_option_caughtdetection },
     };
 
     for (size_t i = 0; i < sizeof(arguments)/sizeof(arguments[0]); ++i)
@@ -0,0 +1,420 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "frame_cache.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+
+
+
+typedef struct frame_cache_frame {
+    jmethodID method;                     ///< method of the frame
+    jlocation location;                   ///< location in the method
+    size_t length;                        ///< length of the formatted frame
+    struct frame_cache_frame *next;       ///< a next frame in the same bucket
+    char text[];                          ///< formatted frame
+} T_frameCacheFrame;
+
+
+
+typedef struct frame_cache_lines {
+    jmethodID method;                     ///< method owning the table
+    jint count;                           ///< number of entries, 0 if unknown
+    jvmtiLineNumberEntry *entries;        ///< entries sorted by start_location
+    struct frame_cache_lines *next;       ///< a next table in the same bucket
+} T_frameCacheLines;
+
+
+
+struct frame_cache {
+    pthread_mutex_t mutex;
+    size_t capacity;                      ///< maximal number of frames and of tables
+    size_t bucket_mask;                   ///< number of buckets - 1
+    T_frameCacheFrame **frames;           ///< buckets of formatted frames
+    size_t frame_count;                   ///< number of formatted frames
+    T_frameCacheLines **lines;            ///< buckets of line number tables
+    size_t lines_count;                   ///< number of line number tables
+    unsigned long generation;             ///< incremented by invalidation
+    unsigned long cached_generation;      ///< generation of cached data
+};
+
+
+
+T_frameCache *frame_cache_new(size_t capacity)
+{
+    assert(0 != capacity || !"Cannot use 0 capacity in frame cache");
+
+    T_frameCache *cache = (T_frameCache *)calloc(1, sizeof(*cache));
+    if (NULL == cache)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        return NULL;
+    }
+
+    size_t bucket_count = 1;
+    while (bucket_count < capacity)
+    {
+        bucket_count <<= 1;
+    }
+
+    cache->frames = (T_frameCacheFrame **)calloc(bucket_count, sizeof(*cache->frames));
+    cache->lines = (T_frameCacheLines **)calloc(bucket_count, sizeof(*cache->lines));
+    if (NULL == cache->frames || NULL == cache->lines)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        free(cache->frames);
+        free(cache->lines);
+        free(cache);
+        return NULL;
+    }
+
+    cache->capacity = capacity;
+    cache->bucket_mask = bucket_count - 1;
+    pthread_mutex_init(&cache->mutex, /*use default attributes*/NULL);
+
+    return cache;
+}
+
+
+
+static void frame_cache_clear_frames(T_frameCache *cache)
+{
+    for (size_t i = 0; i <= cache->bucket_mask; ++i)
+    {
+        T_frameCacheFrame *frame = cache->frames[i];
+        while (NULL != frame)
+        {
+            T_frameCacheFrame *next = frame->next;
+            free(frame);
+            frame = next;
+        }
+        cache->frames[i] = NULL;
+    }
+
+    cache->frame_count = 0;
+}
+
+
+
+static void frame_cache_clear_lines(T_frameCache *cache)
+{
+    for (size_t i = 0; i <= cache->bucket_mask; ++i)
+    {
+        T_frameCacheLines *lines = cache->lines[i];
+        while (NULL != lines)
+        {
+            T_frameCacheLines *next = lines->next;
+            free(lines->entries);
+            free(lines);
+            lines = next;
+        }
+        cache->lines[i] = NULL;
+    }
+
+    cache->lines_count = 0;
+}
+
+
+
+void frame_cache_free(T_frameCache *cache)
+{
+    if (NULL == cache)
+    {
+        return;
+    }
+
+    frame_cache_clear_frames(cache);
+    frame_cache_clear_lines(cache);
+
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->frames);
+    free(cache->lines);
+    free(cache);
+}
+
+
+
+/*
+ * Locks the cache and drops the cached data if the cache was invalidated
+ */
+static void frame_cache_lock(T_frameCache *cache)
+{
+    pthread_mutex_lock(&cache->mutex);
+
+    const unsigned long generation = __atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE);
+    if (generation != cache->cached_generation)
+    {
+        VERBOSE_PRINT("Dropping invalidated stack frames\n");
+        frame_cache_clear_frames(cache);
+        frame_cache_clear_lines(cache);
+        cache->cached_generation = generation;
+    }
+}
+
+
+
+static inline size_t frame_cache_bucket(T_frameCache *cache, jmethodID method, jlocation location)
+{
+    /* jmethodIDs are aligned pointers, the lowest bits are always 0 */
+    uint64_t hash = ((uint64_t)(uintptr_t)method >> 3) ^ ((uint64_t)location * UINT64_C(0x9E3779B97F4A7C15));
+    hash ^= hash >> 29;
+    return (size_t)hash & cache->bucket_mask;
+}
+
+
+
+int frame_cache_append_frame(T_frameCache *cache, jmethodID method, jlocation location, T_stringBuilder *builder)
+{
+    assert(NULL != cache || !"Cannot get a frame from NULL cache");
+
+    int retval = -1;
+
+    frame_cache_lock(cache);
+
+    const size_t bucket = frame_cache_bucket(cache, method, location);
+    for (T_frameCacheFrame *frame = cache->frames[bucket]; NULL != frame; frame = frame->next)
+    {
+        if (frame->method == method && frame->location == location)
+        {
+            retval = string_builder_append_n(builder, frame->text, frame->length) ? 0 : (int)frame->length;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&cache->mutex);
+
+    return retval;
+}
+
+
+
+void frame_cache_put_frame(T_frameCache *cache, jmethodID method, jlocation location, const char *text)
+{
+    assert(NULL != cache || !"Cannot put a frame to NULL cache");
+    assert(NULL != text || !"Cannot put NULL frame to a cache");
+
+    const size_t length = strlen(text);
+    T_frameCacheFrame *new_frame = (T_frameCacheFrame *)malloc(sizeof(*new_frame) + length + 1);
+    if (NULL == new_frame)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory\n");
+        return;
+    }
+
+    new_frame->method = method;
+    new_frame->location = location;
+    new_frame->length = length;
+    memcpy(new_frame->text, text, length + 1);
+
+    frame_cache_lock(cache);
+
+    const size_t bucket = frame_cache_bucket(cache, method, location);
+    for (T_frameCacheFrame *frame = cache->frames[bucket]; NULL != frame; frame = frame->next)
+    {
+        if (frame->method == method && frame->location == location)
+        {   /* other thread was faster */
+            free(new_frame);
+            goto frame_cache_put_frame_unlock;
+        }
+    }
+
+    if (cache->frame_count >= cache->capacity)
+    {
+        VERBOSE_PRINT("The frame cache is full, starting over\n");
+        frame_cache_clear_frames(cache);
+    }
+
+    new_frame->next = cache->frames[bucket];
+    cache->frames[bucket] = new_frame;
+    ++cache->frame_count;
+
+frame_cache_put_frame_unlock:
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+
+
+static int frame_cache_compare_line_entries(const void *lhs, const void *rhs)
+{
+    const jlocation l = ((const jvmtiLineNumberEntry *)lhs)->start_location;
+    const jlocation r = ((const jvmtiLineNumberEntry *)rhs)->start_location;
+    return (l > r) - (l < r);
+}
+
+
+
+/*
+ * Gets a sorted copy of method's line number table from JVMTI
+ *
+ * @returns Mallocated structure or NULL on failure
+ */
+static T_frameCacheLines *frame_cache_load_lines(jvmtiEnv *jvmti_env, jmethodID method)
+{
+    T_frameCacheLines *lines = (T_frameCacheLines *)calloc(1, sizeof(*lines));
+    if (NULL == lines)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        return NULL;
+    }
+
+    lines->method = method;
+
+    jint count = 0;
+    jvmtiLineNumberEntry *table = NULL;
+    const jvmtiError error_code = (*jvmti_env)->GetLineNumberTable(jvmti_env, method, &count, &table);
+    /* Native methods and classes compiled without debug info have no table,
+     * remember that there are no lines */
+    if (JVMTI_ERROR_NONE != error_code)
+    {
+        VERBOSE_PRINT("Method has no line number table (JVMTI error %d)\n", (int)error_code);
+        return lines;
+    }
+
+    if (0 < count)
+    {
+        lines->entries = (jvmtiLineNumberEntry *)malloc(count * sizeof(*lines->entries));
+        if (NULL == lines->entries)
+        {
+            fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory\n");
+            free(lines);
+            lines = NULL;
+        }
+        else
+        {
+            memcpy(lines->entries, table, count * sizeof(*lines->entries));
+            /* The table is not guaranteed to be sorted */
+            qsort(lines->entries, count, sizeof(*lines->entries), frame_cache_compare_line_entries);
+            lines->count = count;
+        }
+    }
+
+    (*jvmti_env)->Deallocate(jvmti_env, (unsigned char *)table);
+    return lines;
+}
+
+
+
+static int frame_cache_find_line(const T_frameCacheLines *lines, jlocation location)
+{
+    /* Find the last entry starting at or before the location */
+    jint low = 0;
+    jint high = lines->count;
+    while (low < high)
+    {
+        const jint middle = low + (high - low) / 2;
+        if (lines->entries[middle].start_location <= location)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return 0 == low ? -1 : lines->entries[low - 1].line_number;
+}
+
+
+
+int frame_cache_get_line_number(T_frameCache *cache, jvmtiEnv *jvmti_env, jmethodID method, jlocation location)
+{
+    assert(NULL != cache || !"Cannot get a line number from NULL cache");
+
+    if (location < 0)
+    {   /* native method */
+        return -1;
+    }
+
+    const size_t bucket = frame_cache_bucket(cache, method, /*whole method*/0);
+    int line_number = -1;
+
+    frame_cache_lock(cache);
+
+    T_frameCacheLines *lines = cache->lines[bucket];
+    while (NULL != lines && lines->method != method)
+    {
+        lines = lines->next;
+    }
+
+    if (NULL == lines)
+    {
+        /* Do not call JVMTI with the lock held */
+        pthread_mutex_unlock(&cache->mutex);
+
+        T_frameCacheLines *new_lines = frame_cache_load_lines(jvmti_env, method);
+        if (NULL == new_lines)
+        {
+            return -1;
+        }
+
+        frame_cache_lock(cache);
+
+        /* Other thread might have added the table in the meantime */
+        lines = cache->lines[bucket];
+        while (NULL != lines && lines->method != method)
+        {
+            lines = lines->next;
+        }
+
+        if (NULL == lines)
+        {
+            if (cache->lines_count >= cache->capacity)
+            {
+                VERBOSE_PRINT("The line number table cache is full, starting over\n");
+                frame_cache_clear_lines(cache);
+            }
+
+            new_lines->next = cache->lines[bucket];
+            cache->lines[bucket] = new_lines;
+            ++cache->lines_count;
+            lines = new_lines;
+        }
+        else
+        {
+            free(new_lines->entries);
+            free(new_lines);
+        }
+    }
+
+    line_number = frame_cache_find_line(lines, location);
+
+    pthread_mutex_unlock(&cache->mutex);
+
+    return line_number;
+}
+
+
+
+void frame_cache_invalidate(T_frameCache *cache)
+{
+    assert(NULL != cache || !"Cannot invalidate NULL cache");
+
+    __atomic_add_fetch(&cache->generation, 1, __ATOMIC_RELEASE);
+}
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,127 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __FRAME_CACHE_H__
+#define __FRAME_CACHE_H__
+
+
+
+/*
+ * JNI and JVMTI types
+ */
+#include <jni.h>
+#include <jvmti.h>
+
+#include "string_builder.h"
+
+#include <stddef.h>
+
+
+
+/*
+ * Memoizes data needed for printing stack frames got from JVMTI
+ *
+ * Keeps formatted frames keyed by (jmethodID, jlocation) and sorted line
+ * number tables keyed by jmethodID. The cache holds at most the given number
+ * of frames and of line number tables; it starts over when it gets full.
+ */
+typedef struct frame_cache T_frameCache;
+
+
+
+/*
+ * Initializes a new cache
+ *
+ * @param capacity A maximal number of cached frames and of cached line number
+ *        tables
+ * @returns Mallocated memory which must be released by @frame_cache_free
+ */
+T_frameCache *frame_cache_new(size_t capacity);
+
+
+
+/*
+ * Frees cache's memory
+ *
+ * @param cache Pointer to @frame_cache. Accepts NULL
+ */
+void frame_cache_free(T_frameCache *cache);
+
+
+
+/*
+ * Appends a cached formatted frame to a string builder
+ *
+ * @param cache Cache
+ * @param method Method of the frame
+ * @param location Location of the frame
+ * @param builder Output string builder
+ * @returns A number of appended characters; 0 if the frame does not fit the
+ *          builder's limit; -1 if the frame is not cached
+ */
+int frame_cache_append_frame(T_frameCache *cache, jmethodID method, jlocation location, T_stringBuilder *builder);
+
+
+
+/*
+ * Caches a formatted frame
+ *
+ * @param cache Cache
+ * @param method Method of the frame
+ * @param location Location of the frame
+ * @param frame Formatted frame, the cache makes its own copy
+ */
+void frame_cache_put_frame(T_frameCache *cache, jmethodID method, jlocation location, const char *frame);
+
+
+
+/*
+ * Translates a location to a line number
+ *
+ * The method's line number table is got from JVMTI only once and then the
+ * line is looked up by binary search. The line is the line of the last entry
+ * starting at or before the location, the same as JVM uses.
+ *
+ * @param cache Cache
+ * @param jvmti_env JVMTI environment with can_get_line_numbers capability
+ * @param method A method
+ * @param location A location in the method
+ * @returns The line number or -1 if it is not known
+ */
+int frame_cache_get_line_number(T_frameCache *cache, jvmtiEnv *jvmti_env, jmethodID method, jlocation location);
+
+
+
+/*
+ * Drops all cached data
+ *
+ * Does not lock anything, so it can be called from JVMTI ObjectFree event
+ * callback. The data are released by the next call accessing the cache.
+ *
+ * @param cache Cache
+ */
+void frame_cache_invalidate(T_frameCache *cache);
+
+
+
+#endif // __FRAME_CACHE_H__
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,228 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "jni_cache.h"
+#include "abrt-checker.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+
+
+/*
+ * Initialization state of the cache
+ */
+enum {
+    JNI_CACHE_EMPTY = 0,
+    JNI_CACHE_READY,
+    JNI_CACHE_FAILED,
+};
+
+
+
+static T_jniCache s_jniCache;
+
+static int s_jniCacheState = JNI_CACHE_EMPTY;
+
+static pthread_mutex_t s_jniCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/*
+ * Returns logical true if exception occurred and clears it.
+ */
+static int jni_cache_clear_exception(JNIEnv *jni_env)
+{
+    if ((*jni_env)->ExceptionOccurred(jni_env))
+    {
+#ifdef VERBOSE
+        (*jni_env)->ExceptionDescribe(jni_env);
+#endif
+        (*jni_env)->ExceptionClear(jni_env);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Finds a class and stores a global reference to it.
+ */
+static int jni_cache_class(JNIEnv *jni_env, const char *name, jclass *result)
+{
+    jclass class = (*jni_env)->FindClass(jni_env, name);
+    if (jni_cache_clear_exception(jni_env) || NULL == class)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": Cannot find class %s\n", name);
+        return 1;
+    }
+
+    *result = (jclass)(*jni_env)->NewGlobalRef(jni_env, class);
+    (*jni_env)->DeleteLocalRef(jni_env, class);
+
+    if (NULL == *result)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": Cannot create a global reference to class %s\n", name);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+static int jni_cache_method(JNIEnv *jni_env, jclass class, const char *name, const char *signature, jmethodID *result)
+{
+    *result = (*jni_env)->GetMethodID(jni_env, class, name, signature);
+    if (jni_cache_clear_exception(jni_env) || NULL == *result)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": Cannot find method %s%s\n", name, signature);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Wraps java.lang.ClassLoader.getSystemClassLoader()
+ */
+static jobject jni_cache_system_class_loader(JNIEnv *jni_env, jclass class_loader_class)
+{
+    jmethodID get_system_class_loader = (*jni_env)->GetStaticMethodID(jni_env, class_loader_class, "getSystemClassLoader", "()Ljava/lang/ClassLoader;");
+    if (jni_cache_clear_exception(jni_env) || NULL == get_system_class_loader)
+    {
+        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not find method java.lang.ClassLoader.getSystemClassLoader()Ljava/lang/ClassLoader;\n");
+        return NULL;
+    }
+
+    jobject system_class_loader = (*jni_env)->CallStaticObjectMethod(jni_env, class_loader_class, get_system_class_loader);
+    if (jni_cache_clear_exception(jni_env) || NULL == system_class_loader)
+    {
+        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Exception occurred: Cannot get the system class loader\n");
+        return NULL;
+    }
+
+    jobject global = (*jni_env)->NewGlobalRef(jni_env, system_class_loader);
+    (*jni_env)->DeleteLocalRef(jni_env, system_class_loader);
+    return global;
+}
+
+
+
+static int jni_cache_resolve(JNIEnv *jni_env, T_jniCache *cache)
+{
+    if (jni_cache_class(jni_env, "java/lang/Object", &cache->object_class)
+        || jni_cache_method(jni_env, cache->object_class, "toString", "()Ljava/lang/String;", &cache->object_to_string))
+    {
+        return 1;
+    }
+
+    if (jni_cache_class(jni_env, "java/lang/Throwable", &cache->throwable_class)
+        || jni_cache_method(jni_env, cache->throwable_class, "getStackTrace", "()[Ljava/lang/StackTraceElement;", &cache->throwable_get_stack_trace)
+        || jni_cache_method(jni_env, cache->throwable_class, "getCause", "()Ljava/lang/Throwable;", &cache->throwable_get_cause))
+    {
+        return 1;
+    }
+
+    if (jni_cache_class(jni_env, "java/lang/StackTraceElement", &cache->stack_trace_element_class)
+        || jni_cache_method(jni_env, cache->stack_trace_element_class, "getClassName", "()Ljava/lang/String;", &cache->stack_trace_element_get_class_name)
+        || jni_cache_method(jni_env, cache->stack_trace_element_class, "getMethodName", "()Ljava/lang/String;", &cache->stack_trace_element_get_method_name))
+    {
+        return 1;
+    }
+
+    if (jni_cache_class(jni_env, "java/lang/ClassLoader", &cache->class_loader_class)
+        || jni_cache_method(jni_env, cache->class_loader_class, "getResource", "(Ljava/lang/String;)Ljava/net/URL;", &cache->class_loader_get_resource))
+    {
+        return 1;
+    }
+
+    if (jni_cache_class(jni_env, "java/net/URL", &cache->url_class)
+        || jni_cache_method(jni_env, cache->url_class, "toExternalForm", "()Ljava/lang/String;", &cache->url_to_external_form)
+        || jni_cache_method(jni_env, cache->url_class, "getPath", "()Ljava/lang/String;", &cache->url_get_path))
+    {
+        return 1;
+    }
+
+    if (jni_cache_class(jni_env, "java/lang/Thread", &cache->thread_class)
+        || jni_cache_method(jni_env, cache->thread_class, "<init>", "(Ljava/lang/String;)V", &cache->thread_init))
+    {
+        return 1;
+    }
+
+    /* Not fatal, renaming of threads will not be detected */
+    cache->thread_name = (*jni_env)->GetFieldID(jni_env, cache->thread_class, "name", "Ljava/lang/String;");
+    if (jni_cache_clear_exception(jni_env) || NULL == cache->thread_name)
+    {
+        VERBOSE_PRINT(__FILE__ ":" STRINGIZE(__LINE__)": Could not find field java.lang.Thread.name\n");
+        cache->thread_name = NULL;
+    }
+
+    /* Not fatal, classes loaded by the bootstrap class loader will have unknown path */
+    cache->system_class_loader = jni_cache_system_class_loader(jni_env, cache->class_loader_class);
+
+    return 0;
+}
+
+
+
+int jni_cache_initialize(JNIEnv *jni_env)
+{
+    pthread_mutex_lock(&s_jniCacheMutex);
+
+    if (JNI_CACHE_EMPTY == s_jniCacheState)
+    {
+        /* Global references of a failed attempt are left to the VM, the
+         * initialization is not retried */
+        const int state = jni_cache_resolve(jni_env, &s_jniCache) ? JNI_CACHE_FAILED : JNI_CACHE_READY;
+        __atomic_store_n(&s_jniCacheState, state, __ATOMIC_RELEASE);
+        VERBOSE_PRINT("JNI cache is %s\n", JNI_CACHE_READY == state ? "ready" : "not available");
+    }
+
+    const int retval = JNI_CACHE_READY != s_jniCacheState;
+
+    pthread_mutex_unlock(&s_jniCacheMutex);
+    return retval;
+}
+
+
+
+const T_jniCache *jni_cache_get(JNIEnv *jni_env)
+{
+    const int state = __atomic_load_n(&s_jniCacheState, __ATOMIC_ACQUIRE);
+    if (JNI_CACHE_READY == state)
+    {
+        return &s_jniCache;
+    }
+
+    if (JNI_CACHE_FAILED == state || jni_cache_initialize(jni_env))
+    {
+        return NULL;
+    }
+
+    return &s_jniCache;
+}
+
+
+
+/*
+ * finito
+ */
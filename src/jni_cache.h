@@ -0,0 +1,96 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __JNI_CACHE_H__
+#define __JNI_CACHE_H__
+
+
+
+/*
+ * JNI types
+ */
+#include <jni.h>
+
+
+
+/*
+ * Global references to frequently used classes and IDs of their methods
+ *
+ * All members are resolved at once and are valid until the VM dies, so the
+ * structure can be read by any thread without locking.
+ */
+typedef struct {
+    jclass object_class;                            ///< java.lang.Object
+    jmethodID object_to_string;                     ///< String toString()
+
+    jclass throwable_class;                         ///< java.lang.Throwable
+    jmethodID throwable_get_stack_trace;            ///< StackTraceElement[] getStackTrace()
+    jmethodID throwable_get_cause;                  ///< Throwable getCause()
+
+    jclass stack_trace_element_class;               ///< java.lang.StackTraceElement
+    jmethodID stack_trace_element_get_class_name;   ///< String getClassName()
+    jmethodID stack_trace_element_get_method_name;  ///< String getMethodName()
+
+    jclass class_loader_class;                      ///< java.lang.ClassLoader
+    jmethodID class_loader_get_resource;            ///< URL getResource(String)
+
+    jclass url_class;                               ///< java.net.URL
+    jmethodID url_to_external_form;                 ///< String toExternalForm()
+    jmethodID url_get_path;                         ///< String getPath()
+
+    jclass thread_class;                            ///< java.lang.Thread
+    jmethodID thread_init;                          ///< Thread(String)
+    jfieldID thread_name;                           ///< String name, can be NULL
+
+    jobject system_class_loader;                    ///< ClassLoader.getSystemClassLoader(), can be NULL
+} T_jniCache;
+
+
+
+/*
+ * Resolves all cached classes and methods
+ *
+ * Should be called from VMInit callback. Does nothing if the cache has been
+ * already initialized.
+ *
+ * @param jni_env JNIEnv of the calling thread
+ * @returns 0 on success; otherwise non zero
+ */
+int jni_cache_initialize(JNIEnv *jni_env);
+
+
+
+/*
+ * Gets the cache
+ *
+ * Initializes the cache if it has not been initialized yet, which can happen
+ * if an event is delivered before VMInit callback finished.
+ *
+ * @param jni_env JNIEnv of the calling thread
+ * @returns The cache or NULL if the cache cannot be initialized
+ */
+const T_jniCache *jni_cache_get(JNIEnv *jni_env);
+
+
+
+#endif // __JNI_CACHE_H__
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,350 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "report_arena.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+
+/*
+ * Size of the retained first chunk, enough for a report with an ordinary
+ * stack trace
+ */
+#define REPORT_ARENA_CHUNK_SIZE (16 * 1024)
+
+/*
+ * Alignment of allocated memory
+ */
+#define REPORT_ARENA_ALIGNMENT 16
+
+/*
+ * Maximal number of arenas in a thread's free list, others go to the shared
+ * pool
+ */
+#define REPORT_ARENA_THREAD_FREE_LIST_LENGTH 4
+
+/*
+ * Maximal number of arenas in the shared pool, others are freed
+ */
+#define REPORT_ARENA_SHARED_POOL_LENGTH 64
+
+
+
+typedef struct report_arena_chunk {
+    struct report_arena_chunk *next;   ///< previously filled chunk
+    size_t size;                       ///< size of memory
+    size_t used;                       ///< number of allocated bytes
+    char *mem;                         ///< memory following the header
+} T_reportArenaChunk;
+
+
+
+struct report_arena {
+    T_reportArenaChunk *chunk;         ///< the chunk being filled
+    T_reportArenaChunk *first;         ///< retained chunk
+    T_reportArena *next_free;          ///< next arena in a free list
+    size_t free_count;                 ///< length of the free list from this arena
+};
+
+
+
+static pthread_key_t s_threadFreeListKey;
+
+static pthread_once_t s_threadFreeListOnce = PTHREAD_ONCE_INIT;
+
+static int s_threadFreeListKeyCreated;
+
+static pthread_mutex_t s_sharedPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static T_reportArena *s_sharedPool;
+
+
+
+static inline size_t report_arena_align(size_t size)
+{
+    return (size + REPORT_ARENA_ALIGNMENT - 1) & ~(size_t)(REPORT_ARENA_ALIGNMENT - 1);
+}
+
+
+
+static T_reportArenaChunk *report_arena_chunk_new(size_t size)
+{
+    const size_t header = report_arena_align(sizeof(T_reportArenaChunk));
+    T_reportArenaChunk *chunk = (T_reportArenaChunk *)malloc(header + size);
+    if (NULL == chunk)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory\n");
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->mem = (char *)chunk + header;
+    return chunk;
+}
+
+
+
+static void report_arena_free(T_reportArena *arena)
+{
+    T_reportArenaChunk *chunk = arena->chunk;
+    while (NULL != chunk)
+    {
+        T_reportArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(arena);
+}
+
+
+
+static void report_arena_free_list(void *list)
+{
+    T_reportArena *arena = (T_reportArena *)list;
+    while (NULL != arena)
+    {
+        T_reportArena *next = arena->next_free;
+        report_arena_free(arena);
+        arena = next;
+    }
+}
+
+
+
+static void report_arena_create_thread_key(void)
+{
+    s_threadFreeListKeyCreated = (0 == pthread_key_create(&s_threadFreeListKey, report_arena_free_list));
+    if (!s_threadFreeListKeyCreated)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": pthread_key_create() error\n");
+    }
+}
+
+
+
+static T_reportArena *report_arena_new(void)
+{
+    T_reportArena *arena = (T_reportArena *)malloc(sizeof(*arena));
+    if (NULL == arena)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory\n");
+        return NULL;
+    }
+
+    arena->first = report_arena_chunk_new(REPORT_ARENA_CHUNK_SIZE);
+    if (NULL == arena->first)
+    {
+        free(arena);
+        return NULL;
+    }
+
+    arena->chunk = arena->first;
+    arena->next_free = NULL;
+    arena->free_count = 0;
+    return arena;
+}
+
+
+
+T_reportArena *report_arena_acquire(void)
+{
+    pthread_once(&s_threadFreeListOnce, report_arena_create_thread_key);
+
+    T_reportArena *arena = NULL;
+    if (s_threadFreeListKeyCreated)
+    {
+        arena = (T_reportArena *)pthread_getspecific(s_threadFreeListKey);
+        if (NULL != arena)
+        {
+            pthread_setspecific(s_threadFreeListKey, arena->next_free);
+        }
+    }
+
+    if (NULL == arena)
+    {
+        pthread_mutex_lock(&s_sharedPoolMutex);
+        arena = s_sharedPool;
+        if (NULL != arena)
+        {
+            s_sharedPool = arena->next_free;
+        }
+        pthread_mutex_unlock(&s_sharedPoolMutex);
+    }
+
+    if (NULL == arena)
+    {
+        return report_arena_new();
+    }
+
+    arena->next_free = NULL;
+    arena->free_count = 0;
+    return arena;
+}
+
+
+
+/*
+ * Frees all chunks but the first one and forgets all allocations
+ */
+static void report_arena_reset(T_reportArena *arena)
+{
+    T_reportArenaChunk *chunk = arena->chunk;
+    while (NULL != chunk)
+    {
+        T_reportArenaChunk *next = chunk->next;
+        if (chunk != arena->first)
+        {
+            free(chunk);
+        }
+        chunk = next;
+    }
+
+    arena->first->next = NULL;
+    arena->first->used = 0;
+    arena->chunk = arena->first;
+}
+
+
+
+void report_arena_release(T_reportArena *arena)
+{
+    if (NULL == arena)
+    {
+        return;
+    }
+
+    report_arena_reset(arena);
+
+    pthread_once(&s_threadFreeListOnce, report_arena_create_thread_key);
+    if (s_threadFreeListKeyCreated)
+    {
+        T_reportArena *list = (T_reportArena *)pthread_getspecific(s_threadFreeListKey);
+        const size_t count = NULL == list ? 0 : list->free_count;
+        if (count < REPORT_ARENA_THREAD_FREE_LIST_LENGTH
+            && 0 == pthread_setspecific(s_threadFreeListKey, arena))
+        {
+            arena->next_free = list;
+            arena->free_count = count + 1;
+            return;
+        }
+    }
+
+    /* The thread only releases arenas, e.g. a reporting thread */
+    pthread_mutex_lock(&s_sharedPoolMutex);
+    const size_t count = NULL == s_sharedPool ? 0 : s_sharedPool->free_count;
+    if (count < REPORT_ARENA_SHARED_POOL_LENGTH)
+    {
+        arena->next_free = s_sharedPool;
+        arena->free_count = count + 1;
+        s_sharedPool = arena;
+        arena = NULL;
+    }
+    pthread_mutex_unlock(&s_sharedPoolMutex);
+
+    if (NULL != arena)
+    {
+        report_arena_free(arena);
+    }
+}
+
+
+
+void report_arena_cleanup(void)
+{
+    pthread_mutex_lock(&s_sharedPoolMutex);
+    T_reportArena *list = s_sharedPool;
+    s_sharedPool = NULL;
+    pthread_mutex_unlock(&s_sharedPoolMutex);
+
+    report_arena_free_list(list);
+}
+
+
+
+void *report_arena_alloc(T_reportArena *arena, size_t size)
+{
+    assert(NULL != arena || !"Cannot allocate from NULL arena");
+
+    size = report_arena_align(size);
+
+    T_reportArenaChunk *chunk = arena->chunk;
+    if (size > chunk->size - chunk->used)
+    {
+        if (size > REPORT_ARENA_CHUNK_SIZE / 2)
+        {   /* a dedicated chunk, the current one is still being filled */
+            chunk = report_arena_chunk_new(size);
+            if (NULL == chunk)
+            {
+                return NULL;
+            }
+
+            chunk->next = arena->chunk->next;
+            arena->chunk->next = chunk;
+        }
+        else
+        {
+            chunk = report_arena_chunk_new(REPORT_ARENA_CHUNK_SIZE);
+            if (NULL == chunk)
+            {
+                return NULL;
+            }
+
+            chunk->next = arena->chunk;
+            arena->chunk = chunk;
+        }
+    }
+
+    void *mem = chunk->mem + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+
+
+char *report_arena_strndup(T_reportArena *arena, const char *str, size_t length)
+{
+    char *copy = (char *)report_arena_alloc(arena, length + 1);
+    if (NULL == copy)
+    {
+        return NULL;
+    }
+
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+
+
+char *report_arena_strdup(T_reportArena *arena, const char *str)
+{
+    return report_arena_strndup(arena, str, strlen(str));
+}
+
+
+
+/*
+ * finito
+ */
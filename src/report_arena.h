@@ -0,0 +1,112 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __REPORT_ARENA_H__
+#define __REPORT_ARENA_H__
+
+
+#include <stddef.h>
+
+
+/*
+ * Memory of a single report released at once
+ *
+ * Allocations are never freed one by one. The whole arena is reset and
+ * recycled when the report is delivered or dropped. An arena is used by one
+ * thread at a time; a queued report may be passed to other thread.
+ */
+typedef struct report_arena T_reportArena;
+
+
+
+/*
+ * Gets an empty arena from the current thread's free list, from the shared
+ * pool or a newly allocated one
+ *
+ * @returns An arena which must be returned by @report_arena_release or NULL
+ *          if memory cannot be allocated
+ */
+T_reportArena *report_arena_acquire(void);
+
+
+
+/*
+ * Releases all memory allocated from the arena and puts the arena to the
+ * current thread's free list
+ *
+ * Keeps only the first chunk of memory, so huge reports do not make idle
+ * arenas huge.
+ *
+ * @param arena Pointer to @report_arena. Accepts NULL
+ */
+void report_arena_release(T_reportArena *arena);
+
+
+
+/*
+ * Frees arenas in the shared pool
+ *
+ * Arenas in free lists of threads are freed when the threads finish.
+ */
+void report_arena_cleanup(void);
+
+
+
+/*
+ * Allocates memory suitably aligned for any type
+ *
+ * @param arena Arena
+ * @param size Number of bytes
+ * @returns Memory valid until the arena is released or NULL if memory cannot
+ *          be allocated
+ */
+void *report_arena_alloc(T_reportArena *arena, size_t size);
+
+
+
+/*
+ * Allocates a copy of a string
+ *
+ * @param arena Arena
+ * @param str Copied string
+ * @returns Copy valid until the arena is released or NULL if memory cannot
+ *          be allocated
+ */
+char *report_arena_strdup(T_reportArena *arena, const char *str);
+
+
+
+/*
+ * Allocates a copy of a string of known length
+ *
+ * @param arena Arena
+ * @param str Copied characters, need not be terminated by '\0'
+ * @param length Number of copied characters
+ * @returns Copy terminated by '\0' valid until the arena is released or NULL
+ *          if memory cannot be allocated
+ */
+char *report_arena_strndup(T_reportArena *arena, const char *str, size_t length);
+
+
+
+#endif // __REPORT_ARENA_H__
+
+
+
+/*
+ * finito
+ */
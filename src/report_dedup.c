@@ -0,0 +1,403 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "report_dedup.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <errno.h>
+#include <assert.h>
+
+
+
+typedef struct report_dedup_entry {
+    uint64_t fingerprint;                  ///< fingerprint of the window
+    void *report;                          ///< held report of the first occurrence or NULL
+    T_reportDedupCounts counts;            ///< occurrence counters
+    struct timespec expires;               ///< monotonic time of closing the window
+    struct report_dedup_entry *chain;      ///< a next entry in the same bucket
+    struct report_dedup_entry *next;       ///< a next opened window or a next free entry
+} T_reportDedupEntry;
+
+
+
+struct report_dedup {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;                ///< signaled when a window is opened or the table is closed
+    pthread_cond_t idle;                   ///< signaled when the consumer left
+    unsigned window_ms;                    ///< length of windows
+    size_t bucket_mask;                    ///< number of buckets - 1
+    T_reportDedupEntry **buckets;          ///< chains of open windows
+    T_reportDedupEntry *oldest;            ///< the window to close first
+    T_reportDedupEntry *newest;            ///< the window opened last
+    T_reportDedupEntry *free_entries;      ///< pool of unused entries
+    T_reportDedupEntry *entries;           ///< memory of all entries
+    size_t consumers;                      ///< number of attached consumers
+    int closed;                            ///< no more occurrences are counted
+};
+
+
+
+T_reportDedup *report_dedup_new(size_t capacity, unsigned window_ms)
+{
+    assert(0 != capacity || !"Cannot use 0 capacity in report dedup");
+
+    T_reportDedup *dedup = (T_reportDedup *)calloc(1, sizeof(*dedup));
+    if (NULL == dedup)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        return NULL;
+    }
+
+    /* at most one half of buckets is used */
+    size_t bucket_count = 1;
+    while (bucket_count < capacity * 2)
+    {
+        bucket_count <<= 1;
+    }
+
+    dedup->buckets = (T_reportDedupEntry **)calloc(bucket_count, sizeof(*dedup->buckets));
+    dedup->entries = (T_reportDedupEntry *)calloc(capacity, sizeof(*dedup->entries));
+    if (NULL == dedup->buckets || NULL == dedup->entries)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        free(dedup->entries);
+        free(dedup->buckets);
+        free(dedup);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        dedup->entries[i].next = dedup->free_entries;
+        dedup->free_entries = dedup->entries + i;
+    }
+
+    dedup->bucket_mask = bucket_count - 1;
+    dedup->window_ms = window_ms;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dedup->changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_init(&dedup->mutex, /*use default attributes*/NULL);
+    pthread_cond_init(&dedup->idle, /*use default attributes*/NULL);
+
+    return dedup;
+}
+
+
+
+void report_dedup_free(T_reportDedup *dedup)
+{
+    if (NULL == dedup)
+    {
+        return;
+    }
+
+    pthread_cond_destroy(&dedup->idle);
+    pthread_cond_destroy(&dedup->changed);
+    pthread_mutex_destroy(&dedup->mutex);
+
+    free(dedup->entries);
+    free(dedup->buckets);
+    free(dedup);
+}
+
+
+
+/*
+ * Adds milliseconds to a time
+ */
+static void report_dedup_add_ms(struct timespec *time, unsigned ms)
+{
+    time->tv_sec += ms / 1000;
+    time->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (time->tv_nsec >= 1000000000L)
+    {
+        time->tv_sec += 1;
+        time->tv_nsec -= 1000000000L;
+    }
+}
+
+
+
+static int report_dedup_expired(const T_reportDedupEntry *entry, const struct timespec *now)
+{
+    return entry->expires.tv_sec < now->tv_sec
+        || (entry->expires.tv_sec == now->tv_sec && entry->expires.tv_nsec <= now->tv_nsec);
+}
+
+
+
+static T_reportDedupEntry **report_dedup_link(T_reportDedup *dedup, uint64_t fingerprint)
+{
+    T_reportDedupEntry **link = dedup->buckets + (size_t)(fingerprint & dedup->bucket_mask);
+    while (NULL != *link && (*link)->fingerprint != fingerprint)
+    {
+        link = &((*link)->chain);
+    }
+
+    return link;
+}
+
+
+
+int report_dedup_occurred(T_reportDedup *dedup, uint64_t fingerprint)
+{
+    assert(NULL != dedup || !"Cannot count an occurrence in NULL dedup");
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    pthread_mutex_lock(&dedup->mutex);
+
+    int retval = 1;
+    if (dedup->closed)
+    {
+        goto report_dedup_occurred_unlock;
+    }
+
+    T_reportDedupEntry **link = report_dedup_link(dedup, fingerprint);
+    if (NULL != *link)
+    {
+        ++(*link)->counts.occurrences;
+        (*link)->counts.last_seen = now;
+        retval = 0;
+        goto report_dedup_occurred_unlock;
+    }
+
+    T_reportDedupEntry *entry = dedup->free_entries;
+    if (NULL == entry)
+    {
+        VERBOSE_PRINT("All deduplication windows are open, not holding %016llx\n", (unsigned long long)fingerprint);
+        goto report_dedup_occurred_unlock;
+    }
+
+    dedup->free_entries = entry->next;
+
+    entry->fingerprint = fingerprint;
+    entry->report = NULL;
+    entry->counts.occurrences = 1;
+    entry->counts.first_seen = now;
+    entry->counts.last_seen = now;
+    clock_gettime(CLOCK_MONOTONIC, &entry->expires);
+    report_dedup_add_ms(&entry->expires, dedup->window_ms);
+
+    entry->chain = NULL;
+    *link = entry;
+
+    entry->next = NULL;
+    if (NULL == dedup->newest)
+    {
+        dedup->oldest = entry;
+        pthread_cond_signal(&dedup->changed);
+    }
+    else
+    {
+        dedup->newest->next = entry;
+    }
+    dedup->newest = entry;
+
+report_dedup_occurred_unlock:
+    pthread_mutex_unlock(&dedup->mutex);
+    return retval;
+}
+
+
+
+int report_dedup_hold(T_reportDedup *dedup, uint64_t fingerprint, void *report)
+{
+    assert(NULL != dedup || !"Cannot hold a report in NULL dedup");
+    assert(NULL != report || !"Cannot hold NULL report");
+
+    pthread_mutex_lock(&dedup->mutex);
+
+    int retval = 1;
+    T_reportDedupEntry *entry = dedup->closed ? NULL : *report_dedup_link(dedup, fingerprint);
+    if (NULL != entry && NULL == entry->report)
+    {
+        entry->report = report;
+        retval = 0;
+    }
+
+    pthread_mutex_unlock(&dedup->mutex);
+    return retval;
+}
+
+
+
+/*
+ * Removes the oldest window from the table
+ */
+static void *report_dedup_take_oldest(T_reportDedup *dedup, T_reportDedupCounts *counts)
+{
+    T_reportDedupEntry *entry = dedup->oldest;
+
+    T_reportDedupEntry **link = report_dedup_link(dedup, entry->fingerprint);
+    assert(entry == *link);
+    *link = entry->chain;
+
+    dedup->oldest = entry->next;
+    if (NULL == dedup->oldest)
+    {
+        dedup->newest = NULL;
+    }
+
+    void *report = entry->report;
+    if (NULL != counts)
+    {
+        *counts = entry->counts;
+    }
+
+    if (NULL == report && entry->counts.occurrences > 1)
+    {
+        VERBOSE_PRINT("Dropping %zu occurrences of %016llx without a report\n", entry->counts.occurrences, (unsigned long long)entry->fingerprint);
+    }
+
+    entry->report = NULL;
+    entry->next = dedup->free_entries;
+    dedup->free_entries = entry;
+
+    return report;
+}
+
+
+
+void *report_dedup_pop_expired(T_reportDedup *dedup, T_reportDedupCounts *counts)
+{
+    assert(NULL != dedup || !"Cannot pop a report from NULL dedup");
+
+    pthread_mutex_lock(&dedup->mutex);
+
+    void *report = NULL;
+    while (NULL == report)
+    {
+        if (NULL == dedup->oldest)
+        {
+            if (dedup->closed)
+            {
+                /* closed and empty, the consumer is leaving */
+                assert(0 != dedup->consumers || !"Pop called by a detached consumer");
+                --dedup->consumers;
+                pthread_cond_broadcast(&dedup->idle);
+                break;
+            }
+
+            pthread_cond_wait(&dedup->changed, &dedup->mutex);
+            continue;
+        }
+
+        if (!dedup->closed)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (!report_dedup_expired(dedup->oldest, &now))
+            {
+                pthread_cond_timedwait(&dedup->changed, &dedup->mutex, &dedup->oldest->expires);
+                continue;
+            }
+        }
+
+        report = report_dedup_take_oldest(dedup, counts);
+    }
+
+    pthread_mutex_unlock(&dedup->mutex);
+    return report;
+}
+
+
+
+void report_dedup_attach(T_reportDedup *dedup)
+{
+    assert(NULL != dedup || !"Cannot attach to NULL dedup");
+
+    pthread_mutex_lock(&dedup->mutex);
+    ++dedup->consumers;
+    pthread_mutex_unlock(&dedup->mutex);
+}
+
+
+
+void report_dedup_detach(T_reportDedup *dedup)
+{
+    assert(NULL != dedup || !"Cannot detach from NULL dedup");
+
+    pthread_mutex_lock(&dedup->mutex);
+    assert(0 != dedup->consumers || !"No consumer is attached");
+    --dedup->consumers;
+    pthread_cond_broadcast(&dedup->idle);
+    pthread_mutex_unlock(&dedup->mutex);
+}
+
+
+
+int report_dedup_close(T_reportDedup *dedup, unsigned timeout_ms)
+{
+    assert(NULL != dedup || !"Cannot close NULL dedup");
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    report_dedup_add_ms(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&dedup->mutex);
+
+    dedup->closed = 1;
+    pthread_cond_broadcast(&dedup->changed);
+
+    int retval = 0;
+    while (0 != dedup->consumers)
+    {
+        if (ETIMEDOUT == pthread_cond_timedwait(&dedup->idle, &dedup->mutex, &deadline))
+        {
+            VERBOSE_PRINT("Timed out while closing the deduplication table\n");
+            retval = 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&dedup->mutex);
+    return retval;
+}
+
+
+
+void *report_dedup_try_pop(T_reportDedup *dedup)
+{
+    assert(NULL != dedup || !"Cannot pop a report from NULL dedup");
+
+    pthread_mutex_lock(&dedup->mutex);
+
+    void *report = NULL;
+    while (NULL == report && NULL != dedup->oldest)
+    {
+        report = report_dedup_take_oldest(dedup, NULL);
+    }
+
+    pthread_mutex_unlock(&dedup->mutex);
+    return report;
+}
+
+
+
+/*
+ * finito
+ */
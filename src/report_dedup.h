@@ -0,0 +1,164 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __REPORT_DEDUP_H__
+#define __REPORT_DEDUP_H__
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+/*
+ * Coalesces repeated exceptions of the whole process into one report
+ *
+ * The first occurrence of a fingerprint opens a window of a fixed length. Its
+ * report is held until the window closes; later occurrences within the window
+ * are only counted. Windows close in the order they were opened and a single
+ * consumer takes the held reports together with their counters.
+ */
+typedef struct report_dedup T_reportDedup;
+
+
+
+/*
+ * Counters of an expired window
+ */
+typedef struct {
+    size_t occurrences;           ///< number of occurrences including the first one
+    struct timespec first_seen;   ///< wall clock time of the first occurrence
+    struct timespec last_seen;    ///< wall clock time of the last occurrence
+} T_reportDedupCounts;
+
+
+
+/*
+ * Initializes a new table
+ *
+ * @param capacity A maximal number of open windows
+ * @param window_ms A length of the windows in milliseconds
+ * @returns Mallocated memory which must be released by @report_dedup_free
+ */
+T_reportDedup *report_dedup_new(size_t capacity, unsigned window_ms);
+
+
+
+/*
+ * Frees table's memory
+ *
+ * Doesn't release memory of held (void *). The table must be closed and
+ * there must be no attached consumer.
+ *
+ * @param dedup Pointer to @report_dedup. Accepts NULL
+ */
+void report_dedup_free(T_reportDedup *dedup);
+
+
+
+/*
+ * Counts an occurrence of a fingerprint
+ *
+ * @param dedup Table
+ * @param fingerprint A non zero fingerprint of the occurrence
+ * @returns Non zero if the occurrence opened a new window and its report is
+ *          to be passed to @report_dedup_hold; 0 if it was counted to an
+ *          open window
+ */
+int report_dedup_occurred(T_reportDedup *dedup, uint64_t fingerprint);
+
+
+
+/*
+ * Holds the report of the occurrence which opened the fingerprint's window
+ *
+ * @param dedup Table
+ * @param fingerprint The fingerprint of the report
+ * @param report A (void *) report, must not be NULL
+ * @returns 0 if the report is held until the window closes; otherwise non zero
+ *          and the caller still owns the report, e.g. the window is already
+ *          closed or the table is closed
+ */
+int report_dedup_hold(T_reportDedup *dedup, uint64_t fingerprint, void *report);
+
+
+
+/*
+ * Registers the consumer
+ *
+ * @param dedup Table
+ */
+void report_dedup_attach(T_reportDedup *dedup);
+
+
+
+/*
+ * Unregisters the consumer which will never call @report_dedup_pop_expired
+ *
+ * @param dedup Table
+ */
+void report_dedup_detach(T_reportDedup *dedup);
+
+
+
+/*
+ * Waits for the oldest window to close and takes its report
+ *
+ * Windows without a held report are dropped. All windows close at once when
+ * the table is closed.
+ *
+ * @param dedup Table
+ * @param counts Set to the counters of the window
+ * @returns The held report or NULL if the table was closed and is empty; the
+ *          consumer is detached in the latter case
+ */
+void *report_dedup_pop_expired(T_reportDedup *dedup, T_reportDedupCounts *counts);
+
+
+
+/*
+ * Stops counting, closes all windows and waits until the consumer takes
+ * their reports
+ *
+ * @param dedup Table
+ * @param timeout_ms A maximal number of milliseconds to wait for the consumer
+ * @returns 0 if the consumer got detached; otherwise non zero and the table
+ *          must not be freed
+ */
+int report_dedup_close(T_reportDedup *dedup, unsigned timeout_ms);
+
+
+
+/*
+ * Takes a held report without waiting
+ *
+ * Useful for releasing reports left in a closed table.
+ *
+ * @param dedup Table
+ * @returns A held report or NULL if there is none
+ */
+void *report_dedup_try_pop(T_reportDedup *dedup);
+
+
+
+#endif // __REPORT_DEDUP_H__
+
+
+
+/*
+ * finito
+ */
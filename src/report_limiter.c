@@ -0,0 +1,210 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "report_limiter.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+
+
+/*
+ * Number of independently locked parts of the limiter, must be a power of 2
+ */
+#define LIMITER_STRIPE_BITS 4
+#define LIMITER_STRIPES (1 << LIMITER_STRIPE_BITS)
+
+/*
+ * Number of signatures remembered by a stripe, must be a power of 2
+ */
+#define LIMITER_STRIPE_SLOTS 64
+
+/*
+ * Number of slots where a signature can be stored
+ */
+#define LIMITER_PROBES 8
+
+/*
+ * Size of a cache line, stripes do not share cache lines
+ */
+#define LIMITER_CACHE_LINE_SIZE 64
+
+
+
+typedef struct {
+    uint64_t signature;               ///< the signature, 0 for an empty slot
+    double tokens;                    ///< number of reports allowed now
+    uint64_t updated;                 ///< when the tokens were refilled [ns]
+    size_t suppressed;                ///< number of occurrences since the last report
+} T_reportLimiterSignature;
+
+
+
+typedef struct {
+    pthread_mutex_t mutex;
+    T_reportLimiterSignature slots[LIMITER_STRIPE_SLOTS];
+} __attribute__ ((aligned (LIMITER_CACHE_LINE_SIZE))) T_reportLimiterStripe;
+
+
+
+struct report_limiter {
+    T_reportLimiterStripe stripes[LIMITER_STRIPES];
+    double rate;                      ///< tokens per nanosecond
+    double burst;                     ///< capacity of the buckets
+};
+
+
+
+static uint64_t report_limiter_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * UINT64_C(1000000000) + (uint64_t)now.tv_nsec;
+}
+
+
+
+T_reportLimiter *report_limiter_new(unsigned rate, unsigned burst)
+{
+    assert(0 != burst || !"Cannot use 0 burst in report limiter");
+
+    T_reportLimiter *limiter = NULL;
+    if (0 != posix_memalign((void **)&limiter, LIMITER_CACHE_LINE_SIZE, sizeof(*limiter)))
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": posix_memalign() error\n");
+        return NULL;
+    }
+
+    memset(limiter, 0, sizeof(*limiter));
+    limiter->rate = rate / 60e9;
+    limiter->burst = burst;
+
+    for (size_t i = 0; i < LIMITER_STRIPES; ++i)
+    {
+        pthread_mutex_init(&limiter->stripes[i].mutex, /*use default attributes*/NULL);
+    }
+
+    return limiter;
+}
+
+
+
+void report_limiter_free(T_reportLimiter *limiter)
+{
+    if (NULL == limiter)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < LIMITER_STRIPES; ++i)
+    {
+        pthread_mutex_destroy(&limiter->stripes[i].mutex);
+    }
+
+    free(limiter);
+}
+
+
+
+/*
+ * Finds the signature's slot or takes a slot for it
+ */
+static T_reportLimiterSignature *report_limiter_find(
+        T_reportLimiter *limiter,
+        T_reportLimiterStripe *stripe,
+        uint64_t signature,
+        uint64_t now)
+{
+    T_reportLimiterSignature *victim = NULL;
+    const size_t first = (size_t)(signature >> LIMITER_STRIPE_BITS);
+    for (size_t i = 0; i < LIMITER_PROBES; ++i)
+    {
+        T_reportLimiterSignature *sig = stripe->slots + ((first + i) & (LIMITER_STRIPE_SLOTS - 1));
+        if (sig->signature == signature)
+        {
+            return sig;
+        }
+
+        /* Prefer an empty slot, then the least recently seen signature */
+        if (NULL == victim || (0 != victim->signature && (0 == sig->signature || sig->updated < victim->updated)))
+        {
+            victim = sig;
+        }
+    }
+
+    if (0 != victim->signature && 0 != victim->suppressed)
+    {
+        VERBOSE_PRINT("Forgetting %zu suppressed reports of %016llx\n", victim->suppressed, (unsigned long long)victim->signature);
+    }
+
+    victim->signature = signature;
+    victim->tokens = limiter->burst;
+    victim->updated = now;
+    victim->suppressed = 0;
+    return victim;
+}
+
+
+
+int report_limiter_acquire(T_reportLimiter *limiter, uint64_t signature, size_t *suppressed)
+{
+    assert(NULL != limiter);
+    assert(0 != signature || !"Cannot use 0 signature in report limiter");
+
+    *suppressed = 0;
+
+    T_reportLimiterStripe *stripe = limiter->stripes + (signature & (LIMITER_STRIPES - 1));
+    const uint64_t now = report_limiter_now();
+
+    pthread_mutex_lock(&stripe->mutex);
+
+    int allowed = 1;
+    T_reportLimiterSignature *sig = report_limiter_find(limiter, stripe, signature, now);
+
+    sig->tokens += (now - sig->updated) * limiter->rate;
+    if (sig->tokens > limiter->burst)
+    {
+        sig->tokens = limiter->burst;
+    }
+    sig->updated = now;
+
+    if (sig->tokens >= 1.0)
+    {
+        sig->tokens -= 1.0;
+        *suppressed = sig->suppressed;
+        sig->suppressed = 0;
+    }
+    else
+    {
+        ++sig->suppressed;
+        allowed = 0;
+    }
+
+    pthread_mutex_unlock(&stripe->mutex);
+    return allowed;
+}
+
+
+
+/*
+ * finito
+ */
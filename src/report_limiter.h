@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __REPORT_LIMITER_H__
+#define __REPORT_LIMITER_H__
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*
+ * Limits the rate of reports of similar exceptions
+ *
+ * Similar exceptions have the same signature, a non zero hash computed by the
+ * caller from the type and the stack of the exception. Every signature has its
+ * own token bucket which is refilled at a constant rate. Occurrences exceeding
+ * the rate are only counted and the count is passed to the next allowed report
+ * of the signature. The limiter remembers a bounded number of signatures; the
+ * least recently seen ones are forgotten.
+ */
+typedef struct report_limiter T_reportLimiter;
+
+
+
+/*
+ * Initializes a new limiter
+ *
+ * @param rate A number of reports of a signature allowed per minute
+ * @param burst A number of reports of a signature allowed at once, at least 1
+ * @returns Mallocated memory which must be released by @report_limiter_free
+ */
+T_reportLimiter *report_limiter_new(unsigned rate, unsigned burst);
+
+
+
+/*
+ * Frees limiter's memory
+ *
+ * @param limiter Pointer to @report_limiter. Accepts NULL
+ */
+void report_limiter_free(T_reportLimiter *limiter);
+
+
+
+/*
+ * Takes a token of the exception's signature
+ *
+ * @param limiter Limiter
+ * @param signature A non zero signature of the exception
+ * @param suppressed Set to a number of occurrences suppressed since the
+ *        previous report of the signature if the report is allowed
+ * @returns Non zero if the exception is to be reported; otherwise 0 and the
+ *          occurrence is counted
+ */
+int report_limiter_acquire(T_reportLimiter *limiter, uint64_t signature, size_t *suppressed);
+
+
+
+#endif // __REPORT_LIMITER_H__
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,363 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "report_queue.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+
+
+
+struct report_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;         ///< signaled when an item is pushed or queue is closed
+    pthread_cond_t not_full;          ///< signaled when an item is popped or queue is closed
+    pthread_cond_t idle;              ///< signaled when a consumer finished an item or left
+    pthread_cond_t turn;              ///< signaled when an item is done
+    T_reportQueueOverflow overflow;   ///< full queue policy
+    size_t capacity;                  ///< capacity of the queue
+    size_t begin;                     ///< points to the oldest item
+    size_t size;                      ///< number of queued items
+    size_t busy;                      ///< number of popped but not done items
+    size_t consumers;                 ///< number of attached consumers
+    size_t popped;                    ///< number of popped items, the next ticket
+    size_t finished;                  ///< number of done items, the ticket allowed to finish
+    size_t dropped;                   ///< number of refused or evicted items
+    int closed;                       ///< no more items are accepted
+    void **mem;                       ///< queue memory
+};
+
+
+
+T_reportQueue *report_queue_new(size_t capacity, T_reportQueueOverflow overflow)
+{
+    assert(0 != capacity || !"Cannot use 0 capacity in report queue");
+
+    T_reportQueue *queue = (T_reportQueue *)calloc(1, sizeof(*queue));
+    if (NULL == queue)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        return NULL;
+    }
+
+    queue->mem = (void **)calloc(capacity, sizeof(*queue->mem));
+    if (NULL == queue->mem)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": calloc() error\n");
+        free(queue);
+        return NULL;
+    }
+
+    queue->capacity = capacity;
+    queue->overflow = overflow;
+
+    pthread_mutex_init(&queue->mutex, /*use default attributes*/NULL);
+    pthread_cond_init(&queue->not_empty, /*use default attributes*/NULL);
+    pthread_cond_init(&queue->not_full, /*use default attributes*/NULL);
+    pthread_cond_init(&queue->idle, /*use default attributes*/NULL);
+    pthread_cond_init(&queue->turn, /*use default attributes*/NULL);
+
+    return queue;
+}
+
+
+
+void report_queue_free(T_reportQueue *queue)
+{
+    if (NULL == queue)
+    {
+        return;
+    }
+
+    pthread_cond_destroy(&queue->turn);
+    pthread_cond_destroy(&queue->idle);
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->mutex);
+
+    free(queue->mem);
+    free(queue);
+}
+
+
+
+/*
+ * Converts a relative timeout to an absolute time suitable for
+ * pthread_cond_timedwait()
+ */
+static void report_queue_deadline(unsigned timeout_ms, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec += 1;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+
+
+static void *report_queue_take_first(T_reportQueue *queue)
+{
+    void *item = queue->mem[queue->begin];
+    queue->mem[queue->begin] = NULL;
+    queue->begin = (queue->begin + 1) % queue->capacity;
+    --queue->size;
+
+    pthread_cond_signal(&queue->not_full);
+    return item;
+}
+
+
+
+int report_queue_push(T_reportQueue *queue, void *item, void **evicted)
+{
+    assert(NULL != queue || !"Cannot push an item to NULL queue");
+    assert(NULL != item || !"Cannot push NULL to a queue");
+
+    *evicted = NULL;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    if (RQ_OVERFLOW_BLOCK == queue->overflow)
+    {
+        while (!queue->closed && queue->size == queue->capacity)
+        {
+            pthread_cond_wait(&queue->not_full, &queue->mutex);
+        }
+    }
+
+    int retval = 1;
+    if (queue->closed)
+    {
+        VERBOSE_PRINT("Cannot push to closed queue\n");
+        goto report_queue_push_unlock;
+    }
+
+    if (queue->size == queue->capacity)
+    {
+        ++queue->dropped;
+
+        if (RQ_OVERFLOW_DROP_NEWEST == queue->overflow)
+        {
+            VERBOSE_PRINT("The queue is full, refusing %p\n", item);
+            goto report_queue_push_unlock;
+        }
+
+        *evicted = report_queue_take_first(queue);
+        VERBOSE_PRINT("The queue is full, evicting %p\n", *evicted);
+    }
+
+    queue->mem[(queue->begin + queue->size) % queue->capacity] = item;
+    ++queue->size;
+    retval = 0;
+
+    pthread_cond_signal(&queue->not_empty);
+
+report_queue_push_unlock:
+    pthread_mutex_unlock(&queue->mutex);
+    return retval;
+}
+
+
+
+void *report_queue_pop(T_reportQueue *queue, size_t *ticket)
+{
+    assert(NULL != queue || !"Cannot pop an item from NULL queue");
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (!queue->closed && 0 == queue->size)
+    {
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    }
+
+    void *item = NULL;
+    if (0 != queue->size)
+    {
+        item = report_queue_take_first(queue);
+        ++queue->busy;
+        *ticket = queue->popped++;
+    }
+    else
+    {
+        /* closed and empty, the consumer is leaving */
+        assert(0 != queue->consumers || !"Pop called by a detached consumer");
+        --queue->consumers;
+        pthread_cond_broadcast(&queue->idle);
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+
+
+void report_queue_attach(T_reportQueue *queue)
+{
+    assert(NULL != queue || !"Cannot attach to NULL queue");
+
+    pthread_mutex_lock(&queue->mutex);
+    ++queue->consumers;
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+
+
+void report_queue_detach(T_reportQueue *queue)
+{
+    assert(NULL != queue || !"Cannot detach from NULL queue");
+
+    pthread_mutex_lock(&queue->mutex);
+    assert(0 != queue->consumers || !"No consumer is attached");
+    --queue->consumers;
+    pthread_cond_broadcast(&queue->idle);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+
+
+void *report_queue_try_pop(T_reportQueue *queue)
+{
+    assert(NULL != queue || !"Cannot pop an item from NULL queue");
+
+    pthread_mutex_lock(&queue->mutex);
+
+    void *item = NULL;
+    if (0 != queue->size)
+    {
+        item = report_queue_take_first(queue);
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+
+
+void report_queue_wait_turn(T_reportQueue *queue, size_t ticket)
+{
+    assert(NULL != queue || !"Cannot wait for a turn in NULL queue");
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->finished != ticket)
+    {
+        pthread_cond_wait(&queue->turn, &queue->mutex);
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+
+
+void report_queue_done(T_reportQueue *queue)
+{
+    assert(NULL != queue || !"Cannot confirm an item of NULL queue");
+
+    pthread_mutex_lock(&queue->mutex);
+
+    assert(0 != queue->busy || !"No item is being processed");
+    --queue->busy;
+    ++queue->finished;
+    pthread_cond_broadcast(&queue->idle);
+    pthread_cond_broadcast(&queue->turn);
+
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+
+
+int report_queue_flush(T_reportQueue *queue, unsigned timeout_ms)
+{
+    assert(NULL != queue || !"Cannot flush NULL queue");
+
+    struct timespec deadline;
+    report_queue_deadline(timeout_ms, &deadline);
+
+    pthread_mutex_lock(&queue->mutex);
+
+    int retval = 0;
+    while (0 != queue->size || 0 != queue->busy)
+    {
+        if (ETIMEDOUT == pthread_cond_timedwait(&queue->idle, &queue->mutex, &deadline))
+        {
+            VERBOSE_PRINT("Timed out while flushing the queue: %zu queued, %zu busy\n", queue->size, queue->busy);
+            retval = 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+    return retval;
+}
+
+
+
+int report_queue_close(T_reportQueue *queue, unsigned timeout_ms)
+{
+    assert(NULL != queue || !"Cannot close NULL queue");
+
+    struct timespec deadline;
+    report_queue_deadline(timeout_ms, &deadline);
+
+    pthread_mutex_lock(&queue->mutex);
+
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+
+    int retval = 0;
+    while (0 != queue->consumers)
+    {
+        if (ETIMEDOUT == pthread_cond_timedwait(&queue->idle, &queue->mutex, &deadline))
+        {
+            VERBOSE_PRINT("Timed out while closing the queue: %zu consumers, %zu busy\n", queue->consumers, queue->busy);
+            retval = 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+    return retval;
+}
+
+
+
+size_t report_queue_dropped(T_reportQueue *queue)
+{
+    assert(NULL != queue || !"Cannot get statistics of NULL queue");
+
+    pthread_mutex_lock(&queue->mutex);
+    const size_t dropped = queue->dropped;
+    pthread_mutex_unlock(&queue->mutex);
+
+    return dropped;
+}
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,186 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __REPORT_QUEUE_H__
+#define __REPORT_QUEUE_H__
+
+
+#include "abrt-checker.h"
+
+#include <stddef.h>
+
+
+/*
+ * Bounded FIFO of (void *) items shared by many producers and consumers
+ */
+typedef struct report_queue T_reportQueue;
+
+
+
+/*
+ * Initializes a new queue
+ *
+ * @param capacity A maximal number of queued items
+ * @param overflow What to do when an item is pushed to a full queue
+ * @returns Mallocated memory which must be released by @report_queue_free
+ */
+T_reportQueue *report_queue_new(size_t capacity, T_reportQueueOverflow overflow);
+
+
+
+/*
+ * Frees queue's memory
+ *
+ * Doesn't release memory of queued (void *). The queue must be closed and
+ * there must be no attached consumer.
+ *
+ * @param queue Pointer to @report_queue. Accepts NULL
+ */
+void report_queue_free(T_reportQueue *queue);
+
+
+
+/*
+ * Appends an item to the end of the queue
+ *
+ * If the queue is full, the overflow policy decides whether the caller waits
+ * for a free slot, the pushed item is refused or the oldest item is evicted.
+ *
+ * @param queue Queue
+ * @param item A (void *) item, must not be NULL
+ * @param evicted Set to the evicted item or to NULL. The caller owns it.
+ * @returns 0 if the item was queued; otherwise non zero and the caller still
+ *          owns the item
+ */
+int report_queue_push(T_reportQueue *queue, void *item, void **evicted);
+
+
+
+/*
+ * Registers a new consumer
+ *
+ * The consumer is detached when it gets NULL from @report_queue_pop.
+ *
+ * @param queue Queue
+ */
+void report_queue_attach(T_reportQueue *queue);
+
+
+
+/*
+ * Unregisters a consumer which will never call @report_queue_pop
+ *
+ * @param queue Queue
+ */
+void report_queue_detach(T_reportQueue *queue);
+
+
+
+/*
+ * Removes the first item from the queue
+ *
+ * Waits for an item if the queue is empty. Every returned item must be
+ * confirmed by @report_queue_done once it is processed. Must be called only
+ * by an attached consumer.
+ *
+ * @param queue Queue
+ * @param ticket Set to the position of the item in the order of popping
+ * @returns The first item or NULL if the queue was closed and is empty; the
+ *          consumer is detached in the latter case
+ */
+void *report_queue_pop(T_reportQueue *queue, size_t *ticket);
+
+
+
+/*
+ * Waits until all items popped before the item with given ticket are done
+ *
+ * Allows several consumers to process items in parallel and to finish them in
+ * the order they were pushed. Every popped item must be confirmed by
+ * @report_queue_done, otherwise later items wait forever.
+ *
+ * @param queue Queue
+ * @param ticket A ticket got from @report_queue_pop
+ */
+void report_queue_wait_turn(T_reportQueue *queue, size_t ticket);
+
+
+
+/*
+ * Confirms that an item returned by @report_queue_pop was processed
+ *
+ * @param queue Queue
+ */
+void report_queue_done(T_reportQueue *queue);
+
+
+
+/*
+ * Waits until all queued items are processed
+ *
+ * @param queue Queue
+ * @param timeout_ms A maximal number of milliseconds to wait
+ * @returns 0 if the queue is empty and no item is being processed; otherwise
+ *          non zero
+ */
+int report_queue_flush(T_reportQueue *queue, unsigned timeout_ms);
+
+
+
+/*
+ * Refuses all further items and wakes up all consumers
+ *
+ * Consumers get remaining items and then NULL from @report_queue_pop.
+ *
+ * @param queue Queue
+ * @param timeout_ms A maximal number of milliseconds to wait for consumers
+ * @returns 0 if all consumers got detached; otherwise non zero and the queue
+ *          must not be freed
+ */
+int report_queue_close(T_reportQueue *queue, unsigned timeout_ms);
+
+
+
+/*
+ * Removes the first item from the queue without waiting
+ *
+ * Useful for releasing items left in a closed queue. Returned items are not
+ * confirmed by @report_queue_done.
+ *
+ * @param queue Queue
+ * @returns The first item or NULL if the queue is empty
+ */
+void *report_queue_try_pop(T_reportQueue *queue);
+
+
+
+/*
+ * Gets a number of items refused or evicted because of a full queue
+ *
+ * @param queue Queue
+ */
+size_t report_queue_dropped(T_reportQueue *queue);
+
+
+
+#endif // __REPORT_QUEUE_H__
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,341 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "string_builder.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+
+/*
+ * Initial size of builder's memory
+ */
+#define STRING_BUILDER_INITIAL_CAPACITY 1024
+
+/*
+ * Larger memory of thread's builder is released when the builder is reused
+ */
+#define STRING_BUILDER_RETAINED_CAPACITY (64 * 1024)
+
+
+
+struct string_builder {
+    char *mem;          ///< built string
+    size_t length;      ///< length of built string
+    size_t capacity;    ///< size of memory including space for '\0'
+    size_t limit;       ///< maximal length of built string
+};
+
+
+
+static pthread_key_t s_threadBuilderKey;
+
+static pthread_once_t s_threadBuilderOnce = PTHREAD_ONCE_INIT;
+
+static int s_threadBuilderKeyCreated;
+
+
+
+T_stringBuilder *string_builder_new(size_t limit)
+{
+    T_stringBuilder *builder = (T_stringBuilder *)malloc(sizeof(*builder));
+    if (NULL == builder)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc() error\n");
+        return NULL;
+    }
+
+    builder->capacity = limit < STRING_BUILDER_INITIAL_CAPACITY ? limit + 1 : STRING_BUILDER_INITIAL_CAPACITY;
+    builder->mem = (char *)malloc(builder->capacity);
+    if (NULL == builder->mem)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc() error\n");
+        free(builder);
+        return NULL;
+    }
+
+    builder->mem[0] = '\0';
+    builder->length = 0;
+    builder->limit = limit;
+
+    return builder;
+}
+
+
+
+void string_builder_free(T_stringBuilder *builder)
+{
+    if (NULL == builder)
+    {
+        return;
+    }
+
+    free(builder->mem);
+    free(builder);
+}
+
+
+
+static void string_builder_thread_destructor(void *builder)
+{
+    string_builder_free((T_stringBuilder *)builder);
+}
+
+
+
+static void string_builder_create_thread_key(void)
+{
+    s_threadBuilderKeyCreated = (0 == pthread_key_create(&s_threadBuilderKey, string_builder_thread_destructor));
+    if (!s_threadBuilderKeyCreated)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": pthread_key_create() error\n");
+    }
+}
+
+
+
+T_stringBuilder *string_builder_get_thread_builder(size_t limit)
+{
+    pthread_once(&s_threadBuilderOnce, string_builder_create_thread_key);
+    if (!s_threadBuilderKeyCreated)
+    {
+        return NULL;
+    }
+
+    T_stringBuilder *builder = (T_stringBuilder *)pthread_getspecific(s_threadBuilderKey);
+    if (NULL != builder && builder->capacity > STRING_BUILDER_RETAINED_CAPACITY)
+    {
+        VERBOSE_PRINT("Releasing %zu bytes of thread's string builder\n", builder->capacity);
+        string_builder_free(builder);
+        builder = NULL;
+    }
+
+    if (NULL == builder)
+    {
+        builder = string_builder_new(limit);
+        if (NULL == builder)
+        {
+            return NULL;
+        }
+
+        if (0 != pthread_setspecific(s_threadBuilderKey, builder))
+        {
+            fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": pthread_setspecific() error\n");
+            string_builder_free(builder);
+            return NULL;
+        }
+    }
+
+    builder->mem[0] = '\0';
+    builder->length = 0;
+    builder->limit = limit;
+
+    return builder;
+}
+
+
+
+size_t string_builder_length(const T_stringBuilder *builder)
+{
+    assert(NULL != builder || !"Cannot get length of NULL builder");
+
+    return builder->length;
+}
+
+
+
+const char *string_builder_cstr(const T_stringBuilder *builder)
+{
+    assert(NULL != builder || !"Cannot get string of NULL builder");
+
+    return builder->mem;
+}
+
+
+
+char *string_builder_strdup(const T_stringBuilder *builder)
+{
+    assert(NULL != builder || !"Cannot copy string of NULL builder");
+
+    char *copy = (char *)malloc(builder->length + 1);
+    if (NULL == copy)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": malloc(): out of memory\n");
+        return NULL;
+    }
+
+    memcpy(copy, builder->mem, builder->length + 1);
+    return copy;
+}
+
+
+
+void string_builder_truncate(T_stringBuilder *builder, size_t length)
+{
+    assert(NULL != builder || !"Cannot truncate NULL builder");
+    assert(length <= builder->length || !"Cannot truncate to a greater length");
+
+    builder->length = length;
+    builder->mem[length] = '\0';
+}
+
+
+
+/*
+ * Makes sure that a number of characters can be appended
+ *
+ * @returns 0 on success; non zero if the limit would be exceeded or memory
+ *          cannot be allocated
+ */
+static int string_builder_reserve(T_stringBuilder *builder, size_t length)
+{
+    if (length > builder->limit - builder->length)
+    {
+        VERBOSE_PRINT("The string builder reached its limit of %zu characters\n", builder->limit);
+        return 1;
+    }
+
+    const size_t required = builder->length + length + 1;
+    if (required <= builder->capacity)
+    {
+        return 0;
+    }
+
+    size_t capacity = builder->capacity;
+    while (capacity < required)
+    {
+        capacity *= 2;
+    }
+
+    if (capacity > builder->limit + 1)
+    {
+        capacity = builder->limit + 1;
+    }
+
+    char *mem = (char *)realloc(builder->mem, capacity);
+    if (NULL == mem)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": realloc(): out of memory\n");
+        return 1;
+    }
+
+    builder->mem = mem;
+    builder->capacity = capacity;
+    return 0;
+}
+
+
+
+int string_builder_append_n(T_stringBuilder *builder, const char *str, size_t length)
+{
+    assert(NULL != builder || !"Cannot append to NULL builder");
+
+    if (string_builder_reserve(builder, length))
+    {
+        return 1;
+    }
+
+    memcpy(builder->mem + builder->length, str, length);
+    builder->length += length;
+    builder->mem[builder->length] = '\0';
+    return 0;
+}
+
+
+
+int string_builder_append(T_stringBuilder *builder, const char *str)
+{
+    return string_builder_append_n(builder, str, strlen(str));
+}
+
+
+
+int string_builder_printf(T_stringBuilder *builder, const char *format, ...)
+{
+    assert(NULL != builder || !"Cannot append to NULL builder");
+
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(builder->mem + builder->length, builder->capacity - builder->length, format, args);
+    va_end(args);
+
+    if (length < 0)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": vsnprintf() failed\n");
+        builder->mem[builder->length] = '\0';
+        return 1;
+    }
+
+    if ((size_t)length < builder->capacity - builder->length && (size_t)length <= builder->limit - builder->length)
+    {   /* the common case, the text fit the already allocated memory */
+        builder->length += length;
+        return 0;
+    }
+
+    /* remove the partially printed text */
+    builder->mem[builder->length] = '\0';
+
+    if (string_builder_reserve(builder, (size_t)length))
+    {
+        return 1;
+    }
+
+    va_start(args, format);
+    vsnprintf(builder->mem + builder->length, builder->capacity - builder->length, format, args);
+    va_end(args);
+
+    builder->length += length;
+    return 0;
+}
+
+
+
+int string_builder_append_jstring(T_stringBuilder *builder, JNIEnv *jni_env, jstring string)
+{
+    assert(NULL != builder || !"Cannot append to NULL builder");
+
+    const jsize utf_length = (*jni_env)->GetStringUTFLength(jni_env, string);
+    const jsize length = (*jni_env)->GetStringLength(jni_env, string);
+
+    if (string_builder_reserve(builder, (size_t)utf_length))
+    {
+        return 1;
+    }
+
+    (*jni_env)->GetStringUTFRegion(jni_env, string, 0, length, builder->mem + builder->length);
+    if ((*jni_env)->ExceptionCheck(jni_env))
+    {
+        (*jni_env)->ExceptionClear(jni_env);
+        builder->mem[builder->length] = '\0';
+        return 1;
+    }
+
+    builder->length += utf_length;
+    builder->mem[builder->length] = '\0';
+    return 0;
+}
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,169 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __STRING_BUILDER_H__
+#define __STRING_BUILDER_H__
+
+
+
+/*
+ * JNI types
+ */
+#include <jni.h>
+
+#include <stddef.h>
+
+
+
+/*
+ * Growable '\0' terminated string with a limit of its length
+ *
+ * Appending never truncates the appended text: either the whole text is
+ * appended or nothing is appended and the function reports that the limit
+ * was reached.
+ */
+typedef struct string_builder T_stringBuilder;
+
+
+
+/*
+ * Initializes a new empty builder
+ *
+ * @param limit A maximal length of built string without the terminating '\0'
+ * @returns Mallocated memory which must be released by @string_builder_free
+ */
+T_stringBuilder *string_builder_new(size_t limit);
+
+
+
+/*
+ * Frees builder's memory
+ *
+ * @param builder Pointer to @string_builder. Accepts NULL
+ */
+void string_builder_free(T_stringBuilder *builder);
+
+
+
+/*
+ * Gets an empty builder owned by the calling thread
+ *
+ * The builder's memory is reused by following calls from the same thread and
+ * it is released when the thread exits, so the builder must not be freed nor
+ * used after next call of this function.
+ *
+ * @param limit A maximal length of built string without the terminating '\0'
+ * @returns The builder or NULL if it cannot be created
+ */
+T_stringBuilder *string_builder_get_thread_builder(size_t limit);
+
+
+
+/*
+ * Gets the length of built string
+ *
+ * @param builder Builder
+ */
+size_t string_builder_length(const T_stringBuilder *builder);
+
+
+
+/*
+ * Gets built string
+ *
+ * @param builder Builder
+ * @returns '\0' terminated string valid until the next modification
+ */
+const char *string_builder_cstr(const T_stringBuilder *builder);
+
+
+
+/*
+ * Copies built string to a new memory of the exact size
+ *
+ * @param builder Builder
+ * @returns Mallocated memory or NULL if memory cannot be allocated
+ */
+char *string_builder_strdup(const T_stringBuilder *builder);
+
+
+
+/*
+ * Shortens built string
+ *
+ * Useful for removing partially appended parts of text.
+ *
+ * @param builder Builder
+ * @param length New length, must not be greater than the current length
+ */
+void string_builder_truncate(T_stringBuilder *builder, size_t length);
+
+
+
+/*
+ * Appends a number of characters
+ *
+ * @param builder Builder
+ * @param str Appended characters
+ * @param length A number of appended characters
+ * @returns 0 if the characters were appended; otherwise non zero and the
+ *          builder is not changed
+ */
+int string_builder_append_n(T_stringBuilder *builder, const char *str, size_t length);
+
+
+
+/*
+ * Appends a '\0' terminated string
+ *
+ * @returns See @string_builder_append_n
+ */
+int string_builder_append(T_stringBuilder *builder, const char *str);
+
+
+
+/*
+ * Appends a formatted string
+ *
+ * @returns See @string_builder_append_n
+ */
+int string_builder_printf(T_stringBuilder *builder, const char *format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+
+
+/*
+ * Appends contents of a java.lang.String
+ *
+ * Copies modified UTF-8 characters directly to the builder's memory.
+ *
+ * @param builder Builder
+ * @param jni_env JNI environment of the calling thread
+ * @param string A java.lang.String object
+ * @returns See @string_builder_append_n
+ */
+int string_builder_append_jstring(T_stringBuilder *builder, JNIEnv *jni_env, jstring string);
+
+
+
+#endif // __STRING_BUILDER_H__
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,450 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "uncaught_handler.h"
+#include "abrt-checker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+
+
+#define HANDLER_CLASS_NAME "com/redhat/abrt/UncaughtExceptionHandler"
+#define HANDLER_INTERFACE_NAME "java/lang/Thread$UncaughtExceptionHandler"
+#define UNCAUGHT_EXCEPTION_METHOD "uncaughtException"
+#define UNCAUGHT_EXCEPTION_SIGNATURE "(Ljava/lang/Thread;Ljava/lang/Throwable;)V"
+
+/*
+ * Size of the buffer the handler's class file is written to
+ */
+#define CLASS_FILE_CAPACITY 512
+
+/*
+ * Java 5 class files need no stack map frames
+ */
+#define CLASS_FILE_MAJOR_VERSION 49
+
+/*
+ * Access flags and constant pool tags from The Java Virtual Machine
+ * Specification
+ */
+#define ACC_PUBLIC 0x0001
+#define ACC_FINAL  0x0010
+#define ACC_SUPER  0x0020
+#define ACC_NATIVE 0x0100
+
+#define CONSTANT_Utf8  1
+#define CONSTANT_Class 7
+
+
+
+/*
+ * Class file being written, bytes exceeding the capacity are only counted
+ */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} T_classFile;
+
+
+
+typedef struct {
+    T_uncaughtHandlerCallback callback;     ///< the agent's callback, NULL until the handler is installed
+    jobject previous;                       ///< global reference to the replaced default handler or NULL
+    jmethodID uncaught_exception;           ///< void UncaughtExceptionHandler.uncaughtException(Thread, Throwable)
+    jclass thread_death_class;              ///< java.lang.ThreadDeath
+    jmethodID thread_get_name;              ///< String Thread.getName()
+    jclass system_class;                    ///< java.lang.System
+    jfieldID system_err;                    ///< PrintStream System.err
+    jmethodID print_stream_print;           ///< void PrintStream.print(String)
+    jmethodID throwable_print_stack_trace;  ///< void Throwable.printStackTrace(PrintStream)
+} T_uncaughtHandler;
+
+
+
+static T_uncaughtHandler s_uncaughtHandler;
+
+
+
+static void class_file_u1(T_classFile *class_file, unsigned value)
+{
+    if (class_file->size < class_file->capacity)
+    {
+        class_file->data[class_file->size] = (unsigned char)value;
+    }
+
+    ++class_file->size;
+}
+
+
+
+static void class_file_u2(T_classFile *class_file, unsigned value)
+{
+    class_file_u1(class_file, (value >> 8) & 0xFF);
+    class_file_u1(class_file, value & 0xFF);
+}
+
+
+
+static void class_file_u4(T_classFile *class_file, unsigned long value)
+{
+    class_file_u2(class_file, (value >> 16) & 0xFFFF);
+    class_file_u2(class_file, value & 0xFFFF);
+}
+
+
+
+/*
+ * Writes a CONSTANT_Utf8 entry, the names are ASCII hence modified UTF-8
+ */
+static void class_file_utf8(T_classFile *class_file, const char *str)
+{
+    const size_t len = strlen(str);
+    class_file_u1(class_file, CONSTANT_Utf8);
+    class_file_u2(class_file, (unsigned)len);
+    for (size_t i = 0; i < len; ++i)
+    {
+        class_file_u1(class_file, (unsigned char)str[i]);
+    }
+}
+
+
+
+static void class_file_class(T_classFile *class_file, unsigned name_index)
+{
+    class_file_u1(class_file, CONSTANT_Class);
+    class_file_u2(class_file, name_index);
+}
+
+
+
+/*
+ * Writes the class file of
+ *
+ *   public final class com.redhat.abrt.UncaughtExceptionHandler
+ *           implements Thread.UncaughtExceptionHandler
+ *   {
+ *       public native void uncaughtException(Thread thread, Throwable exception);
+ *   }
+ *
+ * The class has no constructor, its only instance is created by AllocObject().
+ *
+ * @returns Size of the class file or 0 if it does not fit into the buffer
+ */
+static size_t uncaught_handler_write_class_file(unsigned char *buffer, size_t capacity)
+{
+    T_classFile class_file = { .data = buffer, .size = 0, .capacity = capacity };
+
+    class_file_u4(&class_file, 0xCAFEBABEUL);
+    class_file_u2(&class_file, /*minor version*/0);
+    class_file_u2(&class_file, CLASS_FILE_MAJOR_VERSION);
+
+    /* The constant pool is indexed from 1 */
+    class_file_u2(&class_file, /*constant pool count*/9);
+    class_file_class(&class_file, 2);                               /* #1 */
+    class_file_utf8(&class_file, HANDLER_CLASS_NAME);               /* #2 */
+    class_file_class(&class_file, 4);                               /* #3 */
+    class_file_utf8(&class_file, "java/lang/Object");               /* #4 */
+    class_file_class(&class_file, 6);                               /* #5 */
+    class_file_utf8(&class_file, HANDLER_INTERFACE_NAME);           /* #6 */
+    class_file_utf8(&class_file, UNCAUGHT_EXCEPTION_METHOD);        /* #7 */
+    class_file_utf8(&class_file, UNCAUGHT_EXCEPTION_SIGNATURE);     /* #8 */
+
+    class_file_u2(&class_file, ACC_PUBLIC | ACC_FINAL | ACC_SUPER);
+    class_file_u2(&class_file, /*this class*/1);
+    class_file_u2(&class_file, /*super class*/3);
+    class_file_u2(&class_file, /*interfaces count*/1);
+    class_file_u2(&class_file, /*Thread.UncaughtExceptionHandler*/5);
+    class_file_u2(&class_file, /*fields count*/0);
+
+    class_file_u2(&class_file, /*methods count*/1);
+    class_file_u2(&class_file, ACC_PUBLIC | ACC_NATIVE);
+    class_file_u2(&class_file, /*name*/7);
+    class_file_u2(&class_file, /*descriptor*/8);
+    class_file_u2(&class_file, /*attributes count*/0);
+
+    class_file_u2(&class_file, /*attributes count*/0);
+
+    return class_file.size <= class_file.capacity ? class_file.size : 0;
+}
+
+
+
+/*
+ * Prints an uncaught exception the same way as ThreadGroup.uncaughtException()
+ *
+ * Exceptions thrown by Java methods are left pending, the same as if the
+ * handler was written in Java.
+ */
+static void uncaught_handler_print(JNIEnv *jni_env, jobject thread, jthrowable exception)
+{
+    const T_uncaughtHandler *handler = &s_uncaughtHandler;
+
+    if ((*jni_env)->IsInstanceOf(jni_env, exception, handler->thread_death_class))
+    {
+        return;
+    }
+
+    jobject err = (*jni_env)->GetStaticObjectField(jni_env, handler->system_class, handler->system_err);
+    if (NULL == err)
+    {
+        return;
+    }
+
+    jstring name = (jstring)(*jni_env)->CallObjectMethod(jni_env, thread, handler->thread_get_name);
+    if ((*jni_env)->ExceptionCheck(jni_env) || NULL == name)
+    {
+        return;
+    }
+
+    const char *name_utf = (*jni_env)->GetStringUTFChars(jni_env, name, NULL);
+    if (NULL == name_utf)
+    {
+        return;
+    }
+
+    char *header = NULL;
+    const int failed = -1 == asprintf(&header, "Exception in thread \"%s\" ", name_utf);
+    (*jni_env)->ReleaseStringUTFChars(jni_env, name, name_utf);
+    if (failed)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": asprintf(): out of memory\n");
+        return;
+    }
+
+    jstring header_str = (*jni_env)->NewStringUTF(jni_env, header);
+    free(header);
+    if (NULL == header_str)
+    {
+        return;
+    }
+
+    (*jni_env)->CallVoidMethod(jni_env, err, handler->print_stream_print, header_str);
+    if (!(*jni_env)->ExceptionCheck(jni_env))
+    {
+        (*jni_env)->CallVoidMethod(jni_env, exception, handler->throwable_print_stack_trace, err);
+    }
+}
+
+
+
+/*
+ * Native implementation of UncaughtExceptionHandler.uncaughtException()
+ */
+static void JNICALL uncaught_handler_uncaught_exception(
+        JNIEnv *jni_env,
+        jobject this __UNUSED_VAR,
+        jobject thread,
+        jthrowable exception)
+{
+    const T_uncaughtHandler *handler = &s_uncaughtHandler;
+
+    if (NULL != exception)
+    {
+        handler->callback(jni_env, thread, exception);
+    }
+
+    if (NULL != handler->previous)
+    {   /* JVM ignores exceptions thrown by the handler */
+        (*jni_env)->CallVoidMethod(jni_env, handler->previous, handler->uncaught_exception, thread, exception);
+    }
+    else if (NULL != exception)
+    {
+        uncaught_handler_print(jni_env, thread, exception);
+    }
+}
+
+
+
+/*
+ * Returns non zero and clears the pending exception if a JNI function failed
+ */
+static int uncaught_handler_failed(JNIEnv *jni_env, const void *result, const char *what)
+{
+    if ((*jni_env)->ExceptionCheck(jni_env))
+    {
+#ifdef VERBOSE
+        (*jni_env)->ExceptionDescribe(jni_env);
+#endif
+        (*jni_env)->ExceptionClear(jni_env);
+        result = NULL;
+    }
+
+    if (NULL == result)
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": Cannot get %s\n", what);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+int uncaught_handler_install(JNIEnv *jni_env, T_uncaughtHandlerCallback callback)
+{
+    T_uncaughtHandler *handler = &s_uncaughtHandler;
+    assert(NULL == handler->callback || !"The uncaught exception handler is already installed");
+
+    int retval = 1;
+    T_uncaughtHandler resolved = { .callback = callback };
+    jclass thread_class = NULL;
+    jclass interface_class = NULL;
+    jclass print_stream_class = NULL;
+    jclass throwable_class = NULL;
+    jclass handler_class = NULL;
+    jobject instance = NULL;
+    jmethodID get_default = NULL;
+    jmethodID set_default = NULL;
+
+    thread_class = (*jni_env)->FindClass(jni_env, "java/lang/Thread");
+    if (uncaught_handler_failed(jni_env, thread_class, "java.lang.Thread"))
+        goto uncaught_handler_install_cleanup;
+
+    get_default = (*jni_env)->GetStaticMethodID(jni_env, thread_class, "getDefaultUncaughtExceptionHandler", "()L"HANDLER_INTERFACE_NAME";");
+    if (uncaught_handler_failed(jni_env, get_default, "Thread.getDefaultUncaughtExceptionHandler()"))
+        goto uncaught_handler_install_cleanup;
+
+    set_default = (*jni_env)->GetStaticMethodID(jni_env, thread_class, "setDefaultUncaughtExceptionHandler", "(L"HANDLER_INTERFACE_NAME";)V");
+    if (uncaught_handler_failed(jni_env, set_default, "Thread.setDefaultUncaughtExceptionHandler()"))
+        goto uncaught_handler_install_cleanup;
+
+    resolved.thread_get_name = (*jni_env)->GetMethodID(jni_env, thread_class, "getName", "()Ljava/lang/String;");
+    if (uncaught_handler_failed(jni_env, resolved.thread_get_name, "Thread.getName()"))
+        goto uncaught_handler_install_cleanup;
+
+    interface_class = (*jni_env)->FindClass(jni_env, HANDLER_INTERFACE_NAME);
+    if (uncaught_handler_failed(jni_env, interface_class, "java.lang.Thread.UncaughtExceptionHandler"))
+        goto uncaught_handler_install_cleanup;
+
+    resolved.uncaught_exception = (*jni_env)->GetMethodID(jni_env, interface_class, UNCAUGHT_EXCEPTION_METHOD, UNCAUGHT_EXCEPTION_SIGNATURE);
+    if (uncaught_handler_failed(jni_env, resolved.uncaught_exception, "UncaughtExceptionHandler.uncaughtException()"))
+        goto uncaught_handler_install_cleanup;
+
+    print_stream_class = (*jni_env)->FindClass(jni_env, "java/io/PrintStream");
+    if (uncaught_handler_failed(jni_env, print_stream_class, "java.io.PrintStream"))
+        goto uncaught_handler_install_cleanup;
+
+    resolved.print_stream_print = (*jni_env)->GetMethodID(jni_env, print_stream_class, "print", "(Ljava/lang/String;)V");
+    if (uncaught_handler_failed(jni_env, resolved.print_stream_print, "PrintStream.print()"))
+        goto uncaught_handler_install_cleanup;
+
+    throwable_class = (*jni_env)->FindClass(jni_env, "java/lang/Throwable");
+    if (uncaught_handler_failed(jni_env, throwable_class, "java.lang.Throwable"))
+        goto uncaught_handler_install_cleanup;
+
+    resolved.throwable_print_stack_trace = (*jni_env)->GetMethodID(jni_env, throwable_class, "printStackTrace", "(Ljava/io/PrintStream;)V");
+    if (uncaught_handler_failed(jni_env, resolved.throwable_print_stack_trace, "Throwable.printStackTrace()"))
+        goto uncaught_handler_install_cleanup;
+
+    resolved.system_class = (*jni_env)->FindClass(jni_env, "java/lang/System");
+    if (uncaught_handler_failed(jni_env, resolved.system_class, "java.lang.System"))
+        goto uncaught_handler_install_cleanup;
+
+    resolved.system_err = (*jni_env)->GetStaticFieldID(jni_env, resolved.system_class, "err", "Ljava/io/PrintStream;");
+    if (uncaught_handler_failed(jni_env, resolved.system_err, "System.err"))
+        goto uncaught_handler_install_cleanup;
+
+    resolved.thread_death_class = (*jni_env)->FindClass(jni_env, "java/lang/ThreadDeath");
+    if (uncaught_handler_failed(jni_env, resolved.thread_death_class, "java.lang.ThreadDeath"))
+        goto uncaught_handler_install_cleanup;
+
+    unsigned char class_file[CLASS_FILE_CAPACITY];
+    const size_t class_file_size = uncaught_handler_write_class_file(class_file, sizeof(class_file));
+    assert(0 != class_file_size || !"The class file of the handler does not fit into the buffer");
+
+    /* Defined by the bootstrap class loader, the same as the interface */
+    handler_class = (*jni_env)->DefineClass(jni_env, HANDLER_CLASS_NAME, /*bootstrap*/NULL, (const jbyte *)class_file, (jsize)class_file_size);
+    if (uncaught_handler_failed(jni_env, handler_class, "the class of the handler"))
+        goto uncaught_handler_install_cleanup;
+
+    const JNINativeMethod native_method = {
+        .name = UNCAUGHT_EXCEPTION_METHOD,
+        .signature = UNCAUGHT_EXCEPTION_SIGNATURE,
+        .fnPtr = (void *)&uncaught_handler_uncaught_exception,
+    };
+
+    if (0 != (*jni_env)->RegisterNatives(jni_env, handler_class, &native_method, 1))
+    {
+        uncaught_handler_failed(jni_env, NULL, "the native method of the handler");
+        goto uncaught_handler_install_cleanup;
+    }
+
+    instance = (*jni_env)->AllocObject(jni_env, handler_class);
+    if (uncaught_handler_failed(jni_env, instance, "an instance of the handler"))
+        goto uncaught_handler_install_cleanup;
+
+    jobject previous = (*jni_env)->CallStaticObjectMethod(jni_env, thread_class, get_default);
+    if ((*jni_env)->ExceptionCheck(jni_env))
+    {
+        uncaught_handler_failed(jni_env, NULL, "the default uncaught exception handler");
+        goto uncaught_handler_install_cleanup;
+    }
+
+    /* Only global references are kept */
+    resolved.system_class = (jclass)(*jni_env)->NewGlobalRef(jni_env, resolved.system_class);
+    resolved.thread_death_class = (jclass)(*jni_env)->NewGlobalRef(jni_env, resolved.thread_death_class);
+    resolved.previous = NULL == previous ? NULL : (*jni_env)->NewGlobalRef(jni_env, previous);
+    if (NULL == resolved.system_class || NULL == resolved.thread_death_class
+        || (NULL != previous && NULL == resolved.previous))
+    {
+        fprintf(stderr, __FILE__ ":" STRINGIZE(__LINE__) ": Cannot create global references of the handler\n");
+        goto uncaught_handler_install_release;
+    }
+
+    /* The handler may be called by another thread as soon as it is set */
+    *handler = resolved;
+
+    (*jni_env)->CallStaticVoidMethod(jni_env, thread_class, set_default, instance);
+    if (!uncaught_handler_failed(jni_env, instance, "the permission to set the default uncaught exception handler"))
+    {
+        VERBOSE_PRINT("Installed the default uncaught exception handler\n");
+        retval = 0;
+        goto uncaught_handler_install_cleanup;
+    }
+
+    /* The handler was not set and will never be called */
+    memset(handler, 0, sizeof(*handler));
+
+uncaught_handler_install_release:
+    if (NULL != resolved.system_class)
+        (*jni_env)->DeleteGlobalRef(jni_env, resolved.system_class);
+    if (NULL != resolved.thread_death_class)
+        (*jni_env)->DeleteGlobalRef(jni_env, resolved.thread_death_class);
+    if (NULL != resolved.previous)
+        (*jni_env)->DeleteGlobalRef(jni_env, resolved.previous);
+
+uncaught_handler_install_cleanup:
+    /* Local references of failed resolutions are NULL */
+    (*jni_env)->DeleteLocalRef(jni_env, instance);
+    (*jni_env)->DeleteLocalRef(jni_env, handler_class);
+    (*jni_env)->DeleteLocalRef(jni_env, throwable_class);
+    (*jni_env)->DeleteLocalRef(jni_env, print_stream_class);
+    (*jni_env)->DeleteLocalRef(jni_env, interface_class);
+    (*jni_env)->DeleteLocalRef(jni_env, thread_class);
+
+    return retval;
+}
+
+
+
+/*
+ * finito
+ */
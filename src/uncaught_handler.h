@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef __UNCAUGHT_HANDLER_H__
+#define __UNCAUGHT_HANDLER_H__
+
+
+
+/*
+ * JNI types
+ */
+#include <jni.h>
+
+
+
+/*
+ * Default uncaught exception handler implemented by the agent
+ *
+ * The handler is an instance of a class defined by the agent whose only
+ * method uncaughtException() is native. It passes the exception to the
+ * agent's callback and then behaves like the handler it replaced: it calls
+ * the former default handler or prints the stack trace like
+ * ThreadGroup.uncaughtException().
+ *
+ * JVM calls the handler only for exceptions which are not handled by
+ * an uncaught exception handler of the thread or by an overridden
+ * ThreadGroup.uncaughtException(). The handler stops working if the
+ * application sets another default handler.
+ */
+typedef void (*T_uncaughtHandlerCallback)(JNIEnv *jni_env, jobject thread, jthrowable exception);
+
+
+
+/*
+ * Replaces the default uncaught exception handler
+ *
+ * Can be installed only once; must be called in the live phase of JVM.
+ *
+ * @param jni_env JNI environment of the current thread
+ * @param callback Called for every uncaught exception before it is passed
+ *        on, must not leave an exception pending
+ * @returns 0 if the handler was installed; otherwise non zero
+ */
+int uncaught_handler_install(JNIEnv *jni_env, T_uncaughtHandlerCallback callback);
+
+
+
+#endif // __UNCAUGHT_HANDLER_H__
+
+
+
+/*
+ * finito
+ */
@@ -0,0 +1,80 @@
+import java.lang.management.*;
+import java.util.*;
+import java.util.regex.*;
+
+
+/**
+ * Measures how JVMTI capabilities held by the agent slow down JVM start and
+ * code which throws no exception.
+ *
+ * The startup is the time from the JVM start to the first line of main(), the
+ * warm up is the time of the first round, the steady state is the best time of
+ * the remaining rounds. Compare the numbers of runs without the agent and with
+ * the agent in different configurations.
+ */
+public class CapabilityBenchmark {
+    private static int fibonacci(int n) {
+        return n < 2 ? n : fibonacci(n - 1) + fibonacci(n - 2);
+    }
+
+    private static long round(int calls) {
+        long sum = 0;
+        for (int i = 0; i < calls; ++i) {
+            sum += fibonacci(20 + (i & 3));
+        }
+        return sum;
+    }
+
+    public static void main(String args[]) {
+        final long startup = System.currentTimeMillis() - ManagementFactory.getRuntimeMXBean().getStartTime();
+
+        int rounds = 20;
+        int calls = 2000;
+
+        for (String arg : args) {
+            Scanner s = new Scanner(arg);
+            s.findInLine("^([^=]+)=(\\d+)$");
+            MatchResult r = s.match();
+            if (r.groupCount() != 2) {
+                System.err.println("Invalid argument format [rounds|calls=number]: '" + arg + "'");
+                System.exit(1);
+            }
+            switch (r.group(1)) {
+                case "rounds":
+                    rounds = Integer.parseInt(r.group(2));
+                    break;
+                case "calls":
+                    calls = Integer.parseInt(r.group(2));
+                    break;
+                default:
+                    System.err.println("Unknown argument '" + r.group(1) + "'");
+                    System.exit(1);
+                    break;
+            }
+        }
+
+        long warmup = 0;
+        long best = Long.MAX_VALUE;
+        long checksum = 0;
+        for (int i = 0; i < rounds; ++i) {
+            final long start = System.nanoTime();
+            checksum += round(calls);
+            final long elapsed = System.nanoTime() - start;
+
+            if (i == 0) {
+                warmup = elapsed;
+            }
+            else if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        System.out.println("Rounds: " + rounds + ", calls per round: " + calls + ", checksum: " + checksum);
+        System.out.println("Startup: " + startup + " ms");
+        System.out.println("Warm up: " + (warmup / 1000000) + " ms");
+        System.out.println("Steady state: " + (rounds > 1 ? best / 1000000 : warmup / 1000000) + " ms per round");
+        System.exit(0);
+    }
+}
+
+// finito
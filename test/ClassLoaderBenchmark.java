@@ -0,0 +1,75 @@
+import java.io.*;
+import java.net.*;
+import java.util.*;
+import java.util.regex.*;
+import java.lang.reflect.Method;
+
+
+/**
+ * Measures the cost of reporting caught exceptions thrown from classes which
+ * are not visible to the system class loader.
+ *
+ * Every class loader defines its own ClassLoaderBenchmarkPayload class from
+ * the 'classloaders' directory, so the agent has to look the classes of
+ * stack frames up among all loaded classes. Run it with the agent configured
+ * to report java.lang.IllegalStateException when caught and compare the
+ * numbers of runs with different number of class loaders.
+ */
+public class ClassLoaderBenchmark {
+    public static void main(String args[]) throws Exception {
+        int loaders = 10000;
+        int exceptions = 1000;
+        int depth = 10;
+
+        for (String arg : args) {
+            Scanner s = new Scanner(arg);
+            s.findInLine("^([^=]+)=(\\d+)$");
+            MatchResult r = s.match();
+            if (r.groupCount() != 2) {
+                System.err.println("Invalid argument format [loaders|exceptions|depth=number]: '" + arg + "'");
+                System.exit(1);
+            }
+            switch (r.group(1)) {
+                case "loaders":
+                    loaders = Integer.parseInt(r.group(2));
+                    break;
+                case "exceptions":
+                    exceptions = Integer.parseInt(r.group(2));
+                    break;
+                case "depth":
+                    depth = Integer.parseInt(r.group(2));
+                    break;
+                default:
+                    System.err.println("Unknown argument '" + r.group(1) + "'");
+                    System.exit(1);
+                    break;
+            }
+        }
+
+        URL[] urls = new URL[]{new File("classloaders").toURI().toURL()};
+
+        /* Keep the loaders reachable, their classes must not be unloaded */
+        List<Method> methods = new ArrayList<Method>(loaders);
+        final long loadStart = System.nanoTime();
+        for (int i = 0; i < loaders; ++i) {
+            ClassLoader loader = new URLClassLoader(urls, null);
+            Class<?> payload = Class.forName("ClassLoaderBenchmarkPayload", true, loader);
+            methods.add(payload.getMethod("run", int.class, int.class));
+        }
+        final long loadElapsed = System.nanoTime() - loadStart;
+
+        final long start = System.nanoTime();
+        for (int i = 0; i < exceptions; ++i) {
+            methods.get(i % loaders).invoke(null, i, depth);
+        }
+        final long elapsed = System.nanoTime() - start;
+
+        System.out.println("Class loaders: " + loaders + ", exceptions: " + exceptions + ", depth: " + depth);
+        System.out.println("Loading: " + (loadElapsed / 1000000) + " ms");
+        System.out.println("Elapsed: " + (elapsed / 1000000) + " ms");
+        System.out.println("Per exception: " + (elapsed / exceptions) + " ns");
+        System.exit(0);
+    }
+}
+
+// finito
@@ -0,0 +1,24 @@
+/**
+ * Loaded by many distinct class loaders in ClassLoaderBenchmark.
+ *
+ * Must not be visible to the system class loader.
+ */
+public class ClassLoaderBenchmarkPayload {
+    private static void recurse(int level, int index) {
+        if (level == 0) {
+            throw new IllegalStateException("Class loader benchmark exception " + Integer.toString(index));
+        }
+        recurse(level - 1, index);
+    }
+
+    public static void run(int index, int depth) {
+        try {
+            recurse(depth, index);
+        }
+        catch (IllegalStateException ex) {
+            /* intentionally ignored */
+        }
+    }
+}
+
+// finito
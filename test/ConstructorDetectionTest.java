@@ -0,0 +1,69 @@
+/**
+ * Creates exceptions of a type listed in 'caught' in the ways which
+ * caughtdetection=constructor must tell apart.
+ *
+ * Only the exception created by createChained() is to be reported and only
+ * once, although its constructors call each other and it is thrown and
+ * caught afterwards.
+ */
+
+class ConstructorDetectionListed extends RuntimeException {
+    public ConstructorDetectionListed() {
+        this("chained");
+    }
+
+    public ConstructorDetectionListed(String message) {
+        super(message);
+    }
+
+    public ConstructorDetectionListed(int value) {
+        super("value");
+        if (value < 0) {
+            throw new IllegalArgumentException("Negative value");
+        }
+    }
+}
+
+class ConstructorDetectionSubclass extends ConstructorDetectionListed {
+    public ConstructorDetectionSubclass() {
+        super("subclass");
+    }
+}
+
+public class ConstructorDetectionTest {
+    private static void createChained() {
+        try {
+            throw new ConstructorDetectionListed();
+        }
+        catch (ConstructorDetectionListed ex) {
+            System.out.println("Caught " + ex);
+        }
+    }
+
+    private static void createSubclass() {
+        try {
+            throw new ConstructorDetectionSubclass();
+        }
+        catch (ConstructorDetectionListed ex) {
+            System.out.println("Caught " + ex);
+        }
+    }
+
+    private static void createThrowing() {
+        try {
+            new ConstructorDetectionListed(-1);
+        }
+        catch (IllegalArgumentException ex) {
+            System.out.println("Caught " + ex);
+        }
+    }
+
+    public static void main(String args[]) {
+        createSubclass();
+        createThrowing();
+        createChained();
+        System.exit(0);
+    }
+}
+
+// finito
@@ -0,0 +1,100 @@
+import java.util.*;
+import java.util.regex.*;
+
+
+/**
+ * Measures the cost of reporting caught exceptions.
+ *
+ * Run it with the agent configured to report java.lang.IllegalStateException
+ * when caught and compare the numbers with a run without the agent.
+ *
+ * Run it with the agent reporting only uncaught exceptions to see how much
+ * detecting them costs to every thrown exception.
+ */
+class ExceptionBenchmarkWorker extends Thread {
+    private final int exceptions;
+    private final int depth;
+
+    public ExceptionBenchmarkWorker(int exceptions, int depth) {
+        this.exceptions = exceptions;
+        this.depth = depth;
+    }
+
+    private void recurse(int level, int index) {
+        if (level == 0) {
+            throw new IllegalStateException("Benchmark exception " + Integer.toString(index));
+        }
+        recurse(level - 1, index);
+    }
+
+    public void run() {
+        for (int i = 0; i < exceptions; ++i) {
+            try {
+                recurse(depth, i);
+            }
+            catch (IllegalStateException ex) {
+                /* intentionally ignored */
+            }
+        }
+    }
+}
+
+public class ExceptionBenchmark {
+    public static void main(String args[]) {
+        int threads = 4;
+        int exceptions = 1000;
+        int depth = 10;
+
+        for (String arg : args) {
+            Scanner s = new Scanner(arg);
+            s.findInLine("^([^=]+)=(\\d+)$");
+            MatchResult r = s.match();
+            if (r.groupCount() != 2) {
+                System.err.println("Invalid argument format [threads|exceptions|depth=number]: '" + arg + "'");
+                System.exit(1);
+            }
+            switch (r.group(1)) {
+                case "threads":
+                    threads = Integer.parseInt(r.group(2));
+                    break;
+                case "exceptions":
+                    exceptions = Integer.parseInt(r.group(2));
+                    break;
+                case "depth":
+                    depth = Integer.parseInt(r.group(2));
+                    break;
+                default:
+                    System.err.println("Unknown argument '" + r.group(1) + "'");
+                    System.exit(1);
+                    break;
+            }
+        }
+
+        List<Thread> tojoin = new LinkedList<Thread>();
+        final long start = System.nanoTime();
+        for (int i = threads; i != 0; --i) {
+            Thread t = new ExceptionBenchmarkWorker(exceptions, depth);
+            tojoin.add(t);
+            t.start();
+        }
+
+        for (Thread t : tojoin) {
+            try {
+                t.join();
+            }
+            catch(InterruptedException ex) {
+                System.err.println("Can't join a thread because thread join() was interrupted.");
+                System.exit(1);
+            }
+        }
+        final long elapsed = System.nanoTime() - start;
+
+        final long total = (long)threads * exceptions;
+        System.out.println("Threads: " + threads + ", exceptions per thread: " + exceptions + ", depth: " + depth);
+        System.out.println("Elapsed: " + (elapsed / 1000000) + " ms");
+        System.out.println("Per exception: " + (elapsed / total) + " ns");
+        System.exit(0);
+    }
+}
+
+// finito
@@ -9,8 +9,16 @@ import java.net.*;
  */
 
 class StressThreadCaughtException extends Thread {
+    private int linger;
+
+    public StressThreadCaughtException(int linger) {
+        this.linger = linger;
+    }
+
     private void level_three() {
+        long begin = System.nanoTime();
         SimpleTest.throwAndCatchAllExceptions();
+        ThreadStressTest.recordLatency(System.nanoTime() - begin);
     }
 
     private void level_two() {
@@ -35,23 +43,72 @@ class StressThreadCaughtException extends Thread {
 
     public void run() {
         level_one();
+
+        /* Keep the thread alive after its exceptions were reported */
+        if (linger != 0) {
+            try {
+                Thread.currentThread().sleep(linger);
+            }
+            catch (InterruptedException ex) {
+                System.out.println("Interrupted");
+            }
+        }
     }
 }
 
 public class ThreadStressTest {
+    /* Nanoseconds spent by throwing and catching exceptions, includes the agent's callbacks */
+    private static Queue<Long> latencies = new java.util.concurrent.ConcurrentLinkedQueue<Long>();
+
+    public static void recordLatency(long nanos) {
+        latencies.add(nanos);
+    }
+
+    /**
+     * Prints percentiles of the time spent by throwing and catching exceptions.
+     */
+    private static void printLatencies() {
+        List<Long> sorted = new ArrayList<Long>(latencies);
+        if (sorted.isEmpty()) {
+            return;
+        }
+        Collections.sort(sorted);
+        long p50 = sorted.get(sorted.size() / 2);
+        long p99 = sorted.get((int)Math.min(sorted.size() - 1, (long)Math.ceil(sorted.size() * 0.99) - 1));
+        long max = sorted.get(sorted.size() - 1);
+        System.out.println("Exception round trips: " + Integer.toString(sorted.size())
+                + ", p50 " + Long.toString(p50 / 1000) + " us"
+                + ", p99 " + Long.toString(p99 / 1000) + " us"
+                + ", max " + Long.toString(max / 1000) + " us");
+    }
+
+    /**
+     * Prints the size of heap used by reachable objects.
+     */
+    private static void printRetainedHeap(String label) {
+        Runtime runtime = Runtime.getRuntime();
+        System.gc();
+        System.gc();
+        long used = runtime.totalMemory() - runtime.freeMemory();
+        System.out.println("Retained heap " + label + ": " + Long.toString(used / 1024) + " KiB");
+    }
+
     /**
      * Entry point to this multi thread test.
      */
     public static void main(String args[]) {
         int repeats = 60;
         int threads = 600;
+        int linger = 0;
+        boolean heap = false;
+        boolean latency = false;
 
         for (String arg : args) {
             Scanner s = new Scanner(arg);
             s.findInLine("^([^=]+)=(\\d+)$");
             MatchResult r = s.match();
             if (r.groupCount() != 2) {
-                System.err.println("Invalid argument format [reps|threads=number]: '" + arg + "'");
+                System.err.println("Invalid argument format [reps|threads|linger|heap|latency=number]: '" + arg + "'");
                 System.exit(1);
             }
             switch (r.group(1)) {
@@ -61,6 +118,15 @@ public class ThreadStressTest {
                 case "threads":
                     threads = Integer.parseInt(r.group(2));
                     break;
+                case "linger":
+                    linger = Integer.parseInt(r.group(2));
+                    break;
+                case "heap":
+                    heap = Integer.parseInt(r.group(2)) != 0;
+                    break;
+                case "latency":
+                    latency = Integer.parseInt(r.group(2)) != 0;
+                    break;
                 default:
                     System.err.println("Unknown argument '" + r.group(1) + "'");
                     System.exit(1);
@@ -74,7 +140,7 @@ public class ThreadStressTest {
         for (int i = repeats; i != 0; --i) {
             for (int j = threads; j != 0; --j) {
                 try {
-                    Thread t = new StressThreadCaughtException();
+                    Thread t = new StressThreadCaughtException(linger);
                     tojoin.add(t);
                     System.out.println("Starting Thread: " + Integer.toString((i * j) + j));
                     t.start();
@@ -91,6 +157,10 @@ public class ThreadStressTest {
             catch (InterruptedException ex) {
                 System.out.println("Interrupted");
             }
+
+            if (heap) {
+                printRetainedHeap("after round " + Integer.toString(repeats - i + 1));
+            }
         }
 
         System.out.println("All Threads Started");
@@ -104,6 +174,12 @@ public class ThreadStressTest {
         }
 
         System.out.println("All Threads Finished");
+        if (heap) {
+            printRetainedHeap("after all threads finished");
+        }
+        if (latency) {
+            printLatencies();
+        }
         System.exit(0);
     }
 }
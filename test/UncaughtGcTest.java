@@ -0,0 +1,44 @@
+/**
+ * Makes the only reference to an uncaught exception unreachable and runs the
+ * garbage collector before the throwing thread ends.
+ *
+ * The exception has no handler in Java code, hence the agent postpones its
+ * report until the thread ends. The JVM wraps the exception in
+ * ExceptionInInitializerError which is dropped before the collection.
+ */
+
+class UncaughtGcTestInitializer {
+    static {
+        if (System.getProperty("java.version") != null) {
+            throw new IllegalStateException("Initializer failed");
+        }
+    }
+}
+
+public class UncaughtGcTest extends Thread {
+    private static void initialize() {
+        try {
+            new UncaughtGcTestInitializer();
+        }
+        catch (ExceptionInInitializerError ex) {
+            System.out.println("Initialization failed");
+        }
+    }
+
+    public void run() {
+        initialize();
+
+        for (int i = 0; i < 3; ++i) {
+            System.gc();
+        }
+    }
+
+    public static void main(String args[]) throws InterruptedException {
+        Thread t = new UncaughtGcTest();
+        t.start();
+        t.join();
+        System.exit(0);
+    }
+}
+
+// finito
@@ -0,0 +1,255 @@
+/*
+ *  Copyright (C) RedHat inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Compares delivery of problems through the ABRT socket with the former
+ * synchronous delivery where the throwing thread connected to abrtd, sent one
+ * problem and waited for the response.
+ *
+ * abrtd is replaced by a stand-in server listening on a temporary socket which
+ * reads every problem, spends given time by "processing" it in a thread of its
+ * own and responds like abrtd.
+ *
+ * Usage: abrt_socket_benchmark [problems] [processing time in us]
+ */
+#include "abrt_socket.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+#define REQUEST_HEADER "POST / HTTP/1.1\r\n\r\n"
+#define CREATED_RESPONSE "HTTP/1.1 201 Created\r\n\r\n"
+
+/* Batch windows of measured ABRT sockets */
+static const unsigned s_windows[] = { 0, 5, 20 };
+
+
+
+typedef struct {
+    int listener;
+    unsigned processing_us;
+} T_standIn;
+
+typedef struct {
+    int fd;
+    unsigned processing_us;
+} T_standInClient;
+
+
+
+static void *stand_in_client_run(void *arg)
+{
+    T_standInClient *client = (T_standInClient *)arg;
+
+    char buffer[4096];
+    while (0 < read(client->fd, buffer, sizeof(buffer)))
+        ;
+
+    usleep(client->processing_us);
+
+    if (0 > write(client->fd, CREATED_RESPONSE, sizeof(CREATED_RESPONSE) - 1))
+    {
+        perror("write");
+    }
+
+    close(client->fd);
+    free(client);
+    return NULL;
+}
+
+
+
+static void *stand_in_run(void *arg)
+{
+    T_standIn *server = (T_standIn *)arg;
+    int fd;
+    while (0 <= (fd = accept(server->listener, NULL, NULL)))
+    {
+        T_standInClient *client = (T_standInClient *)malloc(sizeof(*client));
+        client->fd = fd;
+        client->processing_us = server->processing_us;
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, stand_in_client_run, client);
+        pthread_detach(thread);
+    }
+
+    return NULL;
+}
+
+
+
+static double elapsed(const struct timespec *begin, const struct timespec *end)
+{
+    return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+
+
+/*
+ * The former delivery, see libreport's problem_data_send_to_abrt()
+ */
+static int send_synchronously(const char *path, const char *problem, size_t length)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (0 > fd || 0 != connect(fd, (struct sockaddr *)&address, sizeof(address)))
+    {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+
+    int failed = 0 > send(fd, REQUEST_HEADER, sizeof(REQUEST_HEADER) - 1, MSG_NOSIGNAL)
+        || 0 > send(fd, problem, length, MSG_NOSIGNAL)
+        || 0 != shutdown(fd, SHUT_WR);
+
+    char response[64] = { 0 };
+    failed = failed || 0 >= read(fd, response, sizeof(response) - 1)
+        || 0 != strncmp(response, "HTTP/1.1 201 ", strlen("HTTP/1.1 201 "));
+
+    close(fd);
+    return failed;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    const unsigned long problems = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+    const unsigned processing_us = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 10) : 1000;
+
+    char dir[] = "/tmp/abrt-socket-benchmark-XXXXXX";
+    if (NULL == mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s/abrt.socket", dir);
+
+    T_standIn server = { .processing_us = processing_us };
+    server.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (0 > server.listener
+        || 0 != bind(server.listener, (struct sockaddr *)&address, sizeof(address))
+        || 0 != listen(server.listener, 64))
+    {
+        perror("listen");
+        return EXIT_FAILURE;
+    }
+
+    pthread_t server_thread;
+    pthread_create(&server_thread, NULL, stand_in_run, &server);
+
+    /* A typical problem: backtrace, environment and few short items */
+    T_stringBuilder *problem = string_builder_new(64 * 1024);
+    char backtrace[4096];
+    char environ[2048];
+    memset(backtrace, 'b', sizeof(backtrace) - 1);
+    backtrace[sizeof(backtrace) - 1] = '\0';
+    memset(environ, 'e', sizeof(environ) - 1);
+    environ[sizeof(environ) - 1] = '\0';
+    abrt_socket_append_item(problem, "type", "Java");
+    abrt_socket_append_item(problem, "analyzer", "Java");
+    abrt_socket_append_item(problem, "executable", "/usr/share/java/app.jar");
+    abrt_socket_append_item(problem, "reason", "Exception thrown by Main.main()");
+    abrt_socket_append_item(problem, "backtrace", backtrace);
+    abrt_socket_append_item(problem, "environ", environ);
+
+    /* Every problem reports its creation to stderr */
+    if (NULL == freopen("/dev/null", "w", stderr))
+    {
+        perror("freopen");
+    }
+
+    printf("%lu problems of %zu bytes, abrtd processing time %uus\n",
+            problems, string_builder_length(problem), processing_us);
+    printf("%-24s %16s %16s\n", "delivery", "[problems/s]", "[us/submission]");
+
+    struct timespec begin;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (unsigned long i = 0; i < problems; ++i)
+    {
+        if (send_synchronously(address.sun_path, string_builder_cstr(problem), string_builder_length(problem)))
+        {
+            printf("synchronous delivery failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    const double seconds = elapsed(&begin, &end);
+    printf("%-24s %16.0f %16.1f\n", "synchronous", problems / seconds, seconds * 1e6 / problems);
+
+    for (size_t w = 0; w < sizeof(s_windows)/sizeof(s_windows[0]); ++w)
+    {
+        T_abrtSocket *sock = abrt_socket_new(address.sun_path, problems, s_windows[w]);
+        if (NULL == sock)
+        {
+            return EXIT_FAILURE;
+        }
+
+        struct timespec submitted;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (unsigned long i = 0; i < problems; ++i)
+        {
+            abrt_socket_submit(sock, string_builder_cstr(problem), string_builder_length(problem));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &submitted);
+
+        abrt_socket_flush(sock, 600000);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        T_abrtSocketStats stats;
+        abrt_socket_get_stats(sock, &stats);
+        if (0 != abrt_socket_close(sock, 1000) || stats.delivered != problems)
+        {
+            printf("ABRT socket delivered %zu of %lu problems\n", stats.delivered, problems);
+            return EXIT_FAILURE;
+        }
+        abrt_socket_free(sock);
+
+        char name[32];
+        snprintf(name, sizeof(name), "ABRT socket %ums", s_windows[w]);
+        printf("%-24s %16.0f %16.1f\n", name,
+                problems / elapsed(&begin, &end), elapsed(&begin, &submitted) * 1e6 / problems);
+    }
+
+    string_builder_free(problem);
+    shutdown(server.listener, SHUT_RDWR);
+    close(server.listener);
+    unlink(address.sun_path);
+    rmdir(dir);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * finito
+ */
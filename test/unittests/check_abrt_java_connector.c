@@ -1,7 +1,22 @@
 #include "abrt-checker.h"
 #include "internal_libabrt.h"
+#include "string_builder.h"
+#include "report_arena.h"
+#include "abrt_socket.h"
+#include "report_limiter.h"
+#include "report_dedup.h"
+#include "report_queue.h"
+#include "class_index.h"
+#include "frame_cache.h"
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <check.h>
 
 void assert_str_vector_eq(const char **expected, const char **tested)
@@ -37,6 +52,23 @@ void assert_conf_populated(T_configuration *conf)
     ck_assert(conf->fqdnDebugMethods != NULL);
     const char *debugMethods[] = { "n.s.cls.M1", "n.s.cls2.M2", "n.s.cls3.M3", NULL };
     assert_str_vector_eq((const char **)debugMethods, (const char **)conf->fqdnDebugMethods);
+
+    ck_assert_uint_eq(conf->reportQueueDepth, 16);
+    ck_assert_int_eq(conf->reportQueueOverflow, RQ_OVERFLOW_DROP_OLDEST);
+    ck_assert_uint_eq(conf->reportWorkers, 4);
+    ck_assert_uint_eq(conf->flushTimeout, 250);
+    ck_assert_int_eq(conf->stackTraceEngine, ST_ENGINE_JVMTI);
+    ck_assert_uint_eq(conf->stackTraceDepth, 64);
+    ck_assert_uint_eq(conf->stackTraceSize, 4096);
+    ck_assert_int_eq(conf->resampleEnviron, 1);
+    ck_assert_str_eq(conf->abrtSocketPath, "/tmp/abrt-test.socket");
+    ck_assert_uint_eq(conf->abrtBatchWindow, 50);
+    ck_assert_uint_eq(conf->rateLimit, 120);
+    ck_assert_uint_eq(conf->rateLimitBurst, 3);
+    ck_assert_uint_eq(conf->dedupWindow, 500);
+    ck_assert_uint_eq(conf->probeDepth, 4);
+    ck_assert_int_eq(conf->uncaughtDetection, UE_DETECTION_HANDLER);
+    ck_assert_int_eq(conf->caughtDetection, CE_DETECTION_CONSTRUCTOR);
 }
 
 START_TEST(test_config_file_all_entries_populated)
@@ -61,7 +93,11 @@ START_TEST(test_command_line_conf_all_entries_populated)
 
     char *opts = strdup(
             "abrt=on,syslog=on,journald=off,executable=threadclass,output=test.log,"
-            "caught=n.s.Ex1:n.s.Ex2:n.s.Ex3,debugmethod=n.s.cls.M1:n.s.cls2.M2:n.s.cls3.M3");
+            "caught=n.s.Ex1:n.s.Ex2:n.s.Ex3,debugmethod=n.s.cls.M1:n.s.cls2.M2:n.s.cls3.M3,"
+            "queuedepth=16,queueoverflow=dropoldest,workers=4,flushtimeout=250,"
+            "stacktrace=jvmti,stacktracedepth=64,stacktracesize=4096,resampleenviron=on,"
+            "abrtsocket=/tmp/abrt-test.socket,abrtbatchwindow=50,ratelimit=120,ratelimitburst=3,"
+            "dedupwindow=500,probedepth=4,uncaught=handler,caughtdetection=constructor");
 
     ck_assert_msg(NULL != opts, "Out of memory");
 
@@ -82,7 +118,11 @@ START_TEST(test_conf_file_no_overwrite)
 
     char *opts = strdup(
             "abrt=off,syslog=off,journald=on,executable=mainclass,output=,"
-            "conffile=,caught=,debugmethod=");
+            "conffile=,caught=,debugmethod=,queuedepth=0,queueoverflow=block,"
+            "workers=1,flushtimeout=0,stacktrace=throwable,stacktracedepth=1,"
+            "stacktracesize=256,resampleenviron=off,abrtsocket=/run/abrt.sock,"
+            "abrtbatchwindow=0,ratelimit=0,ratelimitburst=1,dedupwindow=0,"
+            "probedepth=1,uncaught=events,caughtdetection=events");
 
     ck_assert_msg(NULL != opts, "Out of memory");
 
@@ -107,10 +147,782 @@ START_TEST(test_conf_file_no_overwrite)
 
     ck_assert(NULL == conf.fqdnDebugMethods);
 
+    ck_assert_uint_eq(conf.reportQueueDepth, 0);
+    ck_assert_int_eq(conf.reportQueueOverflow, RQ_OVERFLOW_BLOCK);
+    ck_assert_uint_eq(conf.reportWorkers, 1);
+    ck_assert_uint_eq(conf.flushTimeout, 0);
+    ck_assert_int_eq(conf.stackTraceEngine, ST_ENGINE_THROWABLE);
+    ck_assert_uint_eq(conf.stackTraceDepth, 1);
+    ck_assert_uint_eq(conf.stackTraceSize, 256);
+    ck_assert_int_eq(conf.resampleEnviron, 0);
+    ck_assert_str_eq(conf.abrtSocketPath, "/run/abrt.sock");
+    ck_assert_uint_eq(conf.abrtBatchWindow, 0);
+    ck_assert_uint_eq(conf.rateLimit, 0);
+    ck_assert_uint_eq(conf.rateLimitBurst, 1);
+    ck_assert_uint_eq(conf.dedupWindow, 0);
+    ck_assert_uint_eq(conf.probeDepth, 1);
+    ck_assert_int_eq(conf.uncaughtDetection, UE_DETECTION_EVENTS);
+    ck_assert_int_eq(conf.caughtDetection, CE_DETECTION_EVENTS);
+
     configuration_destroy(&conf);
 }
 END_TEST
 
+/*
+ * Options with an invalid value and the field which must keep its default
+ * value
+ */
+#define CONF_FIELD(field) offsetof(T_configuration, field), sizeof(((T_configuration *)NULL)->field)
+
+static const struct {
+    const char *option;
+    size_t offset;
+    size_t size;
+} invalidOptionValues[] = {
+    { "queuedepth=-1",                  CONF_FIELD(reportQueueDepth) },
+    { "queueoverflow=ignore",           CONF_FIELD(reportQueueOverflow) },
+    { "workers=0",                      CONF_FIELD(reportWorkers) },
+    { "flushtimeout=10ms",              CONF_FIELD(flushTimeout) },
+    { "stacktrace=native",              CONF_FIELD(stackTraceEngine) },
+    { "stacktracedepth=0",              CONF_FIELD(stackTraceDepth) },
+    { "stacktracesize=255",             CONF_FIELD(stackTraceSize) },
+    { "uncaught=bytecode",              CONF_FIELD(uncaughtDetection) },
+    { "caughtdetection=fillinstacktrace", CONF_FIELD(caughtDetection) },
+    { "resampleenviron=sometimes",      CONF_FIELD(resampleEnviron) },
+    { "abrtsocket=",                    CONF_FIELD(abrtSocketPath) },
+    { "abrtbatchwindow=-5",             CONF_FIELD(abrtBatchWindow) },
+    { "ratelimit=often",                CONF_FIELD(rateLimit) },
+    { "ratelimitburst=0",               CONF_FIELD(rateLimitBurst) },
+    { "dedupwindow=-1",                 CONF_FIELD(dedupWindow) },
+    { "probedepth=0",                   CONF_FIELD(probeDepth) },
+    { "probedepth=65",                  CONF_FIELD(probeDepth) },
+};
+
+START_TEST(test_options_invalid_values)
+{
+    for (size_t i = 0; i < sizeof(invalidOptionValues)/sizeof(invalidOptionValues[0]); ++i)
+    {
+        T_configuration conf;
+        configuration_initialize(&conf);
+
+        const char *field = (const char *)&conf + invalidOptionValues[i].offset;
+        char defaultValue[sizeof(T_configuration)];
+        memcpy(defaultValue, field, invalidOptionValues[i].size);
+
+        char *opts = NULL;
+        const int length = asprintf(&opts, "conffile=,%s", invalidOptionValues[i].option);
+        ck_assert_msg(-1 != length, "Out of memory");
+
+        mark_point();
+        parse_commandline_options(&conf, opts);
+
+        ck_assert_msg(0 == memcmp(field, defaultValue, invalidOptionValues[i].size),
+                "'%s' changed the default value", invalidOptionValues[i].option);
+
+        free(opts);
+        configuration_destroy(&conf);
+    }
+}
+END_TEST
+
+/* Consumer finishing items in a random order of processing */
+typedef struct {
+    T_reportQueue *queue;
+    intptr_t *finished;
+    size_t count;
+} T_reportQueueWorker;
+
+static void *report_queue_worker_run(void *arg)
+{
+    T_reportQueueWorker *worker = (T_reportQueueWorker *)arg;
+
+    size_t ticket = 0;
+    void *item = NULL;
+    while (NULL != (item = report_queue_pop(worker->queue, &ticket)))
+    {
+        usleep((useconds_t)((intptr_t)item % 7) * 100);
+
+        report_queue_wait_turn(worker->queue, ticket);
+        worker->finished[worker->count++] = (intptr_t)item;
+        report_queue_done(worker->queue);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_report_queue_order)
+{
+    T_reportQueue *queue = report_queue_new(4, RQ_OVERFLOW_BLOCK);
+    ck_assert(NULL != queue);
+
+    const intptr_t items = 200;
+    intptr_t finished[200];
+    T_reportQueueWorker worker = { .queue = queue, .finished = finished, .count = 0 };
+
+    pthread_t threads[4];
+    for (size_t i = 0; i < sizeof(threads)/sizeof(threads[0]); ++i)
+    {
+        report_queue_attach(queue);
+        ck_assert_int_eq(pthread_create(threads + i, NULL, report_queue_worker_run, &worker), 0);
+    }
+
+    for (intptr_t i = 1; i <= items; ++i)
+    {
+        void *evicted = NULL;
+        ck_assert_int_eq(report_queue_push(queue, (void *)i, &evicted), 0);
+        ck_assert(NULL == evicted);
+    }
+
+    ck_assert_int_eq(report_queue_flush(queue, 10000), 0);
+    ck_assert_int_eq(report_queue_close(queue, 10000), 0);
+
+    for (size_t i = 0; i < sizeof(threads)/sizeof(threads[0]); ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* items are finished in the order they were pushed */
+    ck_assert_uint_eq(worker.count, (size_t)items);
+    for (intptr_t i = 0; i < items; ++i)
+    {
+        ck_assert_int_eq(finished[i], i + 1);
+    }
+
+    ck_assert_uint_eq(report_queue_dropped(queue), 0);
+
+    void *evicted = NULL;
+    ck_assert_int_ne(report_queue_push(queue, (void *)1, &evicted), 0);
+
+    report_queue_free(queue);
+}
+END_TEST
+
+/* Producer of one item to a full queue */
+typedef struct {
+    T_reportQueue *queue;
+    intptr_t item;
+    int retval;
+    int pushed;
+} T_reportQueueProducer;
+
+static void *report_queue_producer_run(void *arg)
+{
+    T_reportQueueProducer *producer = (T_reportQueueProducer *)arg;
+
+    void *evicted = NULL;
+    producer->retval = report_queue_push(producer->queue, (void *)producer->item, &evicted);
+    __atomic_store_n(&producer->pushed, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+START_TEST(test_report_queue_overflow)
+{
+    void *evicted = NULL;
+
+    /* dropnewest refuses the pushed item */
+    T_reportQueue *queue = report_queue_new(2, RQ_OVERFLOW_DROP_NEWEST);
+    ck_assert(NULL != queue);
+    ck_assert_int_eq(report_queue_push(queue, (void *)1, &evicted), 0);
+    ck_assert_int_eq(report_queue_push(queue, (void *)2, &evicted), 0);
+    ck_assert_int_ne(report_queue_push(queue, (void *)3, &evicted), 0);
+    ck_assert(NULL == evicted);
+    ck_assert_uint_eq(report_queue_dropped(queue), 1);
+    ck_assert(report_queue_try_pop(queue) == (void *)1);
+    ck_assert(report_queue_try_pop(queue) == (void *)2);
+    ck_assert(report_queue_try_pop(queue) == NULL);
+    ck_assert_int_eq(report_queue_close(queue, 0), 0);
+    report_queue_free(queue);
+
+    /* dropoldest evicts the first item */
+    queue = report_queue_new(2, RQ_OVERFLOW_DROP_OLDEST);
+    ck_assert(NULL != queue);
+    ck_assert_int_eq(report_queue_push(queue, (void *)1, &evicted), 0);
+    ck_assert_int_eq(report_queue_push(queue, (void *)2, &evicted), 0);
+    ck_assert_int_eq(report_queue_push(queue, (void *)3, &evicted), 0);
+    ck_assert(evicted == (void *)1);
+    ck_assert_uint_eq(report_queue_dropped(queue), 1);
+    ck_assert(report_queue_try_pop(queue) == (void *)2);
+    ck_assert(report_queue_try_pop(queue) == (void *)3);
+    ck_assert_int_eq(report_queue_close(queue, 0), 0);
+    report_queue_free(queue);
+
+    /* block waits for a free slot */
+    queue = report_queue_new(1, RQ_OVERFLOW_BLOCK);
+    ck_assert(NULL != queue);
+    ck_assert_int_eq(report_queue_push(queue, (void *)1, &evicted), 0);
+
+    T_reportQueueProducer producer = { .queue = queue, .item = 2, .retval = -1, .pushed = 0 };
+    pthread_t thread;
+    ck_assert_int_eq(pthread_create(&thread, NULL, report_queue_producer_run, &producer), 0);
+    usleep(50 * 1000);
+    ck_assert_int_eq(__atomic_load_n(&producer.pushed, __ATOMIC_ACQUIRE), 0);
+
+    ck_assert(report_queue_try_pop(queue) == (void *)1);
+    pthread_join(thread, NULL);
+    ck_assert_int_eq(producer.retval, 0);
+    ck_assert_uint_eq(report_queue_dropped(queue), 0);
+
+    /* closing wakes up a blocked producer */
+    producer.item = 3;
+    producer.pushed = 0;
+    ck_assert_int_eq(pthread_create(&thread, NULL, report_queue_producer_run, &producer), 0);
+    usleep(50 * 1000);
+    ck_assert_int_eq(__atomic_load_n(&producer.pushed, __ATOMIC_ACQUIRE), 0);
+    ck_assert_int_eq(report_queue_close(queue, 0), 0);
+    pthread_join(thread, NULL);
+    ck_assert_int_ne(producer.retval, 0);
+
+    ck_assert(report_queue_try_pop(queue) == (void *)2);
+    report_queue_free(queue);
+}
+END_TEST
+
+START_TEST(test_report_queue_deadlines)
+{
+    T_reportQueue *queue = report_queue_new(2, RQ_OVERFLOW_BLOCK);
+    ck_assert(NULL != queue);
+
+    /* an empty queue is flushed at once */
+    ck_assert_int_eq(report_queue_flush(queue, 0), 0);
+
+    void *evicted = NULL;
+    ck_assert_int_eq(report_queue_push(queue, (void *)1, &evicted), 0);
+
+    /* nobody processes the item */
+    ck_assert_int_ne(report_queue_flush(queue, 50), 0);
+
+    /* a consumer which does not leave keeps the queue open */
+    report_queue_attach(queue);
+    ck_assert_int_ne(report_queue_close(queue, 50), 0);
+    report_queue_detach(queue);
+    ck_assert_int_eq(report_queue_close(queue, 0), 0);
+
+    ck_assert(report_queue_try_pop(queue) == (void *)1);
+    report_queue_free(queue);
+}
+END_TEST
+
+/*
+ * JNI functions used by the class index; a weak reference is the class itself
+ */
+typedef struct {
+    int loaded;
+} T_fakeClass;
+
+static jboolean JNICALL fake_is_same_object(JNIEnv *jni_env, jobject lhs, jobject rhs)
+{
+    (void)jni_env;
+    if (NULL == rhs)
+    {
+        return NULL == lhs || !((T_fakeClass *)lhs)->loaded;
+    }
+
+    return lhs == rhs;
+}
+
+static jobject JNICALL fake_new_ref(JNIEnv *jni_env, jobject ref)
+{
+    (void)jni_env;
+    return NULL == ref || !((T_fakeClass *)ref)->loaded ? NULL : ref;
+}
+
+static void JNICALL fake_delete_ref(JNIEnv *jni_env, jobject ref)
+{
+    (void)jni_env;
+    (void)ref;
+}
+
+static const struct JNINativeInterface_ fakeJniFunctions = {
+    .NewLocalRef = fake_new_ref,
+    .NewWeakGlobalRef = fake_new_ref,
+    .DeleteWeakGlobalRef = fake_delete_ref,
+    .IsSameObject = fake_is_same_object,
+};
+
+START_TEST(test_class_index_add_find_sweep)
+{
+    JNIEnv jni_functions = &fakeJniFunctions;
+    JNIEnv *jni_env = &jni_functions;
+
+    T_classIndex *index = class_index_new();
+    ck_assert(NULL != index);
+
+    /* enough classes to grow the index several times */
+    enum { CLASSES = 4000 };
+    static T_fakeClass classes[CLASSES + 2];
+    char name[32];
+    for (int i = 0; i < CLASSES; ++i)
+    {
+        classes[i].loaded = 1;
+        snprintf(name, sizeof(name), "pkg.Class%d", i);
+        ck_assert_int_eq(class_index_add(index, jni_env, name, (jclass)(classes + i)), 0);
+    }
+
+    ck_assert_uint_eq(class_index_size(index), CLASSES);
+
+    /* an indexed class is not added twice */
+    ck_assert_int_eq(class_index_add(index, jni_env, "pkg.Class0", (jclass)classes), 0);
+    ck_assert_uint_eq(class_index_size(index), CLASSES);
+
+    /* a class of the same name defined by another class loader is added */
+    classes[CLASSES].loaded = 1;
+    ck_assert_int_eq(class_index_add(index, jni_env, "pkg.Class0", (jclass)(classes + CLASSES)), 0);
+    ck_assert_uint_eq(class_index_size(index), CLASSES + 1);
+
+    for (int i = 1; i < CLASSES; ++i)
+    {
+        snprintf(name, sizeof(name), "pkg.Class%d", i);
+        ck_assert(class_index_find(index, jni_env, name) == (jclass)(classes + i));
+    }
+
+    ck_assert(class_index_find(index, jni_env, "pkg.Missing") == NULL);
+
+    /* unloaded classes are not found */
+    for (int i = 1; i < CLASSES; i += 2)
+    {
+        classes[i].loaded = 0;
+    }
+
+    ck_assert(class_index_find(index, jni_env, "pkg.Class1") == NULL);
+    ck_assert(class_index_find(index, jni_env, "pkg.Class2") == (jclass)(classes + 2));
+
+    /* and are removed once as many classes were added as the index kept */
+    ck_assert_uint_eq(class_index_size(index), CLASSES + 1);
+    for (int i = 0; i < CLASSES + 1; ++i)
+    {
+        snprintf(name, sizeof(name), "other.Class%d", i);
+        classes[CLASSES + 1].loaded = 1;
+        ck_assert_int_eq(class_index_add(index, jni_env, name, (jclass)(classes + CLASSES + 1)), 0);
+    }
+
+    ck_assert_uint_eq(class_index_size(index), CLASSES + 1 - CLASSES / 2 + CLASSES + 1);
+    ck_assert(class_index_find(index, jni_env, "pkg.Class3998") == (jclass)(classes + 3998));
+
+    class_index_free(index, jni_env);
+}
+END_TEST
+
+/*
+ * JVMTI functions used by the frame cache; only method 1 has line numbers
+ */
+static int fakeLineNumberTableCalls;
+
+static jvmtiError JNICALL fake_get_line_number_table(jvmtiEnv *jvmti_env, jmethodID method, jint *count, jvmtiLineNumberEntry **table)
+{
+    (void)jvmti_env;
+    ++fakeLineNumberTableCalls;
+
+    if ((jmethodID)(intptr_t)8 != method)
+    {
+        return JVMTI_ERROR_ABSENT_INFORMATION;
+    }
+
+    /* not sorted by location */
+    static const jvmtiLineNumberEntry entries[] = {
+        { .start_location = 10, .line_number = 12 },
+        { .start_location = 3,  .line_number = 10 },
+        { .start_location = 25, .line_number = 15 },
+        { .start_location = 5,  .line_number = 11 },
+    };
+
+    *table = (jvmtiLineNumberEntry *)malloc(sizeof(entries));
+    ck_assert(NULL != *table);
+    memcpy(*table, entries, sizeof(entries));
+    *count = sizeof(entries)/sizeof(entries[0]);
+    return JVMTI_ERROR_NONE;
+}
+
+static jvmtiError JNICALL fake_deallocate(jvmtiEnv *jvmti_env, unsigned char *mem)
+{
+    (void)jvmti_env;
+    free(mem);
+    return JVMTI_ERROR_NONE;
+}
+
+static const struct jvmtiInterface_1_ fakeJvmtiFunctions = {
+    .GetLineNumberTable = fake_get_line_number_table,
+    .Deallocate = fake_deallocate,
+};
+
+START_TEST(test_frame_cache_lines_frames)
+{
+    jvmtiEnv jvmti_functions = &fakeJvmtiFunctions;
+    jvmtiEnv *jvmti_env = &jvmti_functions;
+    const jmethodID method = (jmethodID)(intptr_t)8;
+    const jmethodID no_lines = (jmethodID)(intptr_t)16;
+
+    T_frameCache *cache = frame_cache_new(2);
+    ck_assert(NULL != cache);
+    fakeLineNumberTableCalls = 0;
+
+    /* the line of the last entry starting at or before the location */
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, method, 0), -1);
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, method, 3), 10);
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, method, 4), 10);
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, method, 5), 11);
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, method, 24), 12);
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, method, 25), 15);
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, method, 1000), 15);
+    /* native method */
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, method, -1), -1);
+    ck_assert_int_eq(fakeLineNumberTableCalls, 1);
+
+    /* a missing table is remembered too */
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, no_lines, 5), -1);
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, no_lines, 6), -1);
+    ck_assert_int_eq(fakeLineNumberTableCalls, 2);
+
+    T_stringBuilder *builder = string_builder_new(64);
+    ck_assert(NULL != builder);
+
+    const char frame[] = "\tat Main.main(Main.java:11) [unknown]\n";
+    ck_assert_int_eq(frame_cache_append_frame(cache, method, 5, builder), -1);
+    frame_cache_put_frame(cache, method, 5, frame);
+    ck_assert_int_eq(frame_cache_append_frame(cache, method, 5, builder), (int)strlen(frame));
+    ck_assert_str_eq(string_builder_cstr(builder), frame);
+    ck_assert_int_eq(frame_cache_append_frame(cache, method, 6, builder), -1);
+
+    /* a frame which does not fit the builder is not appended */
+    ck_assert_int_eq(frame_cache_append_frame(cache, method, 5, builder), 0);
+    ck_assert_uint_eq(string_builder_length(builder), strlen(frame));
+
+    /* a full cache starts over */
+    frame_cache_put_frame(cache, method, 6, frame);
+    frame_cache_put_frame(cache, method, 7, frame);
+    string_builder_truncate(builder, 0);
+    ck_assert_int_eq(frame_cache_append_frame(cache, method, 5, builder), -1);
+    ck_assert_int_eq(frame_cache_append_frame(cache, method, 7, builder), (int)strlen(frame));
+
+    /* invalidation drops frames and line number tables */
+    frame_cache_invalidate(cache);
+    ck_assert_int_eq(frame_cache_append_frame(cache, method, 7, builder), -1);
+    ck_assert_int_eq(frame_cache_get_line_number(cache, jvmti_env, method, 5), 11);
+    ck_assert_int_eq(fakeLineNumberTableCalls, 3);
+
+    string_builder_free(builder);
+    frame_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_string_builder_limit)
+{
+    T_stringBuilder *builder = string_builder_new(4000);
+    ck_assert(builder != NULL);
+    ck_assert_str_eq(string_builder_cstr(builder), "");
+
+    /* grows over the initial capacity */
+    for (int i = 0; i < 100; ++i)
+    {
+        ck_assert_int_eq(string_builder_printf(builder, "frame %02d\n", i), 0);
+    }
+
+    ck_assert_uint_eq(string_builder_length(builder), 900);
+    ck_assert(strncmp(string_builder_cstr(builder) + 891, "frame 99\n", 9) == 0);
+
+    string_builder_truncate(builder, 9);
+    ck_assert_str_eq(string_builder_cstr(builder), "frame 00\n");
+
+    /* exactly fills the limit */
+    char text[4000 - 9 + 1];
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    ck_assert_int_eq(string_builder_append(builder, text), 0);
+    ck_assert_uint_eq(string_builder_length(builder), 4000);
+
+    /* nothing is appended over the limit */
+    ck_assert_int_ne(string_builder_append(builder, "y"), 0);
+    ck_assert_int_ne(string_builder_printf(builder, "%d", 1), 0);
+    ck_assert_uint_eq(string_builder_length(builder), 4000);
+    ck_assert_uint_eq(strlen(string_builder_cstr(builder)), 4000);
+
+    char *copy = string_builder_strdup(builder);
+    ck_assert(copy != NULL);
+    ck_assert_str_eq(copy, string_builder_cstr(builder));
+    free(copy);
+
+    string_builder_free(builder);
+
+    /* the thread's builder is reused and starts empty */
+    builder = string_builder_get_thread_builder(16);
+    ck_assert(builder != NULL);
+    ck_assert_int_eq(string_builder_append(builder, "Exception"), 0);
+    ck_assert(string_builder_get_thread_builder(16) == builder);
+    ck_assert_uint_eq(string_builder_length(builder), 0);
+}
+END_TEST
+
+START_TEST(test_report_arena_alloc_release)
+{
+    T_reportArena *arena = report_arena_acquire();
+    ck_assert(arena != NULL);
+
+    char *small = report_arena_strdup(arena, "Caught exception");
+    ck_assert(small != NULL);
+    ck_assert_str_eq(small, "Caught exception");
+
+    char *part = report_arena_strndup(arena, "java.lang.Error", 4);
+    ck_assert(part != NULL);
+    ck_assert_str_eq(part, "java");
+
+    /* memory is aligned for any type and allocations do not overlap */
+    char *prev = NULL;
+    for (size_t size = 1; size < 100000; size = size * 3 + 1)
+    {
+        char *mem = (char *)report_arena_alloc(arena, size);
+        ck_assert(mem != NULL);
+        ck_assert_uint_eq((uintptr_t)mem % 16, 0);
+        memset(mem, 'x', size);
+        if (NULL != prev)
+        {
+            ck_assert(prev[0] == 'x');
+        }
+        prev = mem;
+    }
+
+    ck_assert_str_eq(small, "Caught exception");
+
+    /* the thread gets back its released arena */
+    report_arena_release(arena);
+    T_reportArena *reused = report_arena_acquire();
+    ck_assert(reused == arena);
+
+    /* more arenas than the thread keeps */
+    T_reportArena *arenas[16];
+    for (size_t i = 0; i < sizeof(arenas)/sizeof(arenas[0]); ++i)
+    {
+        arenas[i] = report_arena_acquire();
+        ck_assert(arenas[i] != NULL);
+        ck_assert(report_arena_alloc(arenas[i], 64) != NULL);
+    }
+    for (size_t i = 0; i < sizeof(arenas)/sizeof(arenas[0]); ++i)
+    {
+        report_arena_release(arenas[i]);
+    }
+
+    report_arena_release(reused);
+    report_arena_release(NULL);
+    report_arena_cleanup();
+}
+END_TEST
+
+typedef struct {
+    int listener;
+    int problems;
+    int valid;
+} T_abrtdStandIn;
+
+/* Accepts problems like abrtd does and checks their contents */
+static void *abrtd_stand_in_run(void *arg)
+{
+    T_abrtdStandIn *abrtd = (T_abrtdStandIn *)arg;
+    for (int i = 0; i < abrtd->problems; ++i)
+    {
+        const int fd = accept(abrtd->listener, NULL, NULL);
+        if (0 > fd)
+        {
+            break;
+        }
+
+        char data[1024];
+        size_t length = 0;
+        ssize_t r;
+        while (0 < (r = read(fd, data + length, sizeof(data) - length)))
+        {
+            length += (size_t)r;
+        }
+
+        const char expected[] = "POST / HTTP/1.1\r\n\r\ntype=Java\0reason=Exception\0";
+        if (length == sizeof(expected) - 1 && 0 == memcmp(data, expected, length))
+        {
+            ++abrtd->valid;
+        }
+
+        const char response[] = "HTTP/1.1 201 Created\r\n\r\n";
+        if (0 > write(fd, response, sizeof(response) - 1))
+        {
+            perror("write");
+        }
+        close(fd);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_abrt_socket_submit_flush)
+{
+    char dir[] = "/tmp/abrt-socket-XXXXXX";
+    ck_assert(NULL != mkdtemp(dir));
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s/abrt.socket", dir);
+
+    T_abrtdStandIn abrtd = { .problems = 12, .valid = 0 };
+    abrtd.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    ck_assert(0 <= abrtd.listener);
+    ck_assert_int_eq(bind(abrtd.listener, (struct sockaddr *)&address, sizeof(address)), 0);
+    ck_assert_int_eq(listen(abrtd.listener, 16), 0);
+
+    pthread_t thread;
+    ck_assert_int_eq(pthread_create(&thread, NULL, abrtd_stand_in_run, &abrtd), 0);
+
+    T_stringBuilder *problem = string_builder_new(32);
+    ck_assert(NULL != problem);
+    ck_assert_int_eq(abrt_socket_append_item(problem, "type", "Java"), 0);
+    ck_assert_int_eq(abrt_socket_append_item(problem, "reason", "Exception"), 0);
+    /* a failed item leaves the problem untouched */
+    ck_assert_int_ne(abrt_socket_append_item(problem, "backtrace", "at Main.main(Main.java:1)"), 0);
+    ck_assert_uint_eq(string_builder_length(problem), strlen("type=Java") + strlen("reason=Exception") + 2);
+
+    T_abrtSocket *sock = abrt_socket_new(address.sun_path, 64, 10);
+    ck_assert(NULL != sock);
+
+    for (int i = 0; i < abrtd.problems; ++i)
+    {
+        ck_assert_int_eq(abrt_socket_submit(sock, string_builder_cstr(problem), string_builder_length(problem)), 0);
+    }
+
+    ck_assert_int_eq(abrt_socket_flush(sock, 10000), 0);
+    ck_assert_int_eq(abrt_socket_close(sock, 1000), 0);
+    /* closing is idempotent and closed socket refuses problems */
+    ck_assert_int_eq(abrt_socket_close(sock, 0), 0);
+    ck_assert_int_ne(abrt_socket_submit(sock, string_builder_cstr(problem), string_builder_length(problem)), 0);
+
+    T_abrtSocketStats stats;
+    abrt_socket_get_stats(sock, &stats);
+    ck_assert_uint_eq(stats.submitted, (size_t)abrtd.problems);
+    ck_assert_uint_eq(stats.delivered, (size_t)abrtd.problems);
+    ck_assert_uint_eq(stats.rejected, 0);
+    ck_assert_uint_eq(stats.dropped, 1);
+
+    pthread_join(thread, NULL);
+    ck_assert_int_eq(abrtd.valid, abrtd.problems);
+
+    abrt_socket_free(sock);
+    string_builder_free(problem);
+    close(abrtd.listener);
+    unlink(address.sun_path);
+    rmdir(dir);
+}
+END_TEST
+
+START_TEST(test_abrt_socket_unavailable)
+{
+    T_abrtSocket *sock = abrt_socket_new("/nonexistent/abrt.socket", 2, 0);
+    ck_assert(NULL != sock);
+
+    const char problem[] = "type=Java";
+    for (int i = 0; i < 3; ++i)
+    {
+        abrt_socket_submit(sock, problem, sizeof(problem));
+    }
+
+    /* problems wait for abrtd */
+    ck_assert_int_ne(abrt_socket_flush(sock, 50), 0);
+    ck_assert_int_eq(abrt_socket_close(sock, 1000), 0);
+
+    T_abrtSocketStats stats;
+    abrt_socket_get_stats(sock, &stats);
+    ck_assert_uint_eq(stats.submitted, 2);
+    ck_assert_uint_eq(stats.delivered, 0);
+    ck_assert_uint_eq(stats.dropped, 3);
+    ck_assert(stats.connect_failures > 0);
+
+    abrt_socket_free(sock);
+}
+END_TEST
+
+START_TEST(test_report_limiter_suppress)
+{
+    /* a token every 100ms */
+    T_reportLimiter *limiter = report_limiter_new(600, 2);
+    ck_assert(NULL != limiter);
+
+    const uint64_t signature = UINT64_C(0x1d5c3a9e7f2b4010);
+    size_t suppressed = 42;
+
+    ck_assert(report_limiter_acquire(limiter, signature, &suppressed));
+    ck_assert_uint_eq(suppressed, 0);
+    ck_assert(report_limiter_acquire(limiter, signature, &suppressed));
+    for (int i = 0; i < 5; ++i)
+    {
+        ck_assert(!report_limiter_acquire(limiter, signature, &suppressed));
+    }
+
+    /* other signatures have their own tokens */
+    ck_assert(report_limiter_acquire(limiter, signature + 1, &suppressed));
+    ck_assert(report_limiter_acquire(limiter, signature ^ (UINT64_C(1) << 63), &suppressed));
+    ck_assert(report_limiter_acquire(limiter, 1, &suppressed));
+
+    /* the next report carries the number of suppressed occurrences */
+    usleep(150 * 1000);
+    ck_assert(report_limiter_acquire(limiter, signature, &suppressed));
+    ck_assert_uint_eq(suppressed, 5);
+    ck_assert(!report_limiter_acquire(limiter, signature, &suppressed));
+
+    /* many signatures do not break the limiter */
+    for (uint64_t i = 1; i <= 10000; ++i)
+    {
+        ck_assert(report_limiter_acquire(limiter, i * UINT64_C(0x9E3779B97F4A7C15), &suppressed));
+    }
+
+    report_limiter_free(limiter);
+}
+END_TEST
+
+START_TEST(test_report_dedup_coalesce)
+{
+    T_reportDedup *dedup = report_dedup_new(2, 100);
+    ck_assert(NULL != dedup);
+
+    int first = 1;
+    int second = 2;
+    int third = 3;
+
+    report_dedup_attach(dedup);
+
+    /* the first occurrence opens a window, repeats are only counted */
+    ck_assert(report_dedup_occurred(dedup, 0x10));
+    ck_assert(!report_dedup_hold(dedup, 0x10, &first));
+    ck_assert(report_dedup_hold(dedup, 0x10, &third));
+    for (int i = 0; i < 4; ++i)
+    {
+        ck_assert(!report_dedup_occurred(dedup, 0x10));
+    }
+
+    /* a window without a held report is dropped */
+    ck_assert(report_dedup_occurred(dedup, 0x20));
+    ck_assert(!report_dedup_occurred(dedup, 0x20));
+
+    /* all windows are open */
+    ck_assert(report_dedup_occurred(dedup, 0x30));
+    ck_assert(report_dedup_hold(dedup, 0x30, &third));
+
+    T_reportDedupCounts counts;
+    ck_assert(&first == report_dedup_pop_expired(dedup, &counts));
+    ck_assert_uint_eq(counts.occurrences, 5);
+    ck_assert(counts.first_seen.tv_sec <= counts.last_seen.tv_sec);
+
+    /* the window is closed, the next occurrence opens a new one */
+    ck_assert(report_dedup_occurred(dedup, 0x10));
+    ck_assert(!report_dedup_hold(dedup, 0x10, &second));
+
+    /* closing releases reports of open windows at once */
+    ck_assert(report_dedup_close(dedup, 0));
+    ck_assert(&second == report_dedup_pop_expired(dedup, &counts));
+    ck_assert_uint_eq(counts.occurrences, 1);
+    ck_assert(NULL == report_dedup_pop_expired(dedup, &counts));
+
+    /* no more occurrences are counted */
+    ck_assert(report_dedup_occurred(dedup, 0x10));
+    ck_assert(report_dedup_hold(dedup, 0x10, &third));
+    ck_assert(NULL == report_dedup_try_pop(dedup));
+
+    ck_assert(!report_dedup_close(dedup, 0));
+    report_dedup_free(dedup);
+}
+END_TEST
+
 Suite *abrt_checker_suite(void)
 {
     Suite *s = suite_create ("abrt-checker");
@@ -120,8 +932,52 @@ Suite *abrt_checker_suite(void)
     tcase_add_test(tc_configuration, test_config_file_all_entries_populated);
     tcase_add_test(tc_configuration, test_command_line_conf_all_entries_populated);
     tcase_add_test(tc_configuration, test_conf_file_no_overwrite);
+    tcase_add_test(tc_configuration, test_options_invalid_values);
     suite_add_tcase(s, tc_configuration);
 
+    /* Report queue test case */
+    TCase *tc_report_queue = tcase_create("Report queue");
+    tcase_add_test(tc_report_queue, test_report_queue_order);
+    tcase_add_test(tc_report_queue, test_report_queue_overflow);
+    tcase_add_test(tc_report_queue, test_report_queue_deadlines);
+    suite_add_tcase(s, tc_report_queue);
+
+    /* Class index test case */
+    TCase *tc_class_index = tcase_create("Class index");
+    tcase_add_test(tc_class_index, test_class_index_add_find_sweep);
+    suite_add_tcase(s, tc_class_index);
+
+    /* Frame cache test case */
+    TCase *tc_frame_cache = tcase_create("Frame cache");
+    tcase_add_test(tc_frame_cache, test_frame_cache_lines_frames);
+    suite_add_tcase(s, tc_frame_cache);
+
+    /* String builder test case */
+    TCase *tc_string_builder = tcase_create("String builder");
+    tcase_add_test(tc_string_builder, test_string_builder_limit);
+    suite_add_tcase(s, tc_string_builder);
+
+    /* Report arena test case */
+    TCase *tc_report_arena = tcase_create("Report arena");
+    tcase_add_test(tc_report_arena, test_report_arena_alloc_release);
+    suite_add_tcase(s, tc_report_arena);
+
+    /* ABRT socket test case */
+    TCase *tc_abrt_socket = tcase_create("ABRT socket");
+    tcase_add_test(tc_abrt_socket, test_abrt_socket_submit_flush);
+    tcase_add_test(tc_abrt_socket, test_abrt_socket_unavailable);
+    suite_add_tcase(s, tc_abrt_socket);
+
+    /* Report limiter test case */
+    TCase *tc_report_limiter = tcase_create("Report limiter");
+    tcase_add_test(tc_report_limiter, test_report_limiter_suppress);
+    suite_add_tcase(s, tc_report_limiter);
+
+    /* Report deduplication test case */
+    TCase *tc_report_dedup = tcase_create("Report deduplication");
+    tcase_add_test(tc_report_dedup, test_report_dedup_coalesce);
+    suite_add_tcase(s, tc_report_dedup);
+
     return s;
 }
 
@@ -0,0 +1,400 @@
+/*
+    Copyright (C) 2014  Red Hat, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * Accepts problems like abrtd does, so the reporting path of the agent can be
+ * measured without a running abrtd. Problems are discarded or recorded as
+ * directories of files and the server can be slowed down or made to fail.
+ */
+
+#include <abrt/libabrt.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* The only request accepted by abrtd */
+#define REQUEST_HEADER "POST / HTTP/1.1\r\n"
+#define REQUEST_HEADER_END "\r\n\r\n"
+
+#define CREATED_RESPONSE "HTTP/1.1 201 Created\r\n\r\n"
+#define BAD_REQUEST_RESPONSE "HTTP/1.1 400 Bad Request\r\n\r\n"
+#define FAILURE_RESPONSE "HTTP/1.1 500 Internal Server Error\r\n\r\n"
+
+/* abrtd serves at most this number of clients at the same time */
+#define DEFAULT_CLIENTS 10
+
+/* Larger problems are refused */
+#define MAX_PROBLEM_SIZE (64 * 1024 * 1024)
+
+typedef struct
+{
+    int listener;
+    const char *record_dir;   ///< NULL if problems are discarded
+    unsigned latency_ms;      ///< time spent by "processing" of a problem
+    unsigned failures;        ///< percentage of refused valid problems
+    unsigned long count;      ///< exit after this number of problems, 0 never
+
+    pthread_mutex_t mutex;
+    unsigned long received;   ///< number of complete requests
+    unsigned long created;    ///< number of problems answered by 201
+    unsigned long failed;     ///< number of problems failed on purpose
+    unsigned long malformed;  ///< number of refused requests
+    unsigned long long bytes; ///< size of all requests
+    struct timespec first;    ///< when the first request was received
+    struct timespec last;     ///< when the last request was answered
+} stand_in_t;
+
+static double
+elapsed_seconds(const struct timespec *begin, const struct timespec *end)
+{
+    return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+static char *
+read_request(int fd, size_t *size)
+{
+    size_t capacity = 64 * 1024;
+    char *request = xmalloc(capacity);
+    *size = 0;
+
+    while (1)
+    {
+        if (*size == capacity)
+        {
+            if (capacity >= MAX_PROBLEM_SIZE)
+            {
+                error_msg("Problem data exceed %d bytes", MAX_PROBLEM_SIZE);
+                free(request);
+                return NULL;
+            }
+
+            capacity *= 2;
+            request = xrealloc(request, capacity);
+        }
+
+        const ssize_t r = read(fd, request + *size, capacity - *size);
+        if (0 > r && EINTR == errno)
+            continue;
+
+        if (0 > r)
+        {
+            perror_msg("Can't read problem data");
+            free(request);
+            return NULL;
+        }
+
+        if (0 == r)
+            return request;
+
+        *size += (size_t)r;
+    }
+}
+
+/*
+ * Checks that the request consists of the header and 'name=value\0' items
+ *
+ * @returns Pointer to the first item or NULL if the request is malformed
+ */
+static const char *
+parse_request(const char *request, size_t size, size_t *items)
+{
+    if (size < strlen(REQUEST_HEADER) || 0 != strncmp(request, REQUEST_HEADER, strlen(REQUEST_HEADER)))
+    {
+        error_msg("Unsupported request");
+        return NULL;
+    }
+
+    const char *data = memmem(request, size, REQUEST_HEADER_END, strlen(REQUEST_HEADER_END));
+    if (NULL == data)
+    {
+        error_msg("Unterminated request header");
+        return NULL;
+    }
+
+    data += strlen(REQUEST_HEADER_END);
+    const char *const end = request + size;
+
+    *items = 0;
+    for (const char *item = data; item < end; ++(*items))
+    {
+        const char *terminator = memchr(item, '\0', end - item);
+        const char *separator = memchr(item, '=', end - item);
+        if (NULL == terminator || NULL == separator || separator > terminator || separator == item)
+        {
+            error_msg("Malformed problem data item");
+            return NULL;
+        }
+
+        item = terminator + 1;
+    }
+
+    if (0 == *items)
+    {
+        error_msg("Empty problem data");
+        return NULL;
+    }
+
+    return data;
+}
+
+static void
+record_problem(const char *record_dir, unsigned long number, const char *data, const char *end)
+{
+    char *dir_name = xasprintf("%s/problem-%06lu", record_dir, number);
+    if (0 != mkdir(dir_name, S_IRWXU))
+    {
+        perror_msg("Can't create directory '%s'", dir_name);
+        free(dir_name);
+        return;
+    }
+
+    for (const char *item = data; item < end; item += strlen(item) + 1)
+    {
+        const char *separator = strchr(item, '=');
+        char *name = xstrndup(item, separator - item);
+        if (NULL != strchr(name, '/') || '.' == name[0])
+        {
+            error_msg("Not recording item '%s'", name);
+            free(name);
+            continue;
+        }
+
+        char *file_name = xasprintf("%s/%s", dir_name, name);
+        int fd = open(file_name, O_WRONLY | O_TRUNC | O_CREAT | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+        if (0 > fd)
+        {
+            perror_msg("Can't open file '%s' for writing", file_name);
+        }
+        else
+        {
+            full_write(fd, separator + 1, strlen(separator + 1));
+            close(fd);
+        }
+
+        free(file_name);
+        free(name);
+    }
+
+    free(dir_name);
+}
+
+static void
+serve_client(stand_in_t *server, int fd)
+{
+    size_t size = 0;
+    char *request = read_request(fd, &size);
+    if (NULL == request)
+        return;
+
+    /* Items are terminated by '\0', terminate the last one for sure */
+    request = xrealloc(request, size + 1);
+    request[size] = '\0';
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&server->mutex);
+    const unsigned long number = server->received++;
+    server->bytes += size;
+    if (0 == number)
+        server->first = now;
+    pthread_mutex_unlock(&server->mutex);
+
+    size_t items = 0;
+    const char *data = parse_request(request, size, &items);
+    const char *response = BAD_REQUEST_RESPONSE;
+    int fail = 0;
+    if (NULL != data)
+    {
+        /* Spread the failures evenly, e.g. every 10th problem for 10% */
+        fail = (number * server->failures) / 100 != ((number + 1) * server->failures) / 100;
+        response = fail ? FAILURE_RESPONSE : CREATED_RESPONSE;
+
+        log_debug("Problem %lu: %zu bytes, %zu items", number, size, items);
+
+        if (!fail && NULL != server->record_dir)
+            record_problem(server->record_dir, number, data, request + size);
+    }
+
+    if (0 != server->latency_ms)
+        usleep(server->latency_ms * 1000);
+
+    full_write(fd, response, strlen(response));
+    free(request);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&server->mutex);
+    server->last = now;
+    if (NULL == data)
+        ++server->malformed;
+    else if (fail)
+        ++server->failed;
+    else
+        ++server->created;
+
+    const int done = 0 != server->count && server->count == server->created + server->failed + server->malformed;
+    pthread_mutex_unlock(&server->mutex);
+
+    if (done)
+        kill(getpid(), SIGTERM);
+}
+
+static void *
+client_thread_run(void *arg)
+{
+    stand_in_t *server = (stand_in_t *)arg;
+
+    while (1)
+    {
+        const int fd = accept(server->listener, NULL, NULL);
+        if (0 > fd)
+        {
+            if (EINTR == errno || ECONNABORTED == errno)
+                continue;
+
+            perror_msg("Can't accept a client");
+            return NULL;
+        }
+
+        serve_client(server, fd);
+        close(fd);
+    }
+}
+
+static void
+print_summary(stand_in_t *server)
+{
+    pthread_mutex_lock(&server->mutex);
+
+    const double seconds = 0 != server->received ? elapsed_seconds(&server->first, &server->last) : 0;
+    printf("Received: %lu\n", server->received);
+    printf("Created: %lu\n", server->created);
+    printf("Failed: %lu\n", server->failed);
+    printf("Malformed: %lu\n", server->malformed);
+    printf("Bytes: %llu\n", server->bytes);
+    printf("Seconds: %.3f\n", seconds);
+    printf("Submissions/s: %.1f\n", seconds > 0 ? server->received / seconds : 0.0);
+    fflush(stdout);
+
+    pthread_mutex_unlock(&server->mutex);
+}
+
+int main(int argc, char *argv[])
+{
+    abrt_init(argv);
+
+    const char *socket_path = NULL;
+    const char *record_dir = NULL;
+    int latency_ms = 0;
+    int failures = 0;
+    int count = 0;
+    int clients = DEFAULT_CLIENTS;
+
+    const char *program_usage_string =
+        "& -s SOCKET [-r DIR] [-l MS] [-f PERCENT] [-n COUNT] [-c CLIENTS]\n"
+        "\n"
+        "Accepts problems on SOCKET like abrtd does and prints statistics of\n"
+        "the submissions when it is terminated\n";
+    enum {
+        OPT_v = 1 << 0,
+        OPT_s = 1 << 1,
+        OPT_r = 1 << 2,
+        OPT_l = 1 << 3,
+        OPT_f = 1 << 4,
+        OPT_n = 1 << 5,
+        OPT_c = 1 << 6,
+    };
+    /* Keep enum above and order of options below in sync! */
+    struct options program_options[] = {
+        OPT__VERBOSE(&g_verbose),
+        OPT_STRING('s', "socket", &socket_path, "SOCKET", "Path to the listening Unix socket"),
+        OPT_STRING('r', "record", &record_dir, "DIR", "Record problems as directories in DIR"),
+        OPT_INTEGER('l', "latency", &latency_ms, "Milliseconds spent by processing a problem"),
+        OPT_INTEGER('f', "failures", &failures, "Percentage of refused problems"),
+        OPT_INTEGER('n', "count", &count, "Exit after COUNT problems"),
+        OPT_INTEGER('c', "clients", &clients, "Number of clients served at once"),
+        { 0 }
+    };
+    program_options[ARRAY_SIZE(program_options) - 1].type = OPTION_END;
+
+    parse_opts(argc, argv, program_options, program_usage_string);
+
+    if (NULL == socket_path)
+        show_usage_and_die(program_usage_string, program_options);
+
+    if (0 > latency_ms || 0 > failures || 100 < failures || 0 > count || 0 >= clients)
+        error_msg_and_die("Option value out of range");
+
+    stand_in_t server = {
+        .record_dir = record_dir,
+        .latency_ms = latency_ms,
+        .failures = failures,
+        .count = count,
+    };
+    pthread_mutex_init(&server.mutex, NULL);
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+        error_msg_and_die("Too long socket path '%s'", socket_path);
+
+    strcpy(address.sun_path, socket_path);
+
+    server.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (0 > server.listener)
+        perror_msg_and_die("Can't create a socket");
+
+    unlink(socket_path);
+    if (0 != bind(server.listener, (struct sockaddr *)&address, sizeof(address))
+        || 0 != listen(server.listener, clients))
+        perror_msg_and_die("Can't listen on '%s'", socket_path);
+
+    /* Only the main thread handles the termination signals */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    for (int i = 0; i < clients; ++i)
+    {
+        pthread_t thread;
+        if (0 != pthread_create(&thread, NULL, client_thread_run, &server))
+            error_msg_and_die("Can't create a client thread");
+
+        pthread_detach(thread);
+    }
+
+    int signal_number = 0;
+    sigwait(&signals, &signal_number);
+
+    print_summary(&server);
+    unlink(socket_path);
+
+    return 0;
+}